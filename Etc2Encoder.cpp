@@ -0,0 +1,674 @@
+#include "Etc2Encoder.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <cmath>
+#include <climits>
+
+namespace
+{
+	const int BLOCK_SIZE = 4;
+	const int BLOCK_PIXELS = 16;
+	const int RGB_BLOCK_BYTES = 8;
+	const int ALPHA_BLOCK_BYTES = 8;
+
+	// smaller images are encoded on the calling thread.
+	const int BLOCK_ROWS_PER_TASK = 2;
+
+	// modifiers for the pixel index values 0 to 3 of every table.
+	const int COLOR_MODIFIERS[8][4] =
+	{
+		{ 2, 8, -2, -8 },
+		{ 5, 17, -5, -17 },
+		{ 9, 29, -9, -29 },
+		{ 13, 42, -13, -42 },
+		{ 18, 60, -18, -60 },
+		{ 24, 80, -24, -80 },
+		{ 33, 106, -33, -106 },
+		{ 47, 183, -47, -183 },
+	};
+
+	const int ALPHA_MODIFIERS[16][8] =
+	{
+		{ -3, -6, -9, -15, 2, 5, 8, 14 },
+		{ -3, -7, -10, -13, 2, 6, 9, 12 },
+		{ -2, -5, -8, -13, 1, 4, 7, 12 },
+		{ -2, -4, -6, -13, 1, 3, 5, 12 },
+		{ -3, -6, -8, -12, 2, 5, 7, 11 },
+		{ -3, -7, -9, -11, 2, 6, 8, 10 },
+		{ -4, -7, -8, -11, 3, 6, 7, 10 },
+		{ -3, -5, -8, -11, 2, 4, 7, 10 },
+		{ -2, -6, -8, -10, 1, 5, 7, 9 },
+		{ -2, -5, -8, -10, 1, 4, 7, 9 },
+		{ -2, -4, -8, -10, 1, 3, 7, 9 },
+		{ -2, -5, -7, -10, 1, 4, 6, 9 },
+		{ -3, -4, -7, -10, 2, 3, 6, 9 },
+		{ -1, -2, -3, -10, 0, 1, 2, 9 },
+		{ -4, -6, -8, -9, 3, 5, 7, 8 },
+		{ -3, -5, -7, -9, 2, 4, 6, 8 },
+	};
+
+	// a table whose modifiers include 0, for blocks of one alpha.
+	const int EXACT_ALPHA_TABLE = 13;
+
+	inline int clampByte(int pValue)
+	{
+		return pValue < 0 ? 0 : (pValue > 255 ? 255 : pValue);
+	}
+
+	inline int expand4(int pValue) { return (pValue << 4) | pValue; }
+	inline int expand5(int pValue) { return (pValue << 3) | (pValue >> 2); }
+	inline int expand6(int pValue) { return (pValue << 2) | (pValue >> 4); }
+	inline int expand7(int pValue) { return (pValue << 1) | (pValue >> 6); }
+
+	inline int signed3(int pValue) { return pValue >= 4 ? pValue - 8 : pValue; }
+
+	// pixel i of a block is column i / 4, row i % 4, like the index bits.
+	struct Block
+	{
+		int mColor[BLOCK_PIXELS][3];
+		int mAlpha[BLOCK_PIXELS];
+	};
+
+	void loadBlock(const unsigned char *pPixels, int pWidth, int pHeight, int pChannels, int pBlockX, int pBlockY,
+		Block & pBlock)
+	{
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			const int x = std::min(pBlockX * BLOCK_SIZE + i / BLOCK_SIZE, pWidth - 1);
+			const int y = std::min(pBlockY * BLOCK_SIZE + i % BLOCK_SIZE, pHeight - 1);
+			const unsigned char *pixel = pPixels + (static_cast<size_t>(y) * pWidth + x) * pChannels;
+			for (int c = 0; c < 3; c++)
+			{
+				pBlock.mColor[i][c] = pixel[c];
+			}
+			pBlock.mAlpha[i] = pChannels == 4 ? pixel[3] : 255;
+		}
+	}
+
+	inline int colorError(const int *pColor, int r, int g, int b)
+	{
+		const int dr = pColor[0] - r;
+		const int dg = pColor[1] - g;
+		const int db = pColor[2] - b;
+		return dr * dr + dg * dg + db * db;
+	}
+
+	// the pixels of the two halves of a block, side by side or (flipped) on top of each other.
+	void halfPixels(bool pFlip, int pHalf, int *pPixels)
+	{
+		int count = 0;
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			const int coordinate = pFlip ? i % BLOCK_SIZE : i / BLOCK_SIZE;
+			if ((coordinate >= 2) == (pHalf == 1))
+			{
+				pPixels[count++] = i;
+			}
+		}
+	}
+
+	// best table and pixel indices of one half around pBase (8 bit), error returned.
+	int fitHalf(const Block & pBlock, const int *pPixels, const int *pBase, int & pTable, int *pSelectors, int pBestError)
+	{
+		int bestError = pBestError;
+		int selectors[8];
+		for (int table = 0; table < 8; table++)
+		{
+			int error = 0;
+			for (int p = 0; p < 8 && error < bestError; p++)
+			{
+				const int *color = pBlock.mColor[pPixels[p]];
+				int best = INT_MAX;
+				for (int s = 0; s < 4; s++)
+				{
+					const int modifier = COLOR_MODIFIERS[table][s];
+					const int e = colorError(color, clampByte(pBase[0] + modifier), clampByte(pBase[1] + modifier),
+						clampByte(pBase[2] + modifier));
+					if (e < best)
+					{
+						best = e;
+						selectors[p] = s;
+					}
+				}
+				error += best;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pTable = table;
+				for (int p = 0; p < 8; p++)
+				{
+					pSelectors[pPixels[p]] = selectors[p];
+				}
+			}
+		}
+		return bestError;
+	}
+
+	struct HalfCandidate
+	{
+		int mBase[3];		// quantized, 4 or 5 bits
+		int mTable;
+		int mError;
+		int mSelectors[BLOCK_PIXELS];
+	};
+
+	// the quantized base colors tried for a half, the rounded average and
+	// with pSearch its neighbours.
+	void fitQuantizedHalf(const Block & pBlock, const int *pPixels, int pBits, bool pSearch,
+		const int *pFixedNeighbour, HalfCandidate & pCandidate)
+	{
+		const int levels = (1 << pBits) - 1;
+		int average[3];
+		for (int c = 0; c < 3; c++)
+		{
+			int sum = 0;
+			for (int p = 0; p < 8; p++)
+			{
+				sum += pBlock.mColor[pPixels[p]][c];
+			}
+			average[c] = static_cast<int>(floor(sum / 8.0f * levels / 255.0f + 0.5f));
+			// the second half of a differential block is a 3 bit offset from the first.
+			if (pFixedNeighbour)
+			{
+				average[c] = std::min(pFixedNeighbour[c] + 3, std::max(pFixedNeighbour[c] - 4, average[c]));
+			}
+		}
+
+		pCandidate.mError = INT_MAX;
+		const int range = pSearch ? 1 : 0;
+		for (int dr = -range; dr <= range; dr++)
+		{
+			for (int dg = -range; dg <= range; dg++)
+			{
+				for (int db = -range; db <= range; db++)
+				{
+					const int quantized[3] = { average[0] + dr, average[1] + dg, average[2] + db };
+					bool valid = true;
+					for (int c = 0; c < 3; c++)
+					{
+						valid = valid && quantized[c] >= 0 && quantized[c] <= levels;
+						valid = valid && (!pFixedNeighbour || (quantized[c] - pFixedNeighbour[c] >= -4
+							&& quantized[c] - pFixedNeighbour[c] <= 3));
+					}
+					if (!valid)
+					{
+						continue;
+					}
+					int base[3];
+					for (int c = 0; c < 3; c++)
+					{
+						base[c] = pBits == 4 ? expand4(quantized[c]) : expand5(quantized[c]);
+					}
+					int table = 0;
+					const int error = fitHalf(pBlock, pPixels, base, table, pCandidate.mSelectors, pCandidate.mError);
+					if (error < pCandidate.mError)
+					{
+						pCandidate.mError = error;
+						pCandidate.mTable = table;
+						for (int c = 0; c < 3; c++)
+						{
+							pCandidate.mBase[c] = quantized[c];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	unsigned long long packHalves(bool pDifferential, bool pFlip, const HalfCandidate & pFirst, const HalfCandidate & pSecond)
+	{
+		unsigned long long bits = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			const int shift = 59 - c * 8;
+			if (pDifferential)
+			{
+				bits |= static_cast<unsigned long long>(pFirst.mBase[c]) << shift;
+				bits |= static_cast<unsigned long long>((pSecond.mBase[c] - pFirst.mBase[c]) & 7) << (shift - 3);
+			}
+			else
+			{
+				bits |= static_cast<unsigned long long>(pFirst.mBase[c]) << (shift + 1);
+				bits |= static_cast<unsigned long long>(pSecond.mBase[c]) << (shift - 3);
+			}
+		}
+		bits |= static_cast<unsigned long long>(pFirst.mTable) << 37;
+		bits |= static_cast<unsigned long long>(pSecond.mTable) << 34;
+		bits |= static_cast<unsigned long long>(pDifferential ? 1 : 0) << 33;
+		bits |= static_cast<unsigned long long>(pFlip ? 1 : 0) << 32;
+
+		int half[BLOCK_PIXELS];
+		halfPixels(pFlip, 1, half);
+		int selectors[BLOCK_PIXELS];
+		std::copy(pFirst.mSelectors, pFirst.mSelectors + BLOCK_PIXELS, selectors);
+		for (int p = 0; p < 8; p++)
+		{
+			selectors[half[p]] = pSecond.mSelectors[half[p]];
+		}
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			bits |= static_cast<unsigned long long>(selectors[i] >> 1) << (16 + i);
+			bits |= static_cast<unsigned long long>(selectors[i] & 1) << i;
+		}
+		return bits;
+	}
+
+	// planar: origin, horizontal and vertical corner colors, interpolated.
+	void decodePlanar(const int *pOrigin, const int *pHorizontal, const int *pVertical, int pColors[BLOCK_PIXELS][3])
+	{
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			const int x = i / BLOCK_SIZE;
+			const int y = i % BLOCK_SIZE;
+			for (int c = 0; c < 3; c++)
+			{
+				pColors[i][c] = clampByte((x * (pHorizontal[c] - pOrigin[c]) + y * (pVertical[c] - pOrigin[c])
+					+ 4 * pOrigin[c] + 2) >> 2);
+			}
+		}
+	}
+
+	// 6, 7, 6 bit corner colors from a least squares plane through the block.
+	int fitPlanar(const Block & pBlock, int pCorners[3][3])
+	{
+		const int bits[3] = { 6, 7, 6 };
+		for (int c = 0; c < 3; c++)
+		{
+			float sum = 0, sumX = 0, sumY = 0;
+			for (int i = 0; i < BLOCK_PIXELS; i++)
+			{
+				const float value = static_cast<float>(pBlock.mColor[i][c]);
+				sum += value;
+				sumX += (i / BLOCK_SIZE - 1.5f) * value;
+				sumY += (i % BLOCK_SIZE - 1.5f) * value;
+			}
+			// x and y each take 0 to 3 four times, their squared deviations add up to 20.
+			const float slopeX = sumX / 20;
+			const float slopeY = sumY / 20;
+			const float origin = sum / BLOCK_PIXELS - 1.5f * slopeX - 1.5f * slopeY;
+			const float corners[3] = { origin, origin + 4 * slopeX, origin + 4 * slopeY };
+			const int levels = (1 << bits[c]) - 1;
+			for (int k = 0; k < 3; k++)
+			{
+				pCorners[k][c] = std::min(levels, std::max(0, static_cast<int>(floor(corners[k] * levels / 255.0f + 0.5f))));
+			}
+		}
+
+		int origin[3], horizontal[3], vertical[3];
+		for (int c = 0; c < 3; c++)
+		{
+			const bool seven = c == 1;
+			origin[c] = seven ? expand7(pCorners[0][c]) : expand6(pCorners[0][c]);
+			horizontal[c] = seven ? expand7(pCorners[1][c]) : expand6(pCorners[1][c]);
+			vertical[c] = seven ? expand7(pCorners[2][c]) : expand6(pCorners[2][c]);
+		}
+		int colors[BLOCK_PIXELS][3];
+		decodePlanar(origin, horizontal, vertical, colors);
+		int error = 0;
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			error += colorError(pBlock.mColor[i], colors[i][0], colors[i][1], colors[i][2]);
+		}
+		return error;
+	}
+
+	inline bool overflows(int pBase, int pDelta)
+	{
+		const int value = pBase + signed3(pDelta);
+		return value < 0 || value > 31;
+	}
+
+	// the 57 bits of the corners go around the differential mode fields, the
+	// free bits make red and green stay in range and blue overflow.
+	unsigned long long packPlanar(const int pCorners[3][3])
+	{
+		unsigned long long o[3], h[3], v[3];
+		for (int c = 0; c < 3; c++)
+		{
+			o[c] = static_cast<unsigned long long>(pCorners[0][c]);
+			h[c] = static_cast<unsigned long long>(pCorners[1][c]);
+			v[c] = static_cast<unsigned long long>(pCorners[2][c]);
+		}
+		unsigned long long bits = 0;
+		bits |= o[0] << 57;
+		bits |= ((o[1] >> 6) & 1) << 56;
+		bits |= (o[1] & 63) << 49;
+		bits |= ((o[2] >> 5) & 1) << 48;
+		bits |= ((o[2] >> 3) & 3) << 43;
+		bits |= (o[2] & 7) << 39;
+		bits |= (h[0] >> 1) << 34;
+		bits |= 1ULL << 33;
+		bits |= (h[0] & 1) << 32;
+		bits |= h[1] << 25;
+		bits |= h[2] << 19;
+		bits |= v[0] << 13;
+		bits |= v[1] << 6;
+		bits |= v[2];
+
+		if (overflows(static_cast<int>((bits >> 59) & 31), static_cast<int>((bits >> 56) & 7)))
+		{
+			bits |= 1ULL << 63;
+		}
+		if (overflows(static_cast<int>((bits >> 51) & 31), static_cast<int>((bits >> 48) & 7)))
+		{
+			bits |= 1ULL << 55;
+		}
+		const int blueLow = static_cast<int>((bits >> 43) & 3);
+		const int deltaLow = static_cast<int>((bits >> 40) & 3);
+		if (blueLow + deltaLow >= 4)
+		{
+			bits |= 7ULL << 45;
+		}
+		else
+		{
+			bits |= 1ULL << 42;
+		}
+		return bits;
+	}
+
+	unsigned long long encodeColorBlock(const Block & pBlock, Etc2Quality pQuality)
+	{
+		const bool search = pQuality == ETC2_QUALITY_HIGH;
+		unsigned long long bestBits = 0;
+		int bestError = INT_MAX;
+		for (int flip = 0; flip < 2; flip++)
+		{
+			int first[8], second[8];
+			halfPixels(flip != 0, 0, first);
+			halfPixels(flip != 0, 1, second);
+
+			HalfCandidate a, b;
+			fitQuantizedHalf(pBlock, first, 5, search, NULL, a);
+			fitQuantizedHalf(pBlock, second, 5, search, a.mBase, b);
+			if (b.mError != INT_MAX && a.mError + b.mError < bestError)
+			{
+				bestError = a.mError + b.mError;
+				bestBits = packHalves(true, flip != 0, a, b);
+			}
+
+			fitQuantizedHalf(pBlock, first, 4, search, NULL, a);
+			fitQuantizedHalf(pBlock, second, 4, search, NULL, b);
+			if (a.mError + b.mError < bestError)
+			{
+				bestError = a.mError + b.mError;
+				bestBits = packHalves(false, flip != 0, a, b);
+			}
+		}
+
+		if (search)
+		{
+			int corners[3][3];
+			const int error = fitPlanar(pBlock, corners);
+			if (error < bestError)
+			{
+				bestBits = packPlanar(corners);
+			}
+		}
+		return bestBits;
+	}
+
+	int fitAlpha(const int *pAlpha, int pBase, int pMultiplier, int pTable, int *pSelectors)
+	{
+		int error = 0;
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			int best = INT_MAX;
+			for (int s = 0; s < 8; s++)
+			{
+				const int d = clampByte(pBase + ALPHA_MODIFIERS[pTable][s] * pMultiplier) - pAlpha[i];
+				if (d * d < best)
+				{
+					best = d * d;
+					pSelectors[i] = s;
+				}
+			}
+			error += best;
+		}
+		return error;
+	}
+
+	unsigned long long encodeAlphaBlock(const Block & pBlock, Etc2Quality pQuality)
+	{
+		const int *alpha = pBlock.mAlpha;
+		const int low = *std::min_element(alpha, alpha + BLOCK_PIXELS);
+		const int high = *std::max_element(alpha, alpha + BLOCK_PIXELS);
+
+		int bestBase = low, bestMultiplier = 1, bestTable = EXACT_ALPHA_TABLE;
+		int bestSelectors[BLOCK_PIXELS];
+		int bestError = fitAlpha(alpha, low, 1, EXACT_ALPHA_TABLE, bestSelectors);
+		const int range = pQuality == ETC2_QUALITY_HIGH ? 2 : 0;
+		int selectors[BLOCK_PIXELS];
+		for (int table = 0; table < 16 && bestError > 0; table++)
+		{
+			const int spread = ALPHA_MODIFIERS[table][7] - ALPHA_MODIFIERS[table][3];
+			const int multiplier = std::max(1, std::min(15, (high - low + spread / 2) / spread));
+			// the middle of the table, between its largest negative and positive modifier.
+			const int center = (low + high + 1) / 2 - (ALPHA_MODIFIERS[table][7] + ALPHA_MODIFIERS[table][3]) * multiplier / 2;
+			for (int m = std::max(1, multiplier - range / 2); m <= std::min(15, multiplier + range / 2); m++)
+			{
+				for (int base = clampByte(center - range); base <= clampByte(center + range); base++)
+				{
+					const int error = fitAlpha(alpha, base, m, table, selectors);
+					if (error < bestError)
+					{
+						bestError = error;
+						bestBase = base;
+						bestMultiplier = m;
+						bestTable = table;
+						std::copy(selectors, selectors + BLOCK_PIXELS, bestSelectors);
+					}
+				}
+			}
+		}
+
+		unsigned long long bits = static_cast<unsigned long long>(bestBase) << 56;
+		bits |= static_cast<unsigned long long>(bestMultiplier) << 52;
+		bits |= static_cast<unsigned long long>(bestTable) << 48;
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			bits |= static_cast<unsigned long long>(bestSelectors[i]) << (45 - 3 * i);
+		}
+		return bits;
+	}
+
+	void storeBits(unsigned long long pBits, unsigned char *pOut)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			pOut[i] = static_cast<unsigned char>(pBits >> (56 - 8 * i));
+		}
+	}
+
+	unsigned long long loadBits(const unsigned char *pIn)
+	{
+		unsigned long long bits = 0;
+		for (int i = 0; i < 8; i++)
+		{
+			bits = (bits << 8) | pIn[i];
+		}
+		return bits;
+	}
+
+	void decodeColorBlock(unsigned long long pBits, int pColors[BLOCK_PIXELS][3])
+	{
+		const bool differential = ((pBits >> 33) & 1) != 0;
+		const bool flip = ((pBits >> 32) & 1) != 0;
+		int first[3], second[3];
+		for (int c = 0; c < 3; c++)
+		{
+			const int shift = 59 - c * 8;
+			if (differential)
+			{
+				const int base = static_cast<int>((pBits >> shift) & 31);
+				const int delta = static_cast<int>((pBits >> (shift - 3)) & 7);
+				if (overflows(base, delta))
+				{
+					// blue overflowing alone is planar, red or green are the t and h modes.
+					if (c == 2)
+					{
+						const unsigned long long b = pBits;
+						const int origin[3] = { expand6(static_cast<int>((b >> 57) & 63)),
+							expand7(static_cast<int>((((b >> 56) & 1) << 6) | ((b >> 49) & 63))),
+							expand6(static_cast<int>((((b >> 48) & 1) << 5) | (((b >> 43) & 3) << 3) | ((b >> 39) & 7))) };
+						const int horizontal[3] = { expand6(static_cast<int>((((b >> 34) & 31) << 1) | ((b >> 32) & 1))),
+							expand7(static_cast<int>((b >> 25) & 127)), expand6(static_cast<int>((b >> 19) & 63)) };
+						const int vertical[3] = { expand6(static_cast<int>((b >> 13) & 63)),
+							expand7(static_cast<int>((b >> 6) & 127)), expand6(static_cast<int>(b & 63)) };
+						decodePlanar(origin, horizontal, vertical, pColors);
+					}
+					else
+					{
+						memset(pColors, 0, sizeof(int) * BLOCK_PIXELS * 3);
+					}
+					return;
+				}
+				first[c] = expand5(base);
+				second[c] = expand5(base + signed3(delta));
+			}
+			else
+			{
+				first[c] = expand4(static_cast<int>((pBits >> (shift + 1)) & 15));
+				second[c] = expand4(static_cast<int>((pBits >> (shift - 3)) & 15));
+			}
+		}
+
+		const int tables[2] = { static_cast<int>((pBits >> 37) & 7), static_cast<int>((pBits >> 34) & 7) };
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			const int coordinate = flip ? i % BLOCK_SIZE : i / BLOCK_SIZE;
+			const int half = coordinate >= 2 ? 1 : 0;
+			const int selector = static_cast<int>((((pBits >> (16 + i)) & 1) << 1) | ((pBits >> i) & 1));
+			const int modifier = COLOR_MODIFIERS[tables[half]][selector];
+			const int *base = half ? second : first;
+			for (int c = 0; c < 3; c++)
+			{
+				pColors[i][c] = clampByte(base[c] + modifier);
+			}
+		}
+	}
+
+	void decodeAlphaBlock(unsigned long long pBits, int *pAlpha)
+	{
+		const int base = static_cast<int>(pBits >> 56);
+		const int multiplier = static_cast<int>((pBits >> 52) & 15);
+		const int table = static_cast<int>((pBits >> 48) & 15);
+		for (int i = 0; i < BLOCK_PIXELS; i++)
+		{
+			const int selector = static_cast<int>((pBits >> (45 - 3 * i)) & 7);
+			pAlpha[i] = clampByte(base + ALPHA_MODIFIERS[table][selector] * multiplier);
+		}
+	}
+
+	int blockBytes(int pChannels)
+	{
+		return pChannels == 4 ? ALPHA_BLOCK_BYTES + RGB_BLOCK_BYTES : RGB_BLOCK_BYTES;
+	}
+}
+
+GLenum getEtc2Format(int pChannels)
+{
+	return pChannels == 4 ? GL_COMPRESSED_RGBA8_ETC2_EAC : GL_COMPRESSED_RGB8_ETC2;
+}
+
+int getEtc2Size(int pWidth, int pHeight, int pChannels)
+{
+	return ((pWidth + BLOCK_SIZE - 1) / BLOCK_SIZE) * ((pHeight + BLOCK_SIZE - 1) / BLOCK_SIZE) * blockBytes(pChannels);
+}
+
+void encodeEtc2(const unsigned char *pPixels, int pWidth, int pHeight, int pChannels, Etc2Quality pQuality,
+	WorkerPool *pWorkerPool, std::vector<unsigned char> & pBlocks)
+{
+	const int blocksX = (pWidth + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	const int blocksY = (pHeight + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	const int bytes = blockBytes(pChannels);
+	pBlocks.resize(getEtc2Size(pWidth, pHeight, pChannels));
+
+	const std::function<void(int, int)> encodeRows = [&](int pBegin, int pEnd)
+	{
+		Block block;
+		for (int by = pBegin; by < pEnd; by++)
+		{
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				loadBlock(pPixels, pWidth, pHeight, pChannels, bx, by, block);
+				unsigned char *out = &pBlocks[(static_cast<size_t>(by) * blocksX + bx) * bytes];
+				if (pChannels == 4)
+				{
+					storeBits(encodeAlphaBlock(block, pQuality), out);
+					out += ALPHA_BLOCK_BYTES;
+				}
+				storeBits(encodeColorBlock(block, pQuality), out);
+			}
+		}
+	};
+
+	if (pWorkerPool && blocksY >= BLOCK_ROWS_PER_TASK * 2)
+	{
+		pWorkerPool->parallelFor(blocksY, BLOCK_ROWS_PER_TASK, encodeRows);
+	}
+	else
+	{
+		encodeRows(0, blocksY);
+	}
+}
+
+void decodeEtc2(const unsigned char *pBlocks, int pWidth, int pHeight, int pChannels, unsigned char *pPixels)
+{
+	const int blocksX = (pWidth + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	const int blocksY = (pHeight + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	const int bytes = blockBytes(pChannels);
+	int colors[BLOCK_PIXELS][3];
+	int alpha[BLOCK_PIXELS];
+	for (int by = 0; by < blocksY; by++)
+	{
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			const unsigned char *in = pBlocks + (static_cast<size_t>(by) * blocksX + bx) * bytes;
+			if (pChannels == 4)
+			{
+				decodeAlphaBlock(loadBits(in), alpha);
+				in += ALPHA_BLOCK_BYTES;
+			}
+			decodeColorBlock(loadBits(in), colors);
+
+			for (int i = 0; i < BLOCK_PIXELS; i++)
+			{
+				const int x = bx * BLOCK_SIZE + i / BLOCK_SIZE;
+				const int y = by * BLOCK_SIZE + i % BLOCK_SIZE;
+				if (x >= pWidth || y >= pHeight)
+				{
+					continue;
+				}
+				unsigned char *pixel = pPixels + (static_cast<size_t>(y) * pWidth + x) * pChannels;
+				for (int c = 0; c < 3; c++)
+				{
+					pixel[c] = static_cast<unsigned char>(colors[i][c]);
+				}
+				if (pChannels == 4)
+				{
+					pixel[3] = static_cast<unsigned char>(alpha[i]);
+				}
+			}
+		}
+	}
+}
+
+double measureEtc2PSNR(const unsigned char *pPixels, const unsigned char *pBlocks, int pWidth, int pHeight, int pChannels)
+{
+	const size_t count = static_cast<size_t>(pWidth) * pHeight * pChannels;
+	std::vector<unsigned char> decoded(count);
+	decodeEtc2(pBlocks, pWidth, pHeight, pChannels, &decoded[0]);
+	double sum = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		const double d = static_cast<double>(decoded[i]) - pPixels[i];
+		sum += d * d;
+	}
+	if (sum == 0)
+	{
+		return 99.0;
+	}
+	const double mse = sum / count;
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+
+class WorkerPool;
+
+// etc2 block compression of the decoded textures, on the cpu. the rgb part
+// uses the individual, differential and planar modes, the alpha of rgba
+// images an eac block in front of every rgb block.
+enum Etc2Quality
+{
+	ETC2_QUALITY_FAST,	// base colors from the averages, planar mode off
+	ETC2_QUALITY_HIGH,	// base colors searched around the averages, planar mode on
+};
+
+// GL_COMPRESSED_RGB8_ETC2 for 3 channels, GL_COMPRESSED_RGBA8_ETC2_EAC for 4.
+GLenum getEtc2Format(int pChannels);
+
+// bytes of the blocks of a pWidth x pHeight image.
+int getEtc2Size(int pWidth, int pHeight, int pChannels);
+
+// pChannels (3 or 4) bytes per pixel, packed rows. the blocks over the edges
+// of the image repeat the last column and row. split over pWorkerPool by
+// block rows, which may be NULL.
+void encodeEtc2(const unsigned char *pPixels, int pWidth, int pHeight, int pChannels, Etc2Quality pQuality,
+	WorkerPool *pWorkerPool, std::vector<unsigned char> & pBlocks);
+
+// the modes encodeEtc2 writes only, t and h mode blocks decode black.
+void decodeEtc2(const unsigned char *pBlocks, int pWidth, int pHeight, int pChannels, unsigned char *pPixels);
+
+// peak signal to noise ratio of the decoded blocks against pPixels, in db.
+double measureEtc2PSNR(const unsigned char *pPixels, const unsigned char *pBlocks, int pWidth, int pHeight, int pChannels);
@@ -0,0 +1,114 @@
+#include "FrameUniforms.h"
+#include "GameContext.h"
+#include "ShaderProgram.h"
+#include "GetPosition.h"
+#include "GLStateCache.h"
+
+FrameUniforms::FrameUniforms() : mBuffer(0)
+{
+	memset(&mFrameBlock, 0, sizeof(mFrameBlock));
+	memset(mModel, 0, sizeof(mModel));
+	memset(mNormal, 0, sizeof(mNormal));
+}
+
+FrameUniforms::~FrameUniforms()
+{
+	glDeleteBuffers(1, &mBuffer);
+}
+
+bool FrameUniforms::initialize()
+{
+	glGenBuffers(1, &mBuffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, mBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, mBuffer);
+	return mBuffer != 0;
+}
+
+void FrameUniforms::bindProgram(const ShaderProgram *pProgram) const
+{
+	const ShaderProgram::BlockInfo *block = pProgram->findBlock("FrameBlock");
+	if (!block)
+	{
+		cout << "error: program " << pProgram->programObject << " has no FrameBlock" << endl;
+		return;
+	}
+	if (block->mDataSize != sizeof(FrameBlock))
+	{
+		cout << "error: FrameBlock is " << block->mDataSize << " bytes in the shader, " << sizeof(FrameBlock) << " expected" << endl;
+	}
+	glUniformBlockBinding(pProgram->programObject, block->mIndex, FRAME_BLOCK_BINDING);
+}
+
+void FrameUniforms::update(const GameContext *gameContext)
+{
+	getFloatMatrix(gameContext->viewMatrix, mFrameBlock.mView);
+	getFloatMatrix(gameContext->proMatrix, mFrameBlock.mProjection);
+	getFloatMatrix(gameContext->proMatrix * gameContext->viewMatrix, mFrameBlock.mViewProjection);
+	for (int i = 0; i < 3; i++)
+	{
+		mFrameBlock.mEyePosition[i] = static_cast<GLfloat>(gameContext->eyePos[i]);
+	}
+	mFrameBlock.mEyePosition[3] = 1.0f;
+	if (gameContext->lightPosition && gameContext->lightColor)
+	{
+		memcpy(mFrameBlock.mLightPosition, gameContext->lightPosition, sizeof(mFrameBlock.mLightPosition));
+		memcpy(mFrameBlock.mLightColor, gameContext->lightColor, sizeof(mFrameBlock.mLightColor));
+	}
+
+	gameContext->mGLState->bindBuffer(GL_UNIFORM_BUFFER, mBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlock), &mFrameBlock);
+}
+
+void FrameUniforms::setModelMatrix(const ShaderProgram *pProgram, const FbxAMatrix & pModel, const GLfloat *pPositionDecode)
+{
+	computeModelMatrices(pModel, pPositionDecode, mModel, mNormal);
+	pProgram->setMatrix4(ShaderProgram::MODEL_MATRIX, mModel);
+	pProgram->setMatrix3(ShaderProgram::NORMAL_MATRIX, mNormal);
+}
+
+void FrameUniforms::computeModelMatrices(const FbxAMatrix & pModel, const GLfloat *pPositionDecode,
+	GLfloat *pModelOut, GLfloat *pNormalOut)
+{
+	const double *m = (const double *)pModel;
+	for (int i = 0; i < 16; i++)
+	{
+		pModelOut[i] = static_cast<GLfloat>(m[i]);
+	}
+	if (pPositionDecode)
+	{
+		// m * translate(offset) * scale(scale): the columns scale, the offset moves the origin.
+		for (int r = 0; r < 3; r++)
+		{
+			pModelOut[12 + r] = static_cast<GLfloat>(m[12 + r] + m[r] * pPositionDecode[0]
+				+ m[4 + r] * pPositionDecode[1] + m[8 + r] * pPositionDecode[2]);
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			for (int r = 0; r < 3; r++)
+			{
+				pModelOut[c * 4 + r] = static_cast<GLfloat>(m[c * 4 + r] * pPositionDecode[3 + c]);
+			}
+		}
+	}
+
+	// transpose(inverse(m3)), its columns are the cross products of the columns of m3.
+	const double *a = m, *b = m + 4, *c = m + 8;
+	const double bc[3] = { b[1] * c[2] - b[2] * c[1], b[2] * c[0] - b[0] * c[2], b[0] * c[1] - b[1] * c[0] };
+	const double ca[3] = { c[1] * a[2] - c[2] * a[1], c[2] * a[0] - c[0] * a[2], c[0] * a[1] - c[1] * a[0] };
+	const double ab[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+	const double determinant = a[0] * bc[0] + a[1] * bc[1] + a[2] * bc[2];
+	const double inverse = determinant != 0.0 ? 1.0 / determinant : 0.0;
+	for (int i = 0; i < 3; i++)
+	{
+		pNormalOut[i] = static_cast<GLfloat>(bc[i] * inverse);
+		pNormalOut[3 + i] = static_cast<GLfloat>(ca[i] * inverse);
+		pNormalOut[6 + i] = static_cast<GLfloat>(ab[i] * inverse);
+	}
+}
+
+void FrameUniforms::setModelMatrix(const ShaderProgram *pProgram, const GLfloat *pModel)
+{
+	pProgram->setMatrix4(ShaderProgram::MODEL_MATRIX, pModel);
+}
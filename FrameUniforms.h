@@ -0,0 +1,63 @@
+#pragma once
+#include "preh.h"
+
+class GameContext;
+class ShaderProgram;
+
+// declaration of the block for the shader sources, the same in every stage.
+#define FRAME_BLOCK_GLSL \
+	"layout(std140) uniform FrameBlock {									\n" \
+	"	highp mat4 viewMatrix;												\n" \
+	"	highp mat4 proMatrix;												\n" \
+	"	highp mat4 viewProjMatrix;											\n" \
+	"	highp vec4 view_position;											\n" \
+	"	highp vec4 light_position;											\n" \
+	"	highp vec4 light_color;												\n" \
+	"};																		\n"
+
+// the uniforms that are the same for every draw of a frame live in one
+// std140 uniform block (FrameBlock), uploaded once per frame. per draw only
+// the model and normal matrices are set, from storage owned by this class,
+// so a draw does no heap allocation.
+class FrameUniforms
+{
+public:
+	enum { FRAME_BLOCK_BINDING = 0 };
+
+	FrameUniforms();
+	~FrameUniforms();
+
+	// create the buffer, needs a current gl context.
+	bool initialize();
+
+	// point the FrameBlock of the program at the buffer.
+	void bindProgram(const ShaderProgram *pProgram) const;
+
+	void update(const GameContext *gameContext);
+
+	// pPositionDecode (offset and scale, see VBOMesh::getPositionDecode) may be NULL.
+	void setModelMatrix(const ShaderProgram *pProgram, const FbxAMatrix & pModel, const GLfloat *pPositionDecode = NULL);
+	void setModelMatrix(const ShaderProgram *pProgram, const GLfloat *pModel);
+
+	// pModel (times the position decode) as 16 floats and the normal matrix
+	// of pModel as 9 floats, both column major.
+	static void computeModelMatrices(const FbxAMatrix & pModel, const GLfloat *pPositionDecode,
+		GLfloat *pModelOut, GLfloat *pNormalOut);
+
+private:
+	// std140 layout, every member is a multiple of vec4.
+	struct FrameBlock
+	{
+		GLfloat mView[16];
+		GLfloat mProjection[16];
+		GLfloat mViewProjection[16];
+		GLfloat mEyePosition[4];
+		GLfloat mLightPosition[4];
+		GLfloat mLightColor[4];
+	};
+
+	GLuint mBuffer;
+	FrameBlock mFrameBlock;
+	GLfloat mModel[16];
+	GLfloat mNormal[9];
+};
@@ -0,0 +1,273 @@
+#include "GLStateCache.h"
+
+namespace
+{
+	// never a valid name or enum, the shadow does not know the gl state.
+	const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+	const GLenum BUFFER_TARGETS[] = { GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_PIXEL_UNPACK_BUFFER };
+	const GLenum CAPABILITIES[] = { GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_STENCIL_TEST, GL_POLYGON_OFFSET_FILL };
+	const GLenum TEXTURE_TARGETS[] = { GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY };
+}
+
+GLStateCache::GLStateCache() : mFrame(0)
+{
+	invalidate();
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+void GLStateCache::invalidate()
+{
+	mProgram = UNKNOWN;
+	for (int i = 0; i < BUFFER_TARGET_COUNT; i++)
+	{
+		mBuffers[i] = UNKNOWN;
+	}
+	mVertexArray = UNKNOWN;
+	mActiveTexture = UNKNOWN;
+	for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+	{
+		for (int i = 0; i < TEXTURE_TARGET_COUNT; i++)
+		{
+			mTextures[unit][i] = UNKNOWN;
+		}
+	}
+	for (int i = 0; i < CAPABILITY_COUNT; i++)
+	{
+		mCapabilities[i] = UNKNOWN;
+	}
+	forgetVertexArrayState();
+	mCullFace = UNKNOWN;
+	mDepthFunc = UNKNOWN;
+	mDepthMask = UNKNOWN;
+	mColorMask = UNKNOWN;
+}
+
+void GLStateCache::forgetVertexArrayState()
+{
+	mBuffers[getBufferTarget(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+	for (int i = 0; i < MAX_VERTEX_ATTRIBS; i++)
+	{
+		mVertexAttribArrays[i] = UNKNOWN;
+	}
+}
+
+void GLStateCache::beginFrame()
+{
+	++mFrame;
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+int GLStateCache::getBufferTarget(GLenum pTarget)
+{
+	for (int i = 0; i < BUFFER_TARGET_COUNT; i++)
+	{
+		if (BUFFER_TARGETS[i] == pTarget)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+int GLStateCache::getCapability(GLenum pCapability)
+{
+	for (int i = 0; i < CAPABILITY_COUNT; i++)
+	{
+		if (CAPABILITIES[i] == pCapability)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+int GLStateCache::getTextureTarget(GLenum pTarget)
+{
+	for (int i = 0; i < TEXTURE_TARGET_COUNT; i++)
+	{
+		if (TEXTURE_TARGETS[i] == pTarget)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool GLStateCache::change(GLuint & pShadow, GLuint pValue)
+{
+	if (pShadow == pValue)
+	{
+		++mStatistics.mElidedCount;
+		return false;
+	}
+	pShadow = pValue;
+	++mStatistics.mIssuedCount;
+	return true;
+}
+
+void GLStateCache::useProgram(GLuint pProgram)
+{
+	if (change(mProgram, pProgram))
+	{
+		glUseProgram(pProgram);
+	}
+}
+
+void GLStateCache::bindBuffer(GLenum pTarget, GLuint pBuffer)
+{
+	const int target = getBufferTarget(pTarget);
+	if (target < 0)
+	{
+		++mStatistics.mIssuedCount;
+		glBindBuffer(pTarget, pBuffer);
+	}
+	else if (change(mBuffers[target], pBuffer))
+	{
+		glBindBuffer(pTarget, pBuffer);
+	}
+}
+
+void GLStateCache::bindVertexArray(GLuint pVertexArray)
+{
+	if (change(mVertexArray, pVertexArray))
+	{
+		glBindVertexArray(pVertexArray);
+		forgetVertexArrayState();
+	}
+}
+
+void GLStateCache::activeTexture(GLenum pUnit)
+{
+	if (change(mActiveTexture, pUnit))
+	{
+		glActiveTexture(pUnit);
+	}
+}
+
+void GLStateCache::bindTexture(GLenum pTarget, GLuint pTexture)
+{
+	const int target = getTextureTarget(pTarget);
+	const int unit = mActiveTexture == UNKNOWN ? -1 : static_cast<int>(mActiveTexture - GL_TEXTURE0);
+	if (target < 0 || unit < 0 || unit >= MAX_TEXTURE_UNITS)
+	{
+		++mStatistics.mIssuedCount;
+		glBindTexture(pTarget, pTexture);
+	}
+	else if (change(mTextures[unit][target], pTexture))
+	{
+		glBindTexture(pTarget, pTexture);
+	}
+}
+
+void GLStateCache::setCapability(GLenum pCapability, bool pEnabled)
+{
+	const int capability = getCapability(pCapability);
+	if (capability >= 0 && !change(mCapabilities[capability], pEnabled ? 1 : 0))
+	{
+		return;
+	}
+	if (capability < 0)
+	{
+		++mStatistics.mIssuedCount;
+	}
+	if (pEnabled)
+	{
+		glEnable(pCapability);
+	}
+	else
+	{
+		glDisable(pCapability);
+	}
+}
+
+void GLStateCache::setVertexAttribArray(GLuint pIndex, bool pEnabled)
+{
+	if (pIndex < MAX_VERTEX_ATTRIBS && !change(mVertexAttribArrays[pIndex], pEnabled ? 1 : 0))
+	{
+		return;
+	}
+	if (pIndex >= MAX_VERTEX_ATTRIBS)
+	{
+		++mStatistics.mIssuedCount;
+	}
+	if (pEnabled)
+	{
+		glEnableVertexAttribArray(pIndex);
+	}
+	else
+	{
+		glDisableVertexAttribArray(pIndex);
+	}
+}
+
+void GLStateCache::cullFace(GLenum pMode)
+{
+	if (change(mCullFace, pMode))
+	{
+		glCullFace(pMode);
+	}
+}
+
+void GLStateCache::depthFunc(GLenum pFunction)
+{
+	if (change(mDepthFunc, pFunction))
+	{
+		glDepthFunc(pFunction);
+	}
+}
+
+void GLStateCache::depthMask(GLboolean pMask)
+{
+	if (change(mDepthMask, pMask))
+	{
+		glDepthMask(pMask);
+	}
+}
+
+void GLStateCache::colorMask(GLboolean pMask)
+{
+	if (change(mColorMask, pMask))
+	{
+		glColorMask(pMask, pMask, pMask, pMask);
+	}
+}
+
+void GLStateCache::deleteBuffers(GLsizei pCount, const GLuint *pBuffers)
+{
+	for (GLsizei i = 0; i < pCount; i++)
+	{
+		for (int target = 0; target < BUFFER_TARGET_COUNT; target++)
+		{
+			if (mBuffers[target] == pBuffers[i])
+			{
+				mBuffers[target] = 0;
+			}
+		}
+	}
+	glDeleteBuffers(pCount, pBuffers);
+}
+
+void GLStateCache::deleteTextures(GLsizei pCount, const GLuint *pTextures)
+{
+	for (GLsizei i = 0; i < pCount; i++)
+	{
+		for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+		{
+			for (int target = 0; target < TEXTURE_TARGET_COUNT; target++)
+			{
+				if (mTextures[unit][target] == pTextures[i])
+				{
+					mTextures[unit][target] = 0;
+				}
+			}
+		}
+	}
+	glDeleteTextures(pCount, pTextures);
+}
+
+void GLStateCache::printStatistics() const
+{
+	cout << "gl state: " << mStatistics.mIssuedCount << " calls issued, "
+		<< mStatistics.mElidedCount << " elided" << endl;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "preh.h"
+
+// shadow of the gl binding and capability state the renderer touches, so
+// calls that would not change anything are dropped before reaching the
+// driver. everything on the draw path must go through it, a direct gl call
+// leaves the shadow stale (call invalidate() after such code, e.g. loading).
+// the element buffer and the enabled attribute arrays belong to the vertex
+// array object, they become unknown when another one is bound.
+class GLStateCache
+{
+public:
+	struct Statistics
+	{
+		int mIssuedCount;
+		int mElidedCount;
+	};
+
+	GLStateCache();
+
+	// forget the shadow state, the next call of every kind is issued.
+	void invalidate();
+
+	void beginFrame();
+
+	void useProgram(GLuint pProgram);
+	void bindBuffer(GLenum pTarget, GLuint pBuffer);
+	void bindVertexArray(GLuint pVertexArray);
+	void activeTexture(GLenum pUnit);
+	// binds on the active unit.
+	void bindTexture(GLenum pTarget, GLuint pTexture);
+
+	void enable(GLenum pCapability) { setCapability(pCapability, true); }
+	void disable(GLenum pCapability) { setCapability(pCapability, false); }
+	void enableVertexAttribArray(GLuint pIndex) { setVertexAttribArray(pIndex, true); }
+	void disableVertexAttribArray(GLuint pIndex) { setVertexAttribArray(pIndex, false); }
+
+	void cullFace(GLenum pMode);
+	void depthFunc(GLenum pFunction);
+	void depthMask(GLboolean pMask);
+	void colorMask(GLboolean pMask);
+
+	// deleted names may come back from glGen*, they must not stay bound in the shadow.
+	void deleteBuffers(GLsizei pCount, const GLuint *pBuffers);
+	void deleteTextures(GLsizei pCount, const GLuint *pTextures);
+
+	const Statistics & getStatistics() const { return mStatistics; }
+	void printStatistics() const;
+	// frames begun so far.
+	int getFrame() const { return mFrame; }
+
+private:
+	enum
+	{
+		BUFFER_TARGET_COUNT = 4,
+		CAPABILITY_COUNT = 6,
+		TEXTURE_TARGET_COUNT = 2,
+		MAX_TEXTURE_UNITS = 16,
+		MAX_VERTEX_ATTRIBS = 16,
+	};
+
+	static int getBufferTarget(GLenum pTarget);
+	static int getCapability(GLenum pCapability);
+	static int getTextureTarget(GLenum pTarget);
+
+	void setCapability(GLenum pCapability, bool pEnabled);
+	void setVertexAttribArray(GLuint pIndex, bool pEnabled);
+
+	// true if the call must be issued, and count it either way.
+	bool change(GLuint & pShadow, GLuint pValue);
+	void forgetVertexArrayState();
+
+	GLuint mProgram;
+	GLuint mBuffers[BUFFER_TARGET_COUNT];
+	GLuint mVertexArray;
+	GLuint mActiveTexture;
+	GLuint mTextures[MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+	GLuint mCapabilities[CAPABILITY_COUNT];
+	GLuint mVertexAttribArrays[MAX_VERTEX_ATTRIBS];
+	GLuint mCullFace;
+	GLuint mDepthFunc;
+	GLuint mDepthMask;
+	GLuint mColorMask;
+	Statistics mStatistics;
+	int mFrame;
+};
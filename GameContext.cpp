@@ -2,6 +2,16 @@
 #include "ShaderProgram.h"
 #include "SceneContext.h"
 #include "Transform.h"
+#include "WorkerPool.h"
+#include "OcclusionCuller.h"
+#include "OcclusionQuery.h"
+#include "ScenePicker.h"
+#include "MeshletCuller.h"
+#include "FrameUniforms.h"
+#include "RenderQueue.h"
+#include "GLStateCache.h"
+#include "StaticBatcher.h"
+#include "TextureLoader.h"
 
 GLuint loadShader(GLenum type, const char *shaderSrc)
 {
@@ -116,7 +126,9 @@ GLuint loadProgram(const char *vertShaderSrc, const char *fragShaderSrc)
 }
 GameContext::GameContext(GLint pWidth, GLint pHeight)
 	:mWidth(pWidth), mHeight(pHeight),
-	mShaderProgram(NULL), mLightShaderProgram(NULL), mSceneContext(NULL),
+	lightPosition(NULL), lightColor(NULL),
+	mShaderProgram(NULL), mLightShaderProgram(NULL), mInstancedShaderProgram(NULL), mSceneContext(NULL),
+	mWorkerPool(NULL), mOcclusionCuller(NULL), mOcclusionQuery(NULL), mScenePicker(NULL), mMeshletCuller(NULL), mFrameUniforms(NULL), mRenderQueue(NULL), mGLState(NULL), mStaticBatcher(NULL), mTextureLoader(NULL),
 	eglNativeDisplay(NULL), eglNativeWindow(NULL),
 	eglDisplay(NULL), eglContext(NULL), eglSurface(NULL),
 	drawFunc(NULL), updateFunc(NULL), shutdownFunc(NULL), keyFunc(NULL),
@@ -144,11 +156,39 @@ GameContext::GameContext(GLint pWidth, GLint pHeight)
 			proMatrix.Set(i, j, projection.m[i][j]);
 		}
 	}
+
+	mWorkerPool = new WorkerPool();
+	// the software depth buffer keeps the aspect ratio of the window.
+	const int occlusionWidth = 256;
+	mOcclusionCuller = new OcclusionCuller(occlusionWidth, occlusionWidth * mHeight / mWidth);
+	mOcclusionQuery = new OcclusionQuery();
+	mScenePicker = new ScenePicker();
+	mMeshletCuller = new MeshletCuller();
+	mFrameUniforms = new FrameUniforms();
+	mRenderQueue = new RenderQueue();
+	mGLState = new GLStateCache();
+	mStaticBatcher = new StaticBatcher();
+	mTextureLoader = new TextureLoader(mWorkerPool, mGLState);
 }
 GameContext::~GameContext()
 {
 	delete mShaderProgram;
+	delete mInstancedShaderProgram;
+	if (mSceneContext)
+	{
+		mSceneContext->unloadTextures(this);
+	}
 	delete mSceneContext;
+	delete mOcclusionCuller;
+	delete mOcclusionQuery;
+	delete mScenePicker;
+	delete mMeshletCuller;
+	delete mFrameUniforms;
+	delete mRenderQueue;
+	delete mStaticBatcher;
+	delete mTextureLoader;
+	delete mGLState;
+	delete mWorkerPool;
 }
 
 void GameContext::setViewMatrix()
@@ -178,11 +218,6 @@ void GameContext::setViewMatrix()
 	upDir.Normalize();*/
 	
 	viewMatrix.SetLookAtRH(eyePos, lookAt, upDir);
-	if (mShaderProgram != NULL)
-	{
-		GLfloat eyePosition[] = { eyePos[0], eyePos[1], eyePos[2] };
-		glUniform3fv(glGetUniformLocation(mShaderProgram->programObject, "view_position"), 1, eyePosition);
-	}
 	
 	FbxVector4 eyeDir = lookAt - eyePos;
 	float eyeLength = eyeDir[0] * eyeDir[0] + eyeDir[1] * eyeDir[1] + eyeDir[2] * eyeDir[2];
@@ -205,74 +240,101 @@ bool GameContext::loadShaderProgram()
 {
 	mShaderProgram = new ShaderProgram();
 	mLightShaderProgram = new ShaderProgram();
+	mInstancedShaderProgram = new ShaderProgram();
 	char vShaderStr[] =
 		"#version 300 es														\n"
-		"uniform mat4 proMatrix;												\n"
+		FRAME_BLOCK_GLSL
 		"uniform mat4 modelMatrix;												\n"
-		"uniform mat4 viewMatrix;												\n"
+		"uniform mat3 normalMatrix;												\n"
+		"uniform vec4 uvTransform;												\n"
+		"uniform float textureLayer;											\n"
 		//"uniform vec4 a_color;													\n"
-		"uniform vec4 light_position;											\n"
-		"uniform vec4 view_position;											\n"
 		"layout(location = 0) in vec4 v_position;								\n"
 		"layout(location = 1) in vec3 v_normal;									\n"
 		"layout(location = 2) in vec2 v_text_cord;								\n"
 		//"out vec4 v_color;														\n"
 		"out vec2 text_cord;													\n"
+		"flat out float layer;													\n"
 		"out vec3 normal;														\n"
 		"out vec4 FragPos;														\n"
-		"out vec4 lightPos;														\n"
-		"out vec4 viewPos;														\n"
 		"void main()															\n"
 		"{																		\n"
-		"   gl_Position = proMatrix * viewMatrix * modelMatrix * v_position;	\n"
+		"	FragPos = modelMatrix * v_position;									\n"
+		"   gl_Position = viewProjMatrix * FragPos;								\n"
 		//"	v_color = a_color;													\n"
-		"	text_cord = v_text_cord;											\n"
+		"	text_cord = v_text_cord * uvTransform.xy + uvTransform.zw;			\n"
+		"	layer = textureLayer;												\n"
 		//"	l_color = light_color;												\n"
-		"	normal = mat3(transpose(inverse(modelMatrix))) * v_normal;			\n"
-		"	FragPos = vec4(modelMatrix * v_position);							\n"
-		"	lightPos = vec4(modelMatrix * light_position);						\n"
-		"	viewPos = vec4(modelMatrix * view_position);						\n"
+		"	normal = normalMatrix * v_normal;									\n"
+		"}																		\n";
+
+	// the same as above with the matrices and texture layer of the instance, see RenderQueue::INSTANCE_LOCATION.
+	char vInstancedShaderStr[] =
+		"#version 300 es														\n"
+		FRAME_BLOCK_GLSL
+		"layout(location = 0) in vec4 v_position;								\n"
+		"layout(location = 1) in vec3 v_normal;									\n"
+		"layout(location = 2) in vec2 v_text_cord;								\n"
+		"layout(location = 3) in mat4 instanceModelMatrix;						\n"
+		"layout(location = 7) in mat3 instanceNormalMatrix;						\n"
+		"layout(location = 10) in float instanceTextureLayer;					\n"
+		"uniform vec4 uvTransform;												\n"
+		"out vec2 text_cord;													\n"
+		"flat out float layer;													\n"
+		"out vec3 normal;														\n"
+		"out vec4 FragPos;														\n"
+		"void main()															\n"
+		"{																		\n"
+		"	FragPos = instanceModelMatrix * v_position;							\n"
+		"   gl_Position = viewProjMatrix * FragPos;								\n"
+		"	text_cord = v_text_cord * uvTransform.xy + uvTransform.zw;			\n"
+		"	layer = instanceTextureLayer;										\n"
+		"	normal = instanceNormalMatrix * v_normal;							\n"
 		"}																		\n";
 
 	char fShaderStr[] =
 		"#version 300 es														\n"
 		"precision mediump float;												\n"
+		FRAME_BLOCK_GLSL
 		"struct Material {														\n"
 		"	vec4 emissive;														\n"
 		"	vec4 ambient;														\n"
 		"	vec4 diffuse;														\n"
 		"	vec4 specular;														\n"
 		"	float shininess;													\n"
+		"	float textured;														\n"
 		"};																		\n"
 		"uniform Material material;												\n"
 		//"in vec4 v_color;														\n"
 		"in vec2 text_cord;														\n"
+		"flat in float layer;													\n"
 		"in vec3 normal;														\n"
 		"in vec4 FragPos;														\n"
-		"in vec4 lightPos;														\n"
-		"in vec4 viewPos;														\n"	
 		"out vec4 fragColor;													\n"
 		"uniform sampler2D our_texture;											\n"
-		"uniform vec4 light_color;												\n"
+		"uniform mediump sampler2DArray our_texture_array;						\n"
 		
 		
 		"void main()															\n"
 		"{																		\n"
 		"	vec4 emissive = light_color * material.emissive;					\n"
+		"	vec4 albedo = vec4(1.0);											\n"
+		"	if (material.textured > 0.5)										\n"
+		"		albedo = layer < 0.0 ? texture(our_texture, text_cord) : texture(our_texture_array, vec3(text_cord, layer));\n"
 		//"   fragColor = texture(ourTexture, text_cord) * v_color;				\n"
 		//"	float ambientStrength = 0.6;										\n"
 		//"	vec4 ambient = ambientStrength * light_color;						\n"
-		"	vec4 ambient = light_color * material.ambient;							\n"
+		"	vec4 ambient = light_color * material.ambient * albedo;				\n"
 
 		//"	float diffuseStrength = 0.5;										\n"
 		"	vec3 norm = normalize(normal);										\n"
-		"	vec3 lightDir = normalize(vec3(lightPos) - vec3(FragPos));	\n"
+		"	vec3 lightDir = normalize(vec3(light_position) - vec3(FragPos));	\n"
 		"	float diff = max(dot(norm, lightDir), 0.0);							\n"
 		//"	vec4 diffuse = diffuseStrength * diff * light_color;				\n"
-		"	vec4 diffuse = light_color * (diff * material.diffuse);"
+		"	vec4 diffuse = light_color * (diff * material.diffuse * albedo);"
 	
 		//"	float specularStrength = 0.5;										\n"
-		"	vec3 viewDir = normalize(vec3(viewPos) - vec3(FragPos));			\n"
+		"	vec3 viewDir = normalize(vec3(view_position) - vec3(FragPos));		\n"
 		"	vec3 halfDir = normalize(viewDir + lightDir);						\n"
 		"	float spec = pow(max(dot(norm, halfDir), 0.0), material.shininess);	\n"
 		
@@ -295,16 +357,33 @@ bool GameContext::loadShaderProgram()
 		//"   fragColor = texture(ourTexture, text_cord) * v_color;				\n"
 		"   fragColor = vec4(1.0, 0.0, 0.0, 1.0);				\n"
 		"}																		\n";
-	GLuint programObject, lightProgramObject;
+	GLuint programObject, lightProgramObject, instancedProgramObject;
 	// Create the program object
 	programObject = loadProgram(vShaderStr, fShaderStr);
 	lightProgramObject = loadProgram(vShaderStr, fLightShaderStr);
-	if (programObject == 0)
+	instancedProgramObject = loadProgram(vInstancedShaderStr, fShaderStr);
+	if (programObject == 0 || lightProgramObject == 0 || instancedProgramObject == 0)
 	{
 		return false;
 	}
-	mShaderProgram->programObject = programObject;
-	mLightShaderProgram->programObject = lightProgramObject;
+	// a uniform of the wrong type would leave its slot unresolved.
+	if (!mShaderProgram->reflect(programObject)
+		|| !mLightShaderProgram->reflect(lightProgramObject)
+		|| !mInstancedShaderProgram->reflect(instancedProgramObject))
+	{
+		return false;
+	}
+
+	// the array layers sample from unit 1, the other textures from unit 0.
+	mGLState->useProgram(programObject);
+	mShaderProgram->setInt(ShaderProgram::DIFFUSE_TEXTURE_ARRAY, 1);
+	mGLState->useProgram(instancedProgramObject);
+	mInstancedShaderProgram->setInt(ShaderProgram::DIFFUSE_TEXTURE_ARRAY, 1);
+
+	mFrameUniforms->initialize();
+	mFrameUniforms->bindProgram(mShaderProgram);
+	mFrameUniforms->bindProgram(mLightShaderProgram);
+	mFrameUniforms->bindProgram(mInstancedShaderProgram);
 
 
 	glEnable(GL_DEPTH_TEST);
@@ -312,7 +391,7 @@ bool GameContext::loadShaderProgram()
 	return true;
 }
 
-bool GameContext::loadScene(FbxString pFileName)
+bool GameContext::loadScene(FbxString pFileName, bool pPackVertices)
 {
 	try
 	{
@@ -326,6 +405,7 @@ bool GameContext::loadScene(FbxString pFileName)
 
 	if (mSceneContext->getSceneStatus() == SceneContext::MUST_BE_LOADED)
 	{
+		mSceneContext->setPackVertices(pPackVertices);
 		return mSceneContext->loadFile(this);
 	}
 	return false;
@@ -3,6 +3,16 @@
 
 class ShaderProgram;
 class SceneContext;
+class WorkerPool;
+class OcclusionCuller;
+class OcclusionQuery;
+class ScenePicker;
+class MeshletCuller;
+class FrameUniforms;
+class RenderQueue;
+class GLStateCache;
+class StaticBatcher;
+class TextureLoader;
 
 class GameContext
 {
@@ -23,7 +33,19 @@ public:
 	
 	ShaderProgram* mShaderProgram;
 	ShaderProgram* mLightShaderProgram;
+	// model and normal matrices come from per instance attributes.
+	ShaderProgram* mInstancedShaderProgram;
 	SceneContext* mSceneContext;
+	WorkerPool* mWorkerPool;
+	OcclusionCuller* mOcclusionCuller;
+	OcclusionQuery* mOcclusionQuery;
+	ScenePicker* mScenePicker;
+	MeshletCuller* mMeshletCuller;
+	FrameUniforms* mFrameUniforms;
+	RenderQueue* mRenderQueue;
+	GLStateCache* mGLState;
+	StaticBatcher* mStaticBatcher;
+	TextureLoader* mTextureLoader;
 
 	EGLNativeDisplayType eglNativeDisplay;
 	EGLNativeWindowType eglNativeWindow;
@@ -34,7 +56,8 @@ public:
 	FbxMatrix viewMatrix;
 	FbxMatrix proMatrix;
 	bool loadShaderProgram();
-	bool loadScene(FbxString pFileName);
+	// pPackVertices false loads the meshes in floats.
+	bool loadScene(FbxString pFileName, bool pPackVertices = true);
 	void setViewMatrix();
 	
 	void(*drawFunc) (GameContext *);
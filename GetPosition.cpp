@@ -68,4 +68,13 @@ FbxAMatrix getGeometry(FbxNode* pNode)
 	return FbxAMatrix(t, r, s);
 }
 
+void getFloatMatrix(const FbxMatrix & pMatrix, GLfloat *pResult)
+{
+	const double *values = (const double *)pMatrix;
+	for (int i = 0; i < 16; i++)
+	{
+		pResult[i] = static_cast<GLfloat>(values[i]);
+	}
+}
+
 
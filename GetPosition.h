@@ -9,4 +9,7 @@ FbxAMatrix getGlobalPosition(FbxNode *pNode,
 
 FbxAMatrix getPoseMatrix(FbxPose *pPose, int pNodeIndex);
 
-FbxAMatrix getGeometry(FbxNode *pNode);
\ No newline at end of file
+FbxAMatrix getGeometry(FbxNode *pNode);
+
+// copy to the column major float layout expected by glUniformMatrix4fv.
+void getFloatMatrix(const FbxMatrix & pMatrix, GLfloat *pResult);
\ No newline at end of file
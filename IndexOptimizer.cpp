@@ -0,0 +1,342 @@
+#include "IndexOptimizer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	const int TRIANGLE_VERTEX_COUNT = 3;
+
+	// a vertex is cached while fewer than pCacheSize misses came after its own.
+	// returns the misses of the triangle.
+	int simulateTriangle(const GLuint *pTriangle, std::vector<int> & pCacheTime, int & pTime, int pCacheSize)
+	{
+		int misses = 0;
+		for (int i = 0; i < TRIANGLE_VERTEX_COUNT; i++)
+		{
+			const GLuint vertex = pTriangle[i];
+			if (pTime - pCacheTime[vertex] > pCacheSize)
+			{
+				pCacheTime[vertex] = pTime;
+				++pTime;
+				++misses;
+			}
+		}
+		return misses;
+	}
+
+	// unnormalized normal, its length is twice the area.
+	void triangleCross(const GLfloat *p0, const GLfloat *p1, const GLfloat *p2, float *pCross)
+	{
+		const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		pCross[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		pCross[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		pCross[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+
+	struct ClusterOrder
+	{
+		float mKey;
+		int mCluster;
+
+		bool operator<(const ClusterOrder & pOther) const
+		{
+			return mKey > pOther.mKey;
+		}
+	};
+}
+
+void measureVertexCache(const GLuint *pIndices, int pTriangleCount, int pVertexCount, int pCacheSize,
+	VertexCacheStatistics & pStatistics)
+{
+	std::vector<int> cacheTime(pVertexCount, 0);
+	std::vector<bool> referenced(pVertexCount, false);
+	int time = pCacheSize + 1;
+	int misses = 0;
+	int referencedCount = 0;
+	for (int t = 0; t < pTriangleCount; t++)
+	{
+		misses += simulateTriangle(pIndices + t * TRIANGLE_VERTEX_COUNT, cacheTime, time, pCacheSize);
+		for (int i = 0; i < TRIANGLE_VERTEX_COUNT; i++)
+		{
+			const GLuint vertex = pIndices[t * TRIANGLE_VERTEX_COUNT + i];
+			if (!referenced[vertex])
+			{
+				referenced[vertex] = true;
+				++referencedCount;
+			}
+		}
+	}
+	pStatistics.mACMR = pTriangleCount > 0 ? static_cast<float>(misses) / pTriangleCount : 0.0f;
+	pStatistics.mATVR = referencedCount > 0 ? static_cast<float>(misses) / referencedCount : 0.0f;
+}
+
+void optimizeVertexCache(GLuint *pIndices, int pTriangleCount, int pVertexCount, int pCacheSize,
+	std::vector<int> *pClusters)
+{
+	if (pClusters)
+	{
+		pClusters->clear();
+	}
+	if (pTriangleCount == 0)
+	{
+		return;
+	}
+
+	const int indexCount = pTriangleCount * TRIANGLE_VERTEX_COUNT;
+	std::vector<int> firstTriangle(pVertexCount + 1, 0);
+	for (int i = 0; i < indexCount; i++)
+	{
+		++firstTriangle[pIndices[i] + 1];
+	}
+	for (int i = 0; i < pVertexCount; i++)
+	{
+		firstTriangle[i + 1] += firstTriangle[i];
+	}
+	std::vector<int> vertexTriangles(indexCount);
+	std::vector<int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (int i = 0; i < indexCount; i++)
+	{
+		vertexTriangles[fill[pIndices[i]]++] = i / TRIANGLE_VERTEX_COUNT;
+	}
+
+	// triangles not emitted yet around every vertex.
+	std::vector<int> liveCount(pVertexCount);
+	for (int i = 0; i < pVertexCount; i++)
+	{
+		liveCount[i] = firstTriangle[i + 1] - firstTriangle[i];
+	}
+
+	std::vector<int> cacheTime(pVertexCount, 0);
+	std::vector<bool> emitted(pTriangleCount, false);
+	std::vector<GLuint> deadEnds;
+	deadEnds.reserve(indexCount);
+	std::vector<GLuint> candidates;
+	std::vector<GLuint> output;
+	output.reserve(indexCount);
+	int time = pCacheSize + 1;
+	int cursor = 0;
+
+	if (pClusters)
+	{
+		pClusters->push_back(0);
+	}
+	int fanning = static_cast<int>(pIndices[0]);
+	while (fanning >= 0)
+	{
+		candidates.clear();
+		for (int i = firstTriangle[fanning]; i < firstTriangle[fanning + 1]; i++)
+		{
+			const int triangle = vertexTriangles[i];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+			for (int corner = 0; corner < TRIANGLE_VERTEX_COUNT; corner++)
+			{
+				const GLuint vertex = pIndices[triangle * TRIANGLE_VERTEX_COUNT + corner];
+				output.push_back(vertex);
+				deadEnds.push_back(vertex);
+				candidates.push_back(vertex);
+				--liveCount[vertex];
+				if (time - cacheTime[vertex] > pCacheSize)
+				{
+					cacheTime[vertex] = time;
+					++time;
+				}
+			}
+			emitted[triangle] = true;
+		}
+
+		// fan next around the oldest candidate that is still cached after its
+		// own fan is emitted, any candidate with live triangles otherwise.
+		int next = -1;
+		int bestPriority = -1;
+		for (size_t i = 0; i < candidates.size(); i++)
+		{
+			const GLuint vertex = candidates[i];
+			if (liveCount[vertex] == 0)
+			{
+				continue;
+			}
+			int priority = 0;
+			if (time - cacheTime[vertex] + 2 * liveCount[vertex] <= pCacheSize)
+			{
+				priority = time - cacheTime[vertex];
+			}
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				next = static_cast<int>(vertex);
+			}
+		}
+
+		// dead end: go back to the most recent vertex with live triangles.
+		while (next < 0 && !deadEnds.empty())
+		{
+			const GLuint vertex = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveCount[vertex] > 0)
+			{
+				next = static_cast<int>(vertex);
+			}
+		}
+
+		// nothing left nearby, the cache starts cold.
+		if (next < 0)
+		{
+			while (cursor < pVertexCount && liveCount[cursor] == 0)
+			{
+				++cursor;
+			}
+			if (cursor < pVertexCount)
+			{
+				next = cursor;
+				if (pClusters)
+				{
+					pClusters->push_back(static_cast<int>(output.size()) / TRIANGLE_VERTEX_COUNT);
+				}
+			}
+		}
+		fanning = next;
+	}
+
+	std::copy(output.begin(), output.end(), pIndices);
+}
+
+void optimizeOverdraw(GLuint *pIndices, int pTriangleCount, const GLfloat *pPositions, int pPositionStride,
+	int pVertexCount, const std::vector<int> & pClusters, int pCacheSize, float pThreshold)
+{
+	if (pTriangleCount == 0 || pClusters.empty())
+	{
+		return;
+	}
+
+	// a new cluster restarts the cache, allow it where the triangles so far
+	// already cost no more than pThreshold times the whole cluster.
+	std::vector<int> clusters;
+	std::vector<int> cacheTime(pVertexCount, 0);
+	int time = pCacheSize + 1;
+	for (size_t c = 0; c < pClusters.size(); c++)
+	{
+		const int begin = pClusters[c];
+		const int end = c + 1 < pClusters.size() ? pClusters[c + 1] : pTriangleCount;
+
+		time += pCacheSize + 1;
+		int misses = 0;
+		for (int t = begin; t < end; t++)
+		{
+			misses += simulateTriangle(pIndices + t * TRIANGLE_VERTEX_COUNT, cacheTime, time, pCacheSize);
+		}
+		const float limit = pThreshold * misses / (end - begin);
+
+		time += pCacheSize + 1;
+		clusters.push_back(begin);
+		int start = begin;
+		misses = 0;
+		for (int t = begin; t < end; t++)
+		{
+			misses += simulateTriangle(pIndices + t * TRIANGLE_VERTEX_COUNT, cacheTime, time, pCacheSize);
+			if (t + 1 < end && misses <= limit * (t + 1 - start))
+			{
+				clusters.push_back(t + 1);
+				start = t + 1;
+				misses = 0;
+				time += pCacheSize + 1;
+			}
+		}
+	}
+
+	// area weighted centroid and facing of every cluster and of the whole range.
+	const int clusterCount = static_cast<int>(clusters.size());
+	std::vector<float> centroids(clusterCount * 3, 0.0f);
+	std::vector<float> facings(clusterCount * 3, 0.0f);
+	std::vector<float> areas(clusterCount, 0.0f);
+	float center[3] = { 0, 0, 0 };
+	float totalArea = 0;
+	for (int c = 0; c < clusterCount; c++)
+	{
+		const int end = c + 1 < clusterCount ? clusters[c + 1] : pTriangleCount;
+		for (int t = clusters[c]; t < end; t++)
+		{
+			const GLuint *triangle = pIndices + t * TRIANGLE_VERTEX_COUNT;
+			const GLfloat *p0 = pPositions + triangle[0] * pPositionStride;
+			const GLfloat *p1 = pPositions + triangle[1] * pPositionStride;
+			const GLfloat *p2 = pPositions + triangle[2] * pPositionStride;
+			float cross[3];
+			triangleCross(p0, p1, p2, cross);
+			const float area = sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+			for (int axis = 0; axis < 3; axis++)
+			{
+				const float centroid = (p0[axis] + p1[axis] + p2[axis]) / 3;
+				centroids[c * 3 + axis] += centroid * area;
+				facings[c * 3 + axis] += cross[axis];
+				center[axis] += centroid * area;
+			}
+			areas[c] += area;
+			totalArea += area;
+		}
+	}
+	if (totalArea > 0)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			center[axis] /= totalArea;
+		}
+	}
+
+	std::vector<ClusterOrder> order(clusterCount);
+	for (int c = 0; c < clusterCount; c++)
+	{
+		float key = 0;
+		const float *facing = &facings[c * 3];
+		const float length = sqrt(facing[0] * facing[0] + facing[1] * facing[1] + facing[2] * facing[2]);
+		if (areas[c] > 0 && length > 0)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				key += (centroids[c * 3 + axis] / areas[c] - center[axis]) * facing[axis] / length;
+			}
+		}
+		order[c].mKey = key;
+		order[c].mCluster = c;
+	}
+	std::stable_sort(order.begin(), order.end());
+
+	std::vector<GLuint> sorted;
+	sorted.reserve(pTriangleCount * TRIANGLE_VERTEX_COUNT);
+	for (int i = 0; i < clusterCount; i++)
+	{
+		const int c = order[i].mCluster;
+		const int end = c + 1 < clusterCount ? clusters[c + 1] : pTriangleCount;
+		sorted.insert(sorted.end(), pIndices + clusters[c] * TRIANGLE_VERTEX_COUNT, pIndices + end * TRIANGLE_VERTEX_COUNT);
+	}
+	std::copy(sorted.begin(), sorted.end(), pIndices);
+}
+
+int optimizeVertexFetch(GLuint *pIndices, int pIndexCount, int pVertexCount, std::vector<int> & pSource)
+{
+	std::vector<int> remap(pVertexCount, -1);
+	pSource.clear();
+	for (int i = 0; i < pIndexCount; i++)
+	{
+		const GLuint vertex = pIndices[i];
+		if (remap[vertex] < 0)
+		{
+			remap[vertex] = static_cast<int>(pSource.size());
+			pSource.push_back(static_cast<int>(vertex));
+		}
+		pIndices[i] = static_cast<GLuint>(remap[vertex]);
+	}
+	return static_cast<int>(pSource.size());
+}
+
+void remapVertexAttribute(GLfloat *pData, int pStride, const std::vector<int> & pSource)
+{
+	std::vector<GLfloat> gathered(pSource.size() * pStride);
+	for (size_t i = 0; i < pSource.size(); i++)
+	{
+		std::copy(pData + pSource[i] * pStride, pData + (pSource[i] + 1) * pStride, &gathered[i * pStride]);
+	}
+	std::copy(gathered.begin(), gathered.end(), pData);
+}
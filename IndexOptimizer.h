@@ -0,0 +1,39 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+
+// the orderings target a fifo post transform cache of this many vertices,
+// the smallest one found on current gpus.
+enum { VERTEX_CACHE_SIZE = 16 };
+
+struct VertexCacheStatistics
+{
+	float mACMR;	// cache misses per triangle, 0.5 at best, 3 at worst
+	float mATVR;	// cache misses per referenced vertex, 1 at best
+};
+
+// run the triangles through a fifo cache of pCacheSize vertices.
+void measureVertexCache(const GLuint *pIndices, int pTriangleCount, int pVertexCount, int pCacheSize,
+	VertexCacheStatistics & pStatistics);
+
+// reorder the triangles for the vertex cache (tipsify: fan around the vertex
+// that is still cached, fall back on the recently used ones at dead ends).
+// pClusters, may be NULL, gets the first triangle of every run that starts
+// with a cold cache, beginning with 0.
+void optimizeVertexCache(GLuint *pIndices, int pTriangleCount, int pVertexCount, int pCacheSize,
+	std::vector<int> *pClusters);
+
+// split the clusters of optimizeVertexCache further where the cache cost of
+// a new start stays under pThreshold times the cluster ACMR, then sort the
+// clusters outer facing first, so that they tend to hide the inner ones
+// from any view.
+void optimizeOverdraw(GLuint *pIndices, int pTriangleCount, const GLfloat *pPositions, int pPositionStride,
+	int pVertexCount, const std::vector<int> & pClusters, int pCacheSize, float pThreshold);
+
+// number the vertices in order of first use in pIndices, which are rewritten.
+// pSource gets, for every new vertex, the vertex it was taken from, the
+// unreferenced vertices are dropped. returns the new vertex count.
+int optimizeVertexFetch(GLuint *pIndices, int pIndexCount, int pVertexCount, std::vector<int> & pSource);
+
+// gather pStride floats per vertex from pSource into the front of pData.
+void remapVertexAttribute(GLfloat *pData, int pStride, const std::vector<int> & pSource);
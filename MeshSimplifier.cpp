@@ -0,0 +1,366 @@
+#include "MeshSimplifier.h"
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// reject a collapse that turns a triangle more than this (cosine).
+	const double MIN_NORMAL_DOT = 0.2;
+
+	struct PositionKey
+	{
+		GLfloat x, y, z;
+
+		bool operator==(const PositionKey & pOther) const
+		{
+			return x == pOther.x && y == pOther.y && z == pOther.z;
+		}
+	};
+
+	struct PositionKeyHash
+	{
+		size_t operator()(const PositionKey & pKey) const
+		{
+			unsigned int bits[3];
+			memcpy(bits, &pKey, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	inline unsigned long long edgeKey(int a, int b)
+	{
+		if (a > b)
+		{
+			std::swap(a, b);
+		}
+		return (static_cast<unsigned long long>(a) << 32) | static_cast<unsigned int>(b);
+	}
+
+	void triangleNormal(const double *p0, const double *p1, const double *p2, double *pNormal)
+	{
+		const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		pNormal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		pNormal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		pNormal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+}
+
+void MeshSimplifier::Quadric::clear()
+{
+	for (int i = 0; i < 10; i++)
+	{
+		a[i] = 0;
+	}
+}
+
+void MeshSimplifier::Quadric::addPlane(double x, double y, double z, double d, double pWeight)
+{
+	a[0] += pWeight * x * x; a[1] += pWeight * x * y; a[2] += pWeight * x * z; a[3] += pWeight * x * d;
+	a[4] += pWeight * y * y; a[5] += pWeight * y * z; a[6] += pWeight * y * d;
+	a[7] += pWeight * z * z; a[8] += pWeight * z * d;
+	a[9] += pWeight * d * d;
+}
+
+void MeshSimplifier::Quadric::add(const Quadric& pOther)
+{
+	for (int i = 0; i < 10; i++)
+	{
+		a[i] += pOther.a[i];
+	}
+}
+
+double MeshSimplifier::Quadric::evaluate(const double* p) const
+{
+	const double x = p[0], y = p[1], z = p[2];
+	return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+		+ a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+		+ a[7] * z * z + 2 * a[8] * z
+		+ a[9];
+}
+
+MeshSimplifier::MeshSimplifier(const GLfloat* pPositions, int pPositionStride, int pVertexCount,
+	const GLfloat* pNormals, const GLfloat* pUVs)
+	: mPositions(pPositions), mPositionStride(pPositionStride), mVertexCount(pVertexCount),
+	mNormals(pNormals), mUVs(pUVs)
+{
+	weldPositions();
+}
+
+bool MeshSimplifier::sameAttributes(int a, int b) const
+{
+	if (mNormals && memcmp(mNormals + a * 3, mNormals + b * 3, 3 * sizeof(GLfloat)) != 0)
+	{
+		return false;
+	}
+	if (mUVs && memcmp(mUVs + a * 2, mUVs + b * 2, 2 * sizeof(GLfloat)) != 0)
+	{
+		return false;
+	}
+	return true;
+}
+
+void MeshSimplifier::weldPositions()
+{
+	mCanonical.resize(mVertexCount);
+	mSeam.assign(mVertexCount, false);
+
+	std::unordered_map<PositionKey, int, PositionKeyHash> firstVertex;
+	firstVertex.reserve(mVertexCount);
+	for (int i = 0; i < mVertexCount; i++)
+	{
+		const GLfloat *p = position(i);
+		const PositionKey key = { p[0], p[1], p[2] };
+		std::unordered_map<PositionKey, int, PositionKeyHash>::iterator it = firstVertex.find(key);
+		if (it == firstVertex.end())
+		{
+			firstVertex[key] = i;
+			mCanonical[i] = i;
+		}
+		else
+		{
+			mCanonical[i] = it->second;
+			if (!sameAttributes(i, it->second))
+			{
+				mSeam[it->second] = true;
+			}
+		}
+	}
+}
+
+float MeshSimplifier::simplify(const GLuint* pIndices, int pTriangleCount, int pTargetTriangleCount,
+	std::vector<GLuint>& pResult)
+{
+	// work on canonical (welded) vertices, keep the original corners aside.
+	std::vector<int> corners(pTriangleCount * 3);
+	std::vector<bool> triangleAlive(pTriangleCount, true);
+	std::vector<std::vector<int> > vertexTriangles(mVertexCount);
+	std::unordered_map<unsigned long long, int> edgeUse;
+	edgeUse.reserve(pTriangleCount * 3);
+
+	int aliveCount = 0;
+	for (int t = 0; t < pTriangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			corners[t * 3 + k] = mCanonical[pIndices[t * 3 + k]];
+		}
+		const int c0 = corners[t * 3], c1 = corners[t * 3 + 1], c2 = corners[t * 3 + 2];
+		if (c0 == c1 || c1 == c2 || c2 == c0)
+		{
+			triangleAlive[t] = false;
+			continue;
+		}
+		++aliveCount;
+		for (int k = 0; k < 3; k++)
+		{
+			vertexTriangles[corners[t * 3 + k]].push_back(t);
+			++edgeUse[edgeKey(corners[t * 3 + k], corners[t * 3 + (k + 1) % 3])];
+		}
+	}
+
+	// border vertices of the range (open borders and material boundaries) and seams stay.
+	std::vector<bool> locked(mVertexCount, false);
+	for (std::unordered_map<unsigned long long, int>::const_iterator it = edgeUse.begin(); it != edgeUse.end(); ++it)
+	{
+		if (it->second == 1)
+		{
+			locked[static_cast<int>(it->first >> 32)] = true;
+			locked[static_cast<int>(it->first & 0xFFFFFFFFu)] = true;
+		}
+	}
+
+	std::vector<Quadric> quadrics(mVertexCount);
+	for (int i = 0; i < mVertexCount; i++)
+	{
+		quadrics[i].clear();
+	}
+	std::vector<double> positions(mVertexCount * 3);
+	for (int i = 0; i < mVertexCount; i++)
+	{
+		const GLfloat *p = position(i);
+		positions[i * 3] = p[0];
+		positions[i * 3 + 1] = p[1];
+		positions[i * 3 + 2] = p[2];
+	}
+	for (int t = 0; t < pTriangleCount; t++)
+	{
+		if (!triangleAlive[t])
+		{
+			continue;
+		}
+		const double *p0 = &positions[corners[t * 3] * 3];
+		const double *p1 = &positions[corners[t * 3 + 1] * 3];
+		const double *p2 = &positions[corners[t * 3 + 2] * 3];
+		double normal[3];
+		triangleNormal(p0, p1, p2, normal);
+		const double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length <= 0.0)
+		{
+			continue;
+		}
+		normal[0] /= length;
+		normal[1] /= length;
+		normal[2] /= length;
+		const double d = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
+		for (int k = 0; k < 3; k++)
+		{
+			quadrics[corners[t * 3 + k]].addPlane(normal[0], normal[1], normal[2], d, 1.0);
+		}
+	}
+
+	std::vector<int> version(mVertexCount, 0);
+	std::vector<int> collapsedTo(mVertexCount, -1);
+	std::priority_queue<Collapse> heap;
+
+	// u moves onto v, the corners of u then take the attributes of v.
+	const auto pushCollapse = [&](int u, int v)
+	{
+		if (locked[u] || mSeam[u] || mSeam[v])
+		{
+			return;
+		}
+		Quadric quadric = quadrics[u];
+		quadric.add(quadrics[v]);
+		Collapse collapse;
+		collapse.mCost = quadric.evaluate(&positions[v * 3]);
+		collapse.mFrom = u;
+		collapse.mTo = v;
+		collapse.mFromVersion = version[u];
+		collapse.mToVersion = version[v];
+		heap.push(collapse);
+	};
+
+	for (std::unordered_map<unsigned long long, int>::const_iterator it = edgeUse.begin(); it != edgeUse.end(); ++it)
+	{
+		const int a = static_cast<int>(it->first >> 32);
+		const int b = static_cast<int>(it->first & 0xFFFFFFFFu);
+		pushCollapse(a, b);
+		pushCollapse(b, a);
+	}
+
+	double worstCost = 0.0;
+	while (aliveCount > pTargetTriangleCount && !heap.empty())
+	{
+		const Collapse collapse = heap.top();
+		heap.pop();
+		const int u = collapse.mFrom, v = collapse.mTo;
+		if (collapsedTo[u] >= 0 || collapsedTo[v] >= 0
+			|| version[u] != collapse.mFromVersion || version[v] != collapse.mToVersion)
+		{
+			continue;
+		}
+
+		// the triangles around u that survive must not flip.
+		bool flips = false;
+		bool sharesEdge = false;
+		const std::vector<int> & triangles = vertexTriangles[u];
+		for (size_t i = 0; i < triangles.size() && !flips; i++)
+		{
+			const int t = triangles[i];
+			if (!triangleAlive[t])
+			{
+				continue;
+			}
+			const int *c = &corners[t * 3];
+			if (c[0] == v || c[1] == v || c[2] == v)
+			{
+				sharesEdge = true;
+				continue;
+			}
+			double before[3], after[3];
+			const double *p[3], *q[3];
+			for (int k = 0; k < 3; k++)
+			{
+				p[k] = &positions[c[k] * 3];
+				q[k] = c[k] == u ? &positions[v * 3] : p[k];
+			}
+			triangleNormal(p[0], p[1], p[2], before);
+			triangleNormal(q[0], q[1], q[2], after);
+			const double lengths = sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2])
+				* sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+			const double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+			if (lengths <= 0.0 || dot < MIN_NORMAL_DOT * lengths)
+			{
+				flips = true;
+			}
+		}
+		if (flips || !sharesEdge)
+		{
+			continue;
+		}
+
+		collapsedTo[u] = v;
+		quadrics[v].add(quadrics[u]);
+		++version[v];
+		worstCost = std::max(worstCost, collapse.mCost);
+
+		for (size_t i = 0; i < triangles.size(); i++)
+		{
+			const int t = triangles[i];
+			if (!triangleAlive[t])
+			{
+				continue;
+			}
+			int *c = &corners[t * 3];
+			for (int k = 0; k < 3; k++)
+			{
+				if (c[k] == u)
+				{
+					c[k] = v;
+				}
+			}
+			if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0])
+			{
+				triangleAlive[t] = false;
+				--aliveCount;
+			}
+			else
+			{
+				vertexTriangles[v].push_back(t);
+			}
+		}
+
+		// the quadric of v changed, queue its edges again.
+		const std::vector<int> & around = vertexTriangles[v];
+		for (size_t i = 0; i < around.size(); i++)
+		{
+			const int t = around[i];
+			if (!triangleAlive[t])
+			{
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				const int w = corners[t * 3 + k];
+				if (w != v)
+				{
+					pushCollapse(v, w);
+					pushCollapse(w, v);
+				}
+			}
+		}
+	}
+
+	// a canonical vertex that did not move keeps its own corners, a moved one
+	// uses its target, whose corners all share the same attributes.
+	pResult.clear();
+	pResult.reserve(aliveCount * 3);
+	for (int t = 0; t < pTriangleCount; t++)
+	{
+		if (!triangleAlive[t])
+		{
+			continue;
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			const int original = static_cast<int>(pIndices[t * 3 + k]);
+			const int target = corners[t * 3 + k];
+			pResult.push_back(static_cast<GLuint>(target == mCanonical[original] ? original : target));
+		}
+	}
+
+	return static_cast<float>(sqrt(worstCost));
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+
+// quadric error metric edge collapse on an indexed triangle list.
+// the vertex buffer is never changed, a collapse moves every corner of one
+// vertex onto an existing vertex, so the simplified index lists can share
+// the vertex buffer of the full detail mesh.
+// vertices with the same position but different normal or uv (seams) and
+// vertices on the border of the triangle list never move, so simplifying
+// every material range on its own keeps the submesh boundaries intact.
+class MeshSimplifier
+{
+public:
+	// pNormals (3 floats) and pUVs (2 floats) may be NULL.
+	MeshSimplifier(const GLfloat *pPositions, int pPositionStride, int pVertexCount,
+		const GLfloat *pNormals, const GLfloat *pUVs);
+
+	// simplify pTriangleCount triangles down to about pTargetTriangleCount.
+	// the result replaces the content of pResult, the return value is the
+	// object space error of the worst collapse (0 if nothing collapsed).
+	float simplify(const GLuint *pIndices, int pTriangleCount, int pTargetTriangleCount,
+		std::vector<GLuint> & pResult);
+
+private:
+	struct Quadric
+	{
+		double a[10];	// symmetric 4x4, upper triangle
+
+		void clear();
+		void addPlane(double x, double y, double z, double d, double pWeight);
+		void add(const Quadric & pOther);
+		double evaluate(const double *p) const;
+	};
+
+	struct Collapse
+	{
+		double mCost;
+		int mFrom, mTo;
+		int mFromVersion, mToVersion;
+
+		bool operator<(const Collapse & pOther) const { return mCost > pOther.mCost; }
+	};
+
+	const GLfloat *position(int pVertex) const { return mPositions + pVertex * mPositionStride; }
+	bool sameAttributes(int a, int b) const;
+	void weldPositions();
+
+	const GLfloat *mPositions;
+	int mPositionStride;
+	int mVertexCount;
+	const GLfloat *mNormals;
+	const GLfloat *mUVs;
+
+	// vertex -> first vertex with the same position
+	std::vector<int> mCanonical;
+	// canonical vertex with corners of different attributes
+	std::vector<bool> mSeam;
+};
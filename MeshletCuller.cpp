@@ -0,0 +1,329 @@
+#include "MeshletCuller.h"
+#include "GameContext.h"
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+namespace
+{
+	const int MAX_MESHLET_TRIANGLES = 128;
+
+	// a triangle turned more than this from the meshlet facing (cosine) starts
+	// a new meshlet, unless the meshlet is still small.
+	const float MIN_MESHLET_NORMAL_DOT = 0.3f;
+	const int MIN_MESHLET_TRIANGLES = 64;
+
+	struct PositionKey
+	{
+		GLfloat x, y, z;
+
+		bool operator==(const PositionKey & pOther) const
+		{
+			return x == pOther.x && y == pOther.y && z == pOther.z;
+		}
+	};
+
+	struct PositionKeyHash
+	{
+		size_t operator()(const PositionKey & pKey) const
+		{
+			unsigned int bits[3];
+			memcpy(bits, &pKey, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	void triangleNormal(const GLfloat *p0, const GLfloat *p1, const GLfloat *p2, float *pNormal)
+	{
+		const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		pNormal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		pNormal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		pNormal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		const float length = sqrt(pNormal[0] * pNormal[0] + pNormal[1] * pNormal[1] + pNormal[2] * pNormal[2]);
+		if (length > 0)
+		{
+			pNormal[0] /= length;
+			pNormal[1] /= length;
+			pNormal[2] /= length;
+		}
+	}
+}
+
+void buildMeshlets(const GLfloat *pPositions, int pStride, GLuint *pIndices,
+	int pIndexOffset, int pTriangleCount, std::vector<Meshlet> & pMeshlets)
+{
+	GLuint *indices = pIndices + pIndexOffset;
+	const size_t firstMeshlet = pMeshlets.size();
+
+	// triangles are neighbours when they share a position, so meshes with
+	// split vertices (per polygon vertex normals and uvs) still connect.
+	std::vector<int> corners(pTriangleCount * 3);
+	std::unordered_map<PositionKey, int, PositionKeyHash> positionIds;
+	positionIds.reserve(pTriangleCount * 3);
+	for (int i = 0; i < pTriangleCount * 3; i++)
+	{
+		const GLfloat *p = pPositions + indices[i] * pStride;
+		const PositionKey key = { p[0], p[1], p[2] };
+		std::unordered_map<PositionKey, int, PositionKeyHash>::iterator it = positionIds.find(key);
+		if (it == positionIds.end())
+		{
+			it = positionIds.insert(std::make_pair(key, static_cast<int>(positionIds.size()))).first;
+		}
+		corners[i] = it->second;
+	}
+
+	const int positionCount = static_cast<int>(positionIds.size());
+	std::vector<int> firstTriangle(positionCount + 1, 0);
+	for (int i = 0; i < pTriangleCount * 3; i++)
+	{
+		++firstTriangle[corners[i] + 1];
+	}
+	for (int i = 0; i < positionCount; i++)
+	{
+		firstTriangle[i + 1] += firstTriangle[i];
+	}
+	std::vector<int> positionTriangles(pTriangleCount * 3);
+	std::vector<int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (int i = 0; i < pTriangleCount * 3; i++)
+	{
+		positionTriangles[fill[corners[i]]++] = i / 3;
+	}
+
+	std::vector<float> normals(pTriangleCount * 3);
+	for (int t = 0; t < pTriangleCount; t++)
+	{
+		triangleNormal(pPositions + indices[t * 3] * pStride, pPositions + indices[t * 3 + 1] * pStride,
+			pPositions + indices[t * 3 + 2] * pStride, &normals[t * 3]);
+	}
+
+	// grow every meshlet breadth first from the first unused triangle.
+	std::vector<bool> used(pTriangleCount, false);
+	std::vector<int> order;
+	order.reserve(pTriangleCount);
+	std::vector<int> frontier;
+	for (int seed = 0; seed < pTriangleCount; seed++)
+	{
+		if (used[seed])
+		{
+			continue;
+		}
+
+		const size_t meshletStart = order.size();
+		float axis[3] = { 0, 0, 0 };
+		frontier.clear();
+		frontier.push_back(seed);
+		used[seed] = true;
+		for (size_t next = 0; next < frontier.size() && order.size() - meshletStart < MAX_MESHLET_TRIANGLES; next++)
+		{
+			const int t = frontier[next];
+			const float *normal = &normals[t * 3];
+			const int count = static_cast<int>(order.size() - meshletStart);
+			const float axisLength = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+			if (count >= MIN_MESHLET_TRIANGLES && axisLength > 0
+				&& (normal[0] * axis[0] + normal[1] * axis[1] + normal[2] * axis[2]) < MIN_MESHLET_NORMAL_DOT * axisLength)
+			{
+				// leave it for a later meshlet.
+				used[t] = false;
+				continue;
+			}
+
+			order.push_back(t);
+			axis[0] += normal[0];
+			axis[1] += normal[1];
+			axis[2] += normal[2];
+
+			for (int k = 0; k < 3; k++)
+			{
+				const int position = corners[t * 3 + k];
+				for (int i = firstTriangle[position]; i < firstTriangle[position + 1]; i++)
+				{
+					const int neighbour = positionTriangles[i];
+					if (!used[neighbour])
+					{
+						used[neighbour] = true;
+						frontier.push_back(neighbour);
+					}
+				}
+			}
+		}
+		// the queued but unused triangles go back to the pool.
+		for (size_t i = 0; i < frontier.size(); i++)
+		{
+			used[frontier[i]] = false;
+		}
+		for (size_t i = meshletStart; i < order.size(); i++)
+		{
+			used[order[i]] = true;
+		}
+
+		Meshlet meshlet;
+		meshlet.mIndexOffset = pIndexOffset + static_cast<int>(meshletStart) * 3;
+		meshlet.mTriangleCount = static_cast<int>(order.size() - meshletStart);
+		pMeshlets.push_back(meshlet);
+	}
+
+	std::vector<GLuint> reordered(pTriangleCount * 3);
+	for (int i = 0; i < pTriangleCount; i++)
+	{
+		const int t = order[i];
+		reordered[i * 3] = indices[t * 3];
+		reordered[i * 3 + 1] = indices[t * 3 + 1];
+		reordered[i * 3 + 2] = indices[t * 3 + 2];
+	}
+	std::copy(reordered.begin(), reordered.end(), indices);
+
+	// bounds of the new meshlets.
+	for (size_t m = firstMeshlet; m < pMeshlets.size(); m++)
+	{
+		Meshlet & meshlet = pMeshlets[m];
+		const GLuint *meshletIndices = pIndices + meshlet.mIndexOffset;
+		const int indexCount = meshlet.mTriangleCount * 3;
+
+		float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		meshlet.mMinVertex = meshletIndices[0];
+		meshlet.mMaxVertex = meshletIndices[0];
+		for (int i = 0; i < indexCount; i++)
+		{
+			meshlet.mMinVertex = std::min(meshlet.mMinVertex, meshletIndices[i]);
+			meshlet.mMaxVertex = std::max(meshlet.mMaxVertex, meshletIndices[i]);
+			const GLfloat *p = pPositions + meshletIndices[i] * pStride;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				boundsMin[axis] = std::min(boundsMin[axis], p[axis]);
+				boundsMax[axis] = std::max(boundsMax[axis], p[axis]);
+			}
+		}
+		float radius = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			meshlet.mCenter[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+		}
+		for (int i = 0; i < indexCount; i++)
+		{
+			const GLfloat *p = pPositions + meshletIndices[i] * pStride;
+			const float d[3] = { p[0] - meshlet.mCenter[0], p[1] - meshlet.mCenter[1], p[2] - meshlet.mCenter[2] };
+			radius = std::max(radius, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		}
+		meshlet.mRadius = sqrt(radius);
+
+		float axis[3] = { 0, 0, 0 };
+		std::vector<float> meshletNormals(meshlet.mTriangleCount * 3);
+		for (int t = 0; t < meshlet.mTriangleCount; t++)
+		{
+			triangleNormal(pPositions + meshletIndices[t * 3] * pStride, pPositions + meshletIndices[t * 3 + 1] * pStride,
+				pPositions + meshletIndices[t * 3 + 2] * pStride, &meshletNormals[t * 3]);
+			axis[0] += meshletNormals[t * 3];
+			axis[1] += meshletNormals[t * 3 + 1];
+			axis[2] += meshletNormals[t * 3 + 2];
+		}
+		const float axisLength = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		meshlet.mConeCutoff = 2.0f;
+		meshlet.mConeAxis[0] = 0;
+		meshlet.mConeAxis[1] = 0;
+		meshlet.mConeAxis[2] = 0;
+		if (axisLength > 0)
+		{
+			float minDot = 1.0f;
+			for (int k = 0; k < 3; k++)
+			{
+				meshlet.mConeAxis[k] = axis[k] / axisLength;
+			}
+			for (int t = 0; t < meshlet.mTriangleCount; t++)
+			{
+				const float *normal = &meshletNormals[t * 3];
+				minDot = std::min(minDot, normal[0] * meshlet.mConeAxis[0] + normal[1] * meshlet.mConeAxis[1]
+					+ normal[2] * meshlet.mConeAxis[2]);
+			}
+			// the cone is only useful while every normal is less than 90 degrees from the axis.
+			if (minDot > 0)
+			{
+				meshlet.mConeCutoff = sqrt(1.0f - minDot * minDot);
+			}
+		}
+	}
+}
+
+MeshletCuller::MeshletCuller() : mEnabled(true)
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+void MeshletCuller::beginFrame()
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+void MeshletCuller::setupView(const GameContext *gameContext, const FbxAMatrix & pGlobalTransform, MeshletView & pView) const
+{
+	// planes of the clip matrix proj * view * model are already in object space.
+	const FbxMatrix clip = gameContext->proMatrix * gameContext->viewMatrix * FbxMatrix(pGlobalTransform);
+	const double *m = (const double *)clip;
+	for (int plane = 0; plane < 6; plane++)
+	{
+		const int row = plane / 2;
+		const double sign = plane % 2 == 0 ? 1.0 : -1.0;
+		for (int c = 0; c < 4; c++)
+		{
+			pView.mPlanes[plane][c] = m[c * 4 + 3] + sign * m[c * 4 + row];
+		}
+	}
+
+	const FbxVector4 eye = pGlobalTransform.Inverse().MultT(gameContext->eyePos);
+	pView.mEye[0] = eye[0];
+	pView.mEye[1] = eye[1];
+	pView.mEye[2] = eye[2];
+
+	const double *t = (const double *)pGlobalTransform;
+	const double determinant = t[0] * (t[5] * t[10] - t[9] * t[6])
+		- t[4] * (t[1] * t[10] - t[9] * t[2])
+		+ t[8] * (t[1] * t[6] - t[5] * t[2]);
+	pView.mTestBackFaces = determinant > 0;
+}
+
+bool MeshletCuller::isVisible(const MeshletView & pView, const Meshlet & pMeshlet)
+{
+	++mStatistics.mTestedCount;
+	const float *c = pMeshlet.mCenter;
+	for (int plane = 0; plane < 6; plane++)
+	{
+		const double *p = pView.mPlanes[plane];
+		const double distance = p[0] * c[0] + p[1] * c[1] + p[2] * c[2] + p[3];
+		if (distance < -pMeshlet.mRadius * sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]))
+		{
+			++mStatistics.mFrustumCulledCount;
+			mStatistics.mCulledTriangles += pMeshlet.mTriangleCount;
+			return false;
+		}
+	}
+
+	// every triangle faces away when the whole sphere is inside the back cone.
+	if (pView.mTestBackFaces && pMeshlet.mConeCutoff < 1.0f)
+	{
+		const double toCenter[3] = { c[0] - pView.mEye[0], c[1] - pView.mEye[1], c[2] - pView.mEye[2] };
+		const double distance = sqrt(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+		const double facing = toCenter[0] * pMeshlet.mConeAxis[0] + toCenter[1] * pMeshlet.mConeAxis[1]
+			+ toCenter[2] * pMeshlet.mConeAxis[2];
+		if (facing >= pMeshlet.mConeCutoff * distance + pMeshlet.mRadius)
+		{
+			++mStatistics.mBackFaceCulledCount;
+			mStatistics.mCulledTriangles += pMeshlet.mTriangleCount;
+			return false;
+		}
+	}
+
+	mStatistics.mDrawnTriangles += pMeshlet.mTriangleCount;
+	return true;
+}
+
+void MeshletCuller::printStatistics() const
+{
+	cout << "meshlets: " << mStatistics.mTestedCount << " tested, "
+		<< mStatistics.mFrustumCulledCount << " outside, "
+		<< mStatistics.mBackFaceCulledCount << " back facing, "
+		<< mStatistics.mDrawnTriangles << " triangles drawn, "
+		<< mStatistics.mCulledTriangles << " culled, "
+		<< mStatistics.mRangeCount << " ranges" << endl;
+}
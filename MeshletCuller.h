@@ -0,0 +1,66 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+
+class GameContext;
+
+// a run of about 64 to 128 connected triangles of one submesh, contiguous in
+// the index buffer, with the bounds used to cull it as a whole.
+struct Meshlet
+{
+	int mIndexOffset;
+	int mTriangleCount;
+	GLuint mMinVertex;		// vertex range for glDrawRangeElements
+	GLuint mMaxVertex;
+	float mCenter[3];		// object space bounding sphere
+	float mRadius;
+	float mConeAxis[3];		// average facing of the triangles
+	float mConeCutoff;		// sin of the widest normal angle to the axis, > 1 never backfacing
+};
+
+// the frustum planes and the eye of one draw in the object space of the mesh.
+struct MeshletView
+{
+	double mPlanes[6][4];
+	double mEye[3];
+	bool mTestBackFaces;	// false for mirrored transforms
+};
+
+// reorder the triangles of pIndices[pIndexOffset, pIndexOffset + 3 * pTriangleCount)
+// into meshlets grown over shared positions, appending them to pMeshlets.
+void buildMeshlets(const GLfloat *pPositions, int pStride, GLuint *pIndices,
+	int pIndexOffset, int pTriangleCount, std::vector<Meshlet> & pMeshlets);
+
+// per cluster frustum and backface culling of the meshlets of static meshes.
+class MeshletCuller
+{
+public:
+	struct Statistics
+	{
+		int mTestedCount;
+		int mFrustumCulledCount;
+		int mBackFaceCulledCount;
+		int mDrawnTriangles;
+		int mCulledTriangles;
+		int mRangeCount;		// glDrawRangeElements calls after merging neighbours
+	};
+
+	MeshletCuller();
+
+	void setEnabled(bool pEnabled) { mEnabled = pEnabled; }
+	bool isEnabled() const { return mEnabled; }
+
+	void beginFrame();
+
+	void setupView(const GameContext *gameContext, const FbxAMatrix & pGlobalTransform, MeshletView & pView) const;
+
+	bool isVisible(const MeshletView & pView, const Meshlet & pMeshlet);
+	void addRange() { ++mStatistics.mRangeCount; }
+
+	const Statistics & getStatistics() const { return mStatistics; }
+	void printStatistics() const;
+
+private:
+	bool mEnabled;
+	Statistics mStatistics;
+};
@@ -0,0 +1,286 @@
+#include "MipGenerator.h"
+#include "WorkerPool.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	const int MAX_CHANNELS = 4;
+
+	// kaiser taps on each side of the center of a destination texel.
+	const int KAISER_RADIUS = 4;
+	const int KAISER_TAPS = KAISER_RADIUS * 2;
+	const float KAISER_ALPHA = 4.0f;
+
+	// smaller levels are filtered on the calling thread.
+	const int ROWS_PER_TASK = 16;
+
+	const int LINEAR_TO_SRGB_SIZE = 4096;
+
+	// a float image, every pixel in one Float4 whatever the channel count.
+	struct FloatImage
+	{
+		int mWidth;
+		int mHeight;
+		std::vector<float> mPixels;
+
+		void resize(int pWidth, int pHeight)
+		{
+			mWidth = pWidth;
+			mHeight = pHeight;
+			mPixels.resize(static_cast<size_t>(pWidth) * pHeight * 4);
+		}
+		const float *pixel(int x, int y) const { return &mPixels[(static_cast<size_t>(y) * mWidth + x) * 4]; }
+		float *pixel(int x, int y) { return &mPixels[(static_cast<size_t>(y) * mWidth + x) * 4]; }
+	};
+
+	struct ColorTables
+	{
+		float mToLinear[256];
+		unsigned char mToSRGB[LINEAR_TO_SRGB_SIZE];
+
+		ColorTables()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				const float c = i / 255.0f;
+				mToLinear[i] = c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			for (int i = 0; i < LINEAR_TO_SRGB_SIZE; i++)
+			{
+				const float l = (i + 0.5f) / LINEAR_TO_SRGB_SIZE;
+				const float c = l <= 0.0031308f ? l * 12.92f : 1.055f * pow(l, 1.0f / 2.4f) - 0.055f;
+				mToSRGB[i] = static_cast<unsigned char>(std::min(255.0f, c * 255.0f + 0.5f));
+			}
+		}
+	};
+
+	const ColorTables & colorTables()
+	{
+		static const ColorTables sTables;
+		return sTables;
+	}
+
+	float besselI0(float x)
+	{
+		float sum = 1;
+		float term = 1;
+		for (int k = 1; k < 16; k++)
+		{
+			const float half = x / (2.0f * k);
+			term *= half * half;
+			sum += term;
+		}
+		return sum;
+	}
+
+	// weights of the source texels 2x - KAISER_RADIUS + 1 ... 2x + KAISER_RADIUS
+	// for destination texel x, a half band sinc under a kaiser window.
+	void kaiserWeights(float *pWeights)
+	{
+		float sum = 0;
+		for (int i = 0; i < KAISER_TAPS; i++)
+		{
+			const float x = i - KAISER_RADIUS + 0.5f;
+			const float t = static_cast<float>(PI) * x * 0.5f;
+			const float sinc = sin(t) / t;
+			const float r = x / KAISER_RADIUS;
+			const float window = besselI0(KAISER_ALPHA * sqrt(std::max(0.0f, 1 - r * r))) / besselI0(KAISER_ALPHA);
+			pWeights[i] = sinc * window;
+			sum += pWeights[i];
+		}
+		for (int i = 0; i < KAISER_TAPS; i++)
+		{
+			pWeights[i] /= sum;
+		}
+	}
+
+	void forRows(WorkerPool *pWorkerPool, int pRows, const std::function<void(int, int)> & pFunc)
+	{
+		if (pWorkerPool && pRows >= ROWS_PER_TASK * 2)
+		{
+			pWorkerPool->parallelFor(pRows, ROWS_PER_TASK, pFunc);
+		}
+		else
+		{
+			pFunc(0, pRows);
+		}
+	}
+
+	void decode(const unsigned char *pPixels, int pChannels, bool pSRGB, FloatImage & pImage, WorkerPool *pWorkerPool)
+	{
+		const ColorTables & tables = colorTables();
+		forRows(pWorkerPool, pImage.mHeight, [&](int pBegin, int pEnd)
+		{
+			for (int y = pBegin; y < pEnd; y++)
+			{
+				const unsigned char *src = pPixels + static_cast<size_t>(y) * pImage.mWidth * pChannels;
+				for (int x = 0; x < pImage.mWidth; x++, src += pChannels)
+				{
+					float *dst = pImage.pixel(x, y);
+					for (int c = 0; c < MAX_CHANNELS; c++)
+					{
+						if (c >= pChannels)
+						{
+							dst[c] = 0;
+						}
+						else if (pSRGB && c < 3)
+						{
+							dst[c] = tables.mToLinear[src[c]];
+						}
+						else
+						{
+							dst[c] = src[c] / 255.0f;
+						}
+					}
+				}
+			}
+		});
+	}
+
+	void encode(const FloatImage & pImage, int pChannels, bool pSRGB, MipLevel & pLevel, WorkerPool *pWorkerPool)
+	{
+		const ColorTables & tables = colorTables();
+		pLevel.mWidth = pImage.mWidth;
+		pLevel.mHeight = pImage.mHeight;
+		pLevel.mPixels.resize(static_cast<size_t>(pImage.mWidth) * pImage.mHeight * pChannels);
+		forRows(pWorkerPool, pImage.mHeight, [&](int pBegin, int pEnd)
+		{
+			for (int y = pBegin; y < pEnd; y++)
+			{
+				unsigned char *dst = &pLevel.mPixels[static_cast<size_t>(y) * pImage.mWidth * pChannels];
+				for (int x = 0; x < pImage.mWidth; x++, dst += pChannels)
+				{
+					const float *src = pImage.pixel(x, y);
+					for (int c = 0; c < pChannels; c++)
+					{
+						// the kaiser lobes overshoot a little.
+						const float value = std::min(1.0f, std::max(0.0f, src[c]));
+						if (pSRGB && c < 3)
+						{
+							dst[c] = tables.mToSRGB[std::min(LINEAR_TO_SRGB_SIZE - 1, static_cast<int>(value * LINEAR_TO_SRGB_SIZE))];
+						}
+						else
+						{
+							dst[c] = static_cast<unsigned char>(value * 255.0f + 0.5f);
+						}
+					}
+				}
+			}
+		});
+	}
+
+	// odd sizes clamp the last column and row into the average.
+	void downsampleBox(const FloatImage & pSrc, FloatImage & pDst, WorkerPool *pWorkerPool)
+	{
+		const Float4 quarter(0.25f);
+		forRows(pWorkerPool, pDst.mHeight, [&](int pBegin, int pEnd)
+		{
+			for (int y = pBegin; y < pEnd; y++)
+			{
+				const int y0 = std::min(y * 2, pSrc.mHeight - 1);
+				const int y1 = std::min(y * 2 + 1, pSrc.mHeight - 1);
+				for (int x = 0; x < pDst.mWidth; x++)
+				{
+					const int x0 = std::min(x * 2, pSrc.mWidth - 1);
+					const int x1 = std::min(x * 2 + 1, pSrc.mWidth - 1);
+					const Float4 sum = Float4::load(pSrc.pixel(x0, y0)) + Float4::load(pSrc.pixel(x1, y0))
+						+ Float4::load(pSrc.pixel(x0, y1)) + Float4::load(pSrc.pixel(x1, y1));
+					(sum * quarter).store(pDst.pixel(x, y));
+				}
+			}
+		});
+	}
+
+	// separable, the rows into pTemp first. clamped at the edges like the textures.
+	void downsampleKaiser(const FloatImage & pSrc, FloatImage & pTemp, FloatImage & pDst, const float *pWeights,
+		WorkerPool *pWorkerPool)
+	{
+		Float4 weights[KAISER_TAPS];
+		for (int i = 0; i < KAISER_TAPS; i++)
+		{
+			weights[i] = Float4(pWeights[i]);
+		}
+
+		pTemp.resize(pDst.mWidth, pSrc.mHeight);
+		forRows(pWorkerPool, pTemp.mHeight, [&](int pBegin, int pEnd)
+		{
+			for (int y = pBegin; y < pEnd; y++)
+			{
+				for (int x = 0; x < pTemp.mWidth; x++)
+				{
+					Float4 sum(0.0f);
+					for (int i = 0; i < KAISER_TAPS; i++)
+					{
+						const int sx = std::min(std::max(x * 2 - KAISER_RADIUS + 1 + i, 0), pSrc.mWidth - 1);
+						sum = sum + Float4::load(pSrc.pixel(sx, y)) * weights[i];
+					}
+					sum.store(pTemp.pixel(x, y));
+				}
+			}
+		});
+
+		forRows(pWorkerPool, pDst.mHeight, [&](int pBegin, int pEnd)
+		{
+			for (int y = pBegin; y < pEnd; y++)
+			{
+				for (int x = 0; x < pDst.mWidth; x++)
+				{
+					Float4 sum(0.0f);
+					for (int i = 0; i < KAISER_TAPS; i++)
+					{
+						const int sy = std::min(std::max(y * 2 - KAISER_RADIUS + 1 + i, 0), pTemp.mHeight - 1);
+						sum = sum + Float4::load(pTemp.pixel(x, sy)) * weights[i];
+					}
+					sum.store(pDst.pixel(x, y));
+				}
+			}
+		});
+	}
+}
+
+int getMipLevelCount(int pWidth, int pHeight)
+{
+	int count = 1;
+	while (pWidth > 1 || pHeight > 1)
+	{
+		pWidth = std::max(1, pWidth / 2);
+		pHeight = std::max(1, pHeight / 2);
+		++count;
+	}
+	return count;
+}
+
+void generateMipChain(const unsigned char *pPixels, int pWidth, int pHeight, int pChannels, bool pSRGB,
+	MipFilter pFilter, WorkerPool *pWorkerPool, std::vector<MipLevel> & pLevels)
+{
+	pLevels.clear();
+	if (pWidth <= 0 || pHeight <= 0 || pChannels <= 0 || pChannels > MAX_CHANNELS)
+	{
+		return;
+	}
+
+	float weights[KAISER_TAPS];
+	kaiserWeights(weights);
+
+	FloatImage src, dst, temp;
+	src.resize(pWidth, pHeight);
+	decode(pPixels, pChannels, pSRGB, src, pWorkerPool);
+
+	pLevels.resize(getMipLevelCount(pWidth, pHeight) - 1);
+	for (size_t level = 0; level < pLevels.size(); level++)
+	{
+		dst.resize(std::max(1, src.mWidth / 2), std::max(1, src.mHeight / 2));
+		if (pFilter == MIP_FILTER_KAISER)
+		{
+			downsampleKaiser(src, temp, dst, weights, pWorkerPool);
+		}
+		else
+		{
+			downsampleBox(src, dst, pWorkerPool);
+		}
+		encode(dst, pChannels, pSRGB, pLevels[level], pWorkerPool);
+		std::swap(src, dst);
+	}
+}
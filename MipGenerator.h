@@ -0,0 +1,31 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+
+class WorkerPool;
+
+// cpu mip chains for the decoded textures. no gl calls, the levels are
+// uploaded by the caller.
+enum MipFilter
+{
+	MIP_FILTER_BOX,		// 2x2 average
+	MIP_FILTER_KAISER,	// 8 tap kaiser windowed sinc, sharper, less aliasing
+};
+
+struct MipLevel
+{
+	int mWidth;
+	int mHeight;
+	std::vector<unsigned char> mPixels;	// tightly packed rows
+};
+
+// number of levels of a full chain, level 0 included.
+int getMipLevelCount(int pWidth, int pHeight);
+
+// every level below pPixels (pChannels bytes per pixel, packed rows) down to
+// 1x1, pLevels[0] is level 1. with pSRGB the color channels are filtered in
+// linear space and stored back as srgb, alpha (the 4th channel) is always
+// linear. the levels are filtered from one another in float, split over
+// pWorkerPool by rows, which may be NULL.
+void generateMipChain(const unsigned char *pPixels, int pWidth, int pHeight, int pChannels, bool pSRGB,
+	MipFilter pFilter, WorkerPool *pWorkerPool, std::vector<MipLevel> & pLevels);
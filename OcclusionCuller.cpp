@@ -0,0 +1,363 @@
+#include "OcclusionCuller.h"
+#include "SceneCache.h"
+#include "WorkerPool.h"
+#include "GetPosition.h"
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace
+{
+	// rows rasterized by one task.
+	const int ROWS_PER_TASK = 8;
+
+	const int DEFAULT_MAX_OCCLUDERS = 16;
+
+	const int DEFAULT_MAX_OCCLUDER_TRIANGLES = 2048;
+
+	// meshes smaller than a box are not worth rasterizing.
+	const int MIN_OCCLUDER_TRIANGLES = 12;
+
+	// column major matrix, like the ones uploaded to gl.
+	inline void transformPoint(const GLfloat *m, float x, float y, float z, float *pResult)
+	{
+		pResult[0] = m[0] * x + m[4] * y + m[8] * z + m[12];
+		pResult[1] = m[1] * x + m[5] * y + m[9] * z + m[13];
+		pResult[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+		pResult[3] = m[3] * x + m[7] * y + m[11] * z + m[15];
+	}
+
+	struct OccluderCandidate
+	{
+		FbxNode *mNode;
+		double mScore;
+
+		bool operator<(const OccluderCandidate & pOther) const { return mScore > pOther.mScore; }
+	};
+
+	void collectOccluderCandidates(FbxNode *pNode, std::vector<OccluderCandidate> & pCandidates)
+	{
+		FbxNodeAttribute *nodeAttribute = pNode->GetNodeAttribute();
+		if (nodeAttribute && nodeAttribute->GetAttributeType() == FbxNodeAttribute::eMesh)
+		{
+			FbxMesh *mesh = pNode->GetMesh();
+			const VBOMesh *meshCache = mesh ? static_cast<const VBOMesh *>(mesh->GetUserDataPtr()) : NULL;
+
+			// deformed meshes leave their bind pose, they can not hide anything reliably.
+			if (meshCache && mesh->GetDeformerCount(FbxDeformer::eSkin) == 0
+				&& mesh->GetPolygonCount() >= MIN_OCCLUDER_TRIANGLES)
+			{
+				// score with the surface of the world space bounds.
+				const FbxAMatrix globalTransform = pNode->EvaluateGlobalTransform();
+				const GLfloat *boundsMin = meshCache->getBoundsMin();
+				const GLfloat *boundsMax = meshCache->getBoundsMax();
+				FbxVector4 worldMin, worldMax;
+				for (int corner = 0; corner < 8; corner++)
+				{
+					const FbxVector4 point = globalTransform.MultT(FbxVector4(
+						(corner & 1) ? boundsMax[0] : boundsMin[0],
+						(corner & 2) ? boundsMax[1] : boundsMin[1],
+						(corner & 4) ? boundsMax[2] : boundsMin[2]));
+					for (int axis = 0; axis < 3; axis++)
+					{
+						if (corner == 0 || point[axis] < worldMin[axis]) worldMin[axis] = point[axis];
+						if (corner == 0 || point[axis] > worldMax[axis]) worldMax[axis] = point[axis];
+					}
+				}
+				const double dx = worldMax[0] - worldMin[0];
+				const double dy = worldMax[1] - worldMin[1];
+				const double dz = worldMax[2] - worldMin[2];
+
+				OccluderCandidate candidate;
+				candidate.mNode = pNode;
+				candidate.mScore = dx * dy + dy * dz + dz * dx;
+				pCandidates.push_back(candidate);
+			}
+		}
+
+		const int childCount = pNode->GetChildCount();
+		for (int i = 0; i < childCount; i++)
+		{
+			collectOccluderCandidates(pNode->GetChild(i), pCandidates);
+		}
+	}
+}
+
+OcclusionCuller::Occluder::~Occluder()
+{
+	delete[] mPositions;
+	delete[] mClipVertices;
+	delete[] mIndices;
+}
+
+OcclusionCuller::OcclusionCuller(int pWidth, int pHeight)
+	: mDepthBuffer(pWidth, pHeight), mTriangles(NULL), mTriangleCount(0),
+	mMaxOccluders(DEFAULT_MAX_OCCLUDERS), mMaxOccluderTriangles(DEFAULT_MAX_OCCLUDER_TRIANGLES),
+	mEnabled(false)
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+	memset(mViewProjection, 0, sizeof(mViewProjection));
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+	for (int i = 0; i < mOccluders.GetCount(); i++)
+	{
+		delete mOccluders[i];
+	}
+	mOccluders.Clear();
+	delete[] mTriangles;
+}
+
+void OcclusionCuller::bakeOccluders(FbxNode* pRootNode)
+{
+	for (int i = 0; i < mOccluders.GetCount(); i++)
+	{
+		delete mOccluders[i];
+	}
+	mOccluders.Clear();
+	delete[] mTriangles;
+	mTriangles = NULL;
+	mTriangleCount = 0;
+
+	std::vector<OccluderCandidate> candidates;
+	collectOccluderCandidates(pRootNode, candidates);
+	std::sort(candidates.begin(), candidates.end());
+
+	for (size_t i = 0; i < candidates.size() && mOccluders.GetCount() < mMaxOccluders; i++)
+	{
+		Occluder *occluder = createOccluder(candidates[i].mNode, candidates[i].mNode->GetMesh());
+		if (!occluder)
+		{
+			continue;
+		}
+		if (occluder->mTriangleCount > mMaxOccluderTriangles)
+		{
+			simplifyOccluder(occluder);
+		}
+		occluder->mTriangleOffset = mTriangleCount;
+		mTriangleCount += occluder->mTriangleCount;
+		mOccluders.Add(occluder);
+	}
+
+	if (mTriangleCount)
+	{
+		mTriangles = new RasterTriangle[mTriangleCount];
+	}
+
+	mStatistics.mOccluderCount = mOccluders.GetCount();
+	mStatistics.mOccluderTriangles = mTriangleCount;
+	cout << "occlusion: " << mStatistics.mOccluderCount << " occluders, "
+		<< mStatistics.mOccluderTriangles << " triangles" << endl;
+}
+
+OcclusionCuller::Occluder* OcclusionCuller::createOccluder(FbxNode* pNode, const FbxMesh* pMesh) const
+{
+	const int vertexCount = pMesh->GetControlPointsCount();
+	const int polygonCount = pMesh->GetPolygonCount();
+	if (vertexCount == 0 || polygonCount == 0)
+	{
+		return NULL;
+	}
+
+	// the scene is triangulated, control points are already shared between triangles.
+	Occluder *occluder = new Occluder;
+	occluder->mNode = pNode;
+	occluder->mVertexCount = vertexCount;
+	occluder->mPositions = new GLfloat[vertexCount * 3];
+	occluder->mClipVertices = new GLfloat[vertexCount * 4];
+	occluder->mIndices = new GLuint[polygonCount * 3];
+
+	const FbxVector4 *controlPoints = pMesh->GetControlPoints();
+	for (int i = 0; i < vertexCount; i++)
+	{
+		occluder->mPositions[i * 3] = static_cast<GLfloat>(controlPoints[i][0]);
+		occluder->mPositions[i * 3 + 1] = static_cast<GLfloat>(controlPoints[i][1]);
+		occluder->mPositions[i * 3 + 2] = static_cast<GLfloat>(controlPoints[i][2]);
+	}
+
+	int triangleCount = 0;
+	for (int polygonIndex = 0; polygonIndex < polygonCount; polygonIndex++)
+	{
+		const int i0 = pMesh->GetPolygonVertex(polygonIndex, 0);
+		const int i1 = pMesh->GetPolygonVertex(polygonIndex, 1);
+		const int i2 = pMesh->GetPolygonVertex(polygonIndex, 2);
+		if (i0 < 0 || i1 < 0 || i2 < 0)
+		{
+			continue;
+		}
+		occluder->mIndices[triangleCount * 3] = static_cast<GLuint>(i0);
+		occluder->mIndices[triangleCount * 3 + 1] = static_cast<GLuint>(i1);
+		occluder->mIndices[triangleCount * 3 + 2] = static_cast<GLuint>(i2);
+		++triangleCount;
+	}
+	occluder->mTriangleCount = triangleCount;
+	return occluder;
+}
+
+void OcclusionCuller::simplifyOccluder(Occluder* pOccluder) const
+{
+	// keep the largest triangles of the mesh. a part of the surface never
+	// hides more than the whole does, unlike a remeshed one whose vertices
+	// moved, so the culling stays conservative.
+	std::vector<std::pair<float, int> > areas(pOccluder->mTriangleCount);
+	for (int i = 0; i < pOccluder->mTriangleCount; i++)
+	{
+		const GLfloat *p0 = pOccluder->mPositions + pOccluder->mIndices[i * 3] * 3;
+		const GLfloat *p1 = pOccluder->mPositions + pOccluder->mIndices[i * 3 + 1] * 3;
+		const GLfloat *p2 = pOccluder->mPositions + pOccluder->mIndices[i * 3 + 2] * 3;
+		const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		const float cross[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		// twice the area, squared, orders the same.
+		areas[i] = std::make_pair(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2], i);
+	}
+	std::nth_element(areas.begin(), areas.begin() + mMaxOccluderTriangles, areas.end(),
+		std::greater<std::pair<float, int> >());
+
+	// the kept triangles stay in mesh order.
+	std::vector<char> kept(pOccluder->mTriangleCount, 0);
+	for (int i = 0; i < mMaxOccluderTriangles; i++)
+	{
+		kept[areas[i].second] = 1;
+	}
+	int triangleCount = 0;
+	for (int i = 0; i < pOccluder->mTriangleCount; i++)
+	{
+		if (kept[i])
+		{
+			std::copy(pOccluder->mIndices + i * 3, pOccluder->mIndices + i * 3 + 3, pOccluder->mIndices + triangleCount * 3);
+			++triangleCount;
+		}
+	}
+	pOccluder->mTriangleCount = triangleCount;
+}
+
+void OcclusionCuller::renderOccluders(const FbxMatrix& pViewProjection, WorkerPool* pWorkerPool)
+{
+	getFloatMatrix(pViewProjection, mViewProjection);
+	mDepthBuffer.clear();
+
+	mStatistics.mRasterizedTriangles = 0;
+	mStatistics.mTestedCount = 0;
+	mStatistics.mOccludedCount = 0;
+	mStatistics.mOutsideCount = 0;
+
+	// the fbx sdk is not thread safe, evaluate the transforms here.
+	const int occluderCount = mOccluders.GetCount();
+	for (int i = 0; i < occluderCount; i++)
+	{
+		Occluder *occluder = mOccluders[i];
+		getFloatMatrix(pViewProjection * FbxMatrix(occluder->mNode->EvaluateGlobalTransform()),
+			occluder->mModelViewProjection);
+	}
+
+	std::vector<int> acceptedCounts(occluderCount, 0);
+	pWorkerPool->parallelFor(occluderCount, 1, [&](int pBegin, int pEnd)
+	{
+		for (int i = pBegin; i < pEnd; i++)
+		{
+			Occluder *occluder = mOccluders[i];
+			for (int v = 0; v < occluder->mVertexCount; v++)
+			{
+				transformPoint(occluder->mModelViewProjection, occluder->mPositions[v * 3],
+					occluder->mPositions[v * 3 + 1], occluder->mPositions[v * 3 + 2],
+					occluder->mClipVertices + v * 4);
+			}
+			acceptedCounts[i] = mDepthBuffer.setupTriangles(occluder->mClipVertices, occluder->mIndices,
+				occluder->mTriangleCount, mTriangles + occluder->mTriangleOffset);
+		}
+	});
+
+	for (int i = 0; i < occluderCount; i++)
+	{
+		mStatistics.mRasterizedTriangles += acceptedCounts[i];
+	}
+
+	// every task owns a band of rows, so no pixel is written by two threads.
+	pWorkerPool->parallelFor(mDepthBuffer.getHeight(), ROWS_PER_TASK, [&](int pBegin, int pEnd)
+	{
+		mDepthBuffer.rasterizeRows(mTriangles, mTriangleCount, pBegin, pEnd);
+	});
+
+	mDepthBuffer.buildHierarchy();
+}
+
+bool OcclusionCuller::isVisible(const FbxAMatrix& pGlobalTransform, const GLfloat* pBoundsMin, const GLfloat* pBoundsMax)
+{
+	++mStatistics.mTestedCount;
+
+	// model view projection = view projection * global transform, column major.
+	GLfloat model[16], modelViewProjection[16];
+	getFloatMatrix(FbxMatrix(pGlobalTransform), model);
+	for (int column = 0; column < 4; column++)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			modelViewProjection[column * 4 + row] =
+				mViewProjection[row] * model[column * 4] +
+				mViewProjection[4 + row] * model[column * 4 + 1] +
+				mViewProjection[8 + row] * model[column * 4 + 2] +
+				mViewProjection[12 + row] * model[column * 4 + 3];
+		}
+	}
+
+	const float width = static_cast<float>(mDepthBuffer.getWidth());
+	const float height = static_cast<float>(mDepthBuffer.getHeight());
+	float minX = 0, minY = 0, maxX = 0, maxY = 0, minDepth = 0;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		float clip[4];
+		transformPoint(modelViewProjection,
+			(corner & 1) ? pBoundsMax[0] : pBoundsMin[0],
+			(corner & 2) ? pBoundsMax[1] : pBoundsMin[1],
+			(corner & 4) ? pBoundsMax[2] : pBoundsMin[2], clip);
+
+		// the bounds cross the near plane, the camera may be inside.
+		if (SoftwareDepthBuffer::isClipped(clip))
+		{
+			return true;
+		}
+
+		const float invW = 1.0f / clip[3];
+		const float x = (clip[0] * invW * 0.5f + 0.5f) * width;
+		const float y = (clip[1] * invW * 0.5f + 0.5f) * height;
+		const float depth = clip[2] * invW * 0.5f + 0.5f;
+		if (corner == 0)
+		{
+			minX = maxX = x;
+			minY = maxY = y;
+			minDepth = depth;
+		}
+		else
+		{
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+			minY = std::min(minY, y);
+			maxY = std::max(maxY, y);
+			minDepth = std::min(minDepth, depth);
+		}
+	}
+
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height || minDepth > 1.0f)
+	{
+		++mStatistics.mOutsideCount;
+		return false;
+	}
+
+	if (mDepthBuffer.isOccluded(minX, minY, maxX, maxY, minDepth))
+	{
+		++mStatistics.mOccludedCount;
+		return false;
+	}
+	return true;
+}
+
+void OcclusionCuller::printStatistics() const
+{
+	cout << "occlusion: " << mStatistics.mOccluderCount << " occluders, "
+		<< mStatistics.mRasterizedTriangles << "/" << mStatistics.mOccluderTriangles << " triangles rasterized, "
+		<< mStatistics.mTestedCount << " tested, "
+		<< mStatistics.mOccludedCount << " occluded, "
+		<< mStatistics.mOutsideCount << " outside" << endl;
+}
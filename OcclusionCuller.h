@@ -0,0 +1,75 @@
+#pragma once
+#include "preh.h"
+#include "SoftwareDepthBuffer.h"
+
+class WorkerPool;
+
+// occlusion culling stage: the biggest static meshes are baked as occluders,
+// rasterized on the worker threads each frame, and the bounds of every other
+// mesh are tested against the result before it is drawn.
+class OcclusionCuller
+{
+public:
+	struct Statistics
+	{
+		int mOccluderCount;
+		int mOccluderTriangles;
+		int mRasterizedTriangles;
+		int mTestedCount;
+		int mOccludedCount;
+		int mOutsideCount;
+	};
+
+	OcclusionCuller(int pWidth, int pHeight);
+	~OcclusionCuller();
+
+	void setEnabled(bool pEnabled) { mEnabled = pEnabled; }
+	bool isEnabled() const { return mEnabled; }
+
+	// choose the occluders among the baked VBOMesh of the scene.
+	// must be called after the mesh caches are hooked on the meshes.
+	void bakeOccluders(FbxNode *pRootNode);
+
+	// clear, rasterize the occluders and build the depth hierarchy for this frame.
+	void renderOccluders(const FbxMatrix & pViewProjection, WorkerPool *pWorkerPool);
+
+	// test the local bounds of a mesh placed with pGlobalTransform.
+	bool isVisible(const FbxAMatrix & pGlobalTransform, const GLfloat *pBoundsMin, const GLfloat *pBoundsMax);
+
+	const Statistics & getStatistics() const { return mStatistics; }
+	const SoftwareDepthBuffer & getDepthBuffer() const { return mDepthBuffer; }
+
+	void printStatistics() const;
+
+private:
+	struct Occluder
+	{
+		Occluder() : mNode(NULL), mPositions(NULL), mClipVertices(NULL), mIndices(NULL),
+			mVertexCount(0), mTriangleCount(0), mTriangleOffset(0) {}
+		~Occluder();
+
+		FbxNode *mNode;
+		GLfloat *mPositions;		// xyz, local space
+		GLfloat *mClipVertices;		// xyzw, rewritten every frame
+		GLuint *mIndices;
+		int mVertexCount;
+		int mTriangleCount;
+		int mTriangleOffset;		// first triangle in mTriangles
+		GLfloat mModelViewProjection[16];
+	};
+
+	Occluder *createOccluder(FbxNode *pNode, const FbxMesh *pMesh) const;
+	// down to the mMaxOccluderTriangles largest triangles.
+	void simplifyOccluder(Occluder *pOccluder) const;
+
+	SoftwareDepthBuffer mDepthBuffer;
+	FbxArray<Occluder *> mOccluders;
+	RasterTriangle *mTriangles;
+	int mTriangleCount;
+	GLfloat mViewProjection[16];
+
+	int mMaxOccluders;
+	int mMaxOccluderTriangles;
+	bool mEnabled;
+	Statistics mStatistics;
+};
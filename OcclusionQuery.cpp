@@ -0,0 +1,220 @@
+#include "OcclusionQuery.h"
+#include "GameContext.h"
+#include "ShaderProgram.h"
+#include "GetPosition.h"
+#include "FrameUniforms.h"
+#include "GLStateCache.h"
+
+namespace
+{
+	// an item is hidden only after this many queries in a row found it occluded,
+	// it is shown again as soon as one sample passes.
+	const int OCCLUDED_RESULTS_TO_HIDE = 3;
+
+	// the proxy is a bit bigger than the bounds so it is never hidden by the mesh itself.
+	const double PROXY_PADDING = 0.01;
+
+	// unit cube, same layout as the test light.
+	const GLfloat CUBE_VERTICES[] = {
+		0, 0, 1, 1,
+		1, 0, 1, 1,
+		1, 1, 1, 1,
+		0, 1, 1, 1,
+		0, 0, 0, 1,
+		1, 0, 0, 1,
+		1, 1, 0, 1,
+		0, 1, 0, 1
+	};
+
+	// counter-clockwise seen from outside.
+	const GLuint CUBE_INDICES[] = {
+		0, 1, 2, 0, 2, 3,
+		0, 5, 1, 0, 4, 5,
+		0, 7, 4, 0, 3, 7,
+		1, 5, 6, 1, 6, 2,
+		4, 6, 5, 4, 7, 6,
+		3, 2, 6, 3, 6, 7
+	};
+}
+
+OcclusionQuery::OcclusionQuery() : mCubeVBO(0), mCubeIndiceVBO(0), mFrame(0), mEnabled(false)
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+OcclusionQuery::~OcclusionQuery()
+{
+	for (std::map<const FbxNode *, Entry>::iterator it = mEntries.begin(); it != mEntries.end(); ++it)
+	{
+		if (it->second.mQuery)
+		{
+			glDeleteQueries(1, &it->second.mQuery);
+		}
+	}
+	glDeleteBuffers(1, &mCubeVBO);
+	glDeleteBuffers(1, &mCubeIndiceVBO);
+}
+
+bool OcclusionQuery::initialize()
+{
+	glGenBuffers(1, &mCubeVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, mCubeVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_VERTICES), CUBE_VERTICES, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &mCubeIndiceVBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mCubeIndiceVBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(CUBE_INDICES), CUBE_INDICES, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	return mCubeVBO != 0 && mCubeIndiceVBO != 0;
+}
+
+void OcclusionQuery::beginFrame()
+{
+	++mFrame;
+	mFrameEntries.Clear();
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+void OcclusionQuery::readResult(Entry& pEntry)
+{
+	if (!pEntry.mPending)
+	{
+		return;
+	}
+
+	GLuint available = 0;
+	glGetQueryObjectuiv(pEntry.mQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+	{
+		// reading it now would stall, keep the previous classification.
+		++mStatistics.mStallCount;
+		return;
+	}
+
+	GLuint samplesPassed = 0;
+	glGetQueryObjectuiv(pEntry.mQuery, GL_QUERY_RESULT, &samplesPassed);
+	pEntry.mPending = false;
+	++mStatistics.mResultCount;
+
+	if (samplesPassed)
+	{
+		pEntry.mOccludedResults = 0;
+		pEntry.mVisible = true;
+	}
+	else if (++pEntry.mOccludedResults >= OCCLUDED_RESULTS_TO_HIDE)
+	{
+		pEntry.mVisible = false;
+	}
+}
+
+bool OcclusionQuery::testVisibility(const FbxNode* pNode, const FbxAMatrix& pGlobalTransform,
+	const GLfloat* pBoundsMin, const GLfloat* pBoundsMax, const FbxVector4 & pEyePosition)
+{
+	Entry & entry = mEntries[pNode];
+
+	// a node drawn twice in a frame is queried once.
+	if (entry.mFrame != mFrame)
+	{
+		entry.mFrame = mFrame;
+		readResult(entry);
+
+		FbxVector4 boundsMin(pBoundsMin[0], pBoundsMin[1], pBoundsMin[2]);
+		FbxVector4 boundsMax(pBoundsMax[0], pBoundsMax[1], pBoundsMax[2]);
+		const FbxVector4 extent = boundsMax - boundsMin;
+		const double padding = PROXY_PADDING * (extent[0] > extent[1] ? (extent[0] > extent[2] ? extent[0] : extent[2])
+			: (extent[1] > extent[2] ? extent[1] : extent[2])) + 1e-4;
+		boundsMin -= FbxVector4(padding, padding, padding, 0);
+		boundsMax += FbxVector4(padding, padding, padding, 0);
+
+		// the faces of the proxy are clipped when the camera is inside it.
+		const FbxVector4 localEye = pGlobalTransform.Inverse().MultT(pEyePosition);
+		entry.mCameraInside = true;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (localEye[axis] < boundsMin[axis] || localEye[axis] > boundsMax[axis])
+			{
+				entry.mCameraInside = false;
+			}
+		}
+		if (entry.mCameraInside)
+		{
+			entry.mVisible = true;
+			entry.mOccludedResults = 0;
+		}
+
+		const FbxAMatrix proxyTransform(boundsMin, FbxVector4(0, 0, 0), boundsMax - boundsMin);
+		getFloatMatrix(FbxMatrix(pGlobalTransform * proxyTransform), entry.mModel);
+		mFrameEntries.Add(&entry);
+
+		if (entry.mVisible)
+		{
+			++mStatistics.mVisibleCount;
+		}
+		else
+		{
+			++mStatistics.mOccludedCount;
+		}
+	}
+	return entry.mVisible;
+}
+
+void OcclusionQuery::issueQueries(GameContext* gameContext)
+{
+	// view and projection come from the frame block.
+	ShaderProgram *program = gameContext->mLightShaderProgram;
+	FrameUniforms *frameUniforms = gameContext->mFrameUniforms;
+	GLStateCache *glState = gameContext->mGLState;
+	glState->useProgram(program->programObject);
+
+	glState->bindVertexArray(0);
+	glState->bindBuffer(GL_ARRAY_BUFFER, mCubeVBO);
+	glState->enableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	glState->disableVertexAttribArray(1);
+	glState->disableVertexAttribArray(2);
+	glState->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mCubeIndiceVBO);
+
+	// test only, the proxies must not show up nor hide anything.
+	glState->colorMask(GL_FALSE);
+	glState->depthMask(GL_FALSE);
+	glState->depthFunc(GL_LEQUAL);
+	// a mirrored transform turns the proxy inside out.
+	glState->disable(GL_CULL_FACE);
+
+	for (int i = 0; i < mFrameEntries.GetCount(); i++)
+	{
+		Entry *entry = mFrameEntries[i];
+		if (entry->mPending || entry->mCameraInside)
+		{
+			continue;
+		}
+		if (!entry->mQuery)
+		{
+			glGenQueries(1, &entry->mQuery);
+		}
+
+		frameUniforms->setModelMatrix(program, entry->mModel);
+		glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, entry->mQuery);
+		glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+
+		entry->mPending = true;
+		++mStatistics.mIssuedCount;
+	}
+
+	glState->colorMask(GL_TRUE);
+	glState->depthMask(GL_TRUE);
+	glState->depthFunc(GL_LESS);
+	glState->enable(GL_CULL_FACE);
+}
+
+void OcclusionQuery::printStatistics() const
+{
+	cout << "occlusion queries: " << mStatistics.mIssuedCount << " issued, "
+		<< mStatistics.mResultCount << " results, "
+		<< mStatistics.mStallCount << " not ready, "
+		<< mStatistics.mVisibleCount << " visible, "
+		<< mStatistics.mOccludedCount << " occluded" << endl;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include "preh.h"
+#include <map>
+
+class GameContext;
+
+// gpu occlusion culling: the bounding box of every draw item is drawn as a
+// proxy cube inside a GL_ANY_SAMPLES_PASSED_CONSERVATIVE query at the end of
+// the frame, and the result is read back in a later frame, when it is ready,
+// so the cpu never waits on the gpu.
+class OcclusionQuery
+{
+public:
+	struct Statistics
+	{
+		int mIssuedCount;		// queries started this frame
+		int mResultCount;		// results read this frame
+		int mStallCount;		// results polled but not ready yet
+		int mVisibleCount;
+		int mOccludedCount;
+	};
+
+	OcclusionQuery();
+	~OcclusionQuery();
+
+	// create the proxy cube, needs a current gl context.
+	bool initialize();
+
+	void setEnabled(bool pEnabled) { mEnabled = pEnabled; }
+	bool isEnabled() const { return mEnabled; }
+
+	void beginFrame();
+
+	// poll the last query of the node, remember its bounds for this frame's
+	// proxy pass and tell whether the node should be drawn.
+	bool testVisibility(const FbxNode *pNode, const FbxAMatrix & pGlobalTransform,
+		const GLfloat *pBoundsMin, const GLfloat *pBoundsMax, const FbxVector4 & pEyePosition);
+
+	// draw the proxy cubes of this frame's items that have no query in flight.
+	// the scene must be drawn already, so the depth buffer is complete.
+	void issueQueries(GameContext *gameContext);
+
+	const Statistics & getStatistics() const { return mStatistics; }
+	void printStatistics() const;
+
+private:
+	struct Entry
+	{
+		Entry() : mQuery(0), mPending(false), mVisible(true), mOccludedResults(0), mFrame(-1),
+			mCameraInside(false) {}
+
+		GLuint mQuery;
+		bool mPending;
+		bool mVisible;
+		int mOccludedResults;	// consecutive results without any sample passed
+		int mFrame;				// last frame the node was seen
+		GLfloat mModel[16];		// proxy cube transform
+		bool mCameraInside;
+	};
+
+	void readResult(Entry & pEntry);
+
+	std::map<const FbxNode *, Entry> mEntries;
+	FbxArray<Entry *> mFrameEntries;
+
+	GLuint mCubeVBO;
+	GLuint mCubeIndiceVBO;
+	int mFrame;
+	bool mEnabled;
+	Statistics mStatistics;
+};
@@ -0,0 +1,202 @@
+#include "PickMesh.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cstring>
+#include <cfloat>
+
+namespace
+{
+	// determinants below this are treated as rays parallel to the triangle.
+	const float PARALLEL_EPSILON = 1e-12f;
+
+	// hits closer than this to the origin are ignored.
+	const float MIN_DISTANCE = 1e-6f;
+}
+
+PickMesh::PickMesh() : mTriangleCount(0)
+{
+}
+
+void PickMesh::addTriangles(const GLfloat *pPositions, int pStride, const GLuint *pIndices,
+	int pIndexOffset, int pTriangleCount, int pSubMesh)
+{
+	const int blockCount = (pTriangleCount + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	const int firstBlock = static_cast<int>(mBlocks.size());
+	mBlocks.resize(firstBlock + blockCount);
+	mBlockSubMesh.resize(firstBlock + blockCount, pSubMesh);
+
+	for (int b = 0; b < blockCount; b++)
+	{
+		// unused lanes stay degenerate and never hit.
+		TriangleBlock & block = mBlocks[firstBlock + b];
+		memset(&block, 0, sizeof(TriangleBlock));
+
+		for (int lane = 0; lane < BLOCK_SIZE; lane++)
+		{
+			const int triangle = b * BLOCK_SIZE + lane;
+			if (triangle >= pTriangleCount)
+			{
+				break;
+			}
+			const GLuint *corners = pIndices + pIndexOffset + triangle * 3;
+			const GLfloat *p0 = pPositions + corners[0] * pStride;
+			const GLfloat *p1 = pPositions + corners[1] * pStride;
+			const GLfloat *p2 = pPositions + corners[2] * pStride;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				block.mVertex[axis][lane] = p0[axis];
+				block.mEdge1[axis][lane] = p1[axis] - p0[axis];
+				block.mEdge2[axis][lane] = p2[axis] - p0[axis];
+			}
+		}
+	}
+
+	for (int first = 0; first < blockCount; first += CLUSTER_BLOCK_COUNT)
+	{
+		Cluster cluster;
+		cluster.mFirstBlock = firstBlock + first;
+		cluster.mBlockCount = std::min(static_cast<int>(CLUSTER_BLOCK_COUNT), blockCount - first);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			cluster.mMin[axis] = FLT_MAX;
+			cluster.mMax[axis] = -FLT_MAX;
+		}
+
+		const int lastTriangle = std::min(pTriangleCount, (first + cluster.mBlockCount) * BLOCK_SIZE);
+		for (int triangle = first * BLOCK_SIZE; triangle < lastTriangle; triangle++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				const GLfloat *p = pPositions + pIndices[pIndexOffset + triangle * 3 + k] * pStride;
+				for (int axis = 0; axis < 3; axis++)
+				{
+					cluster.mMin[axis] = std::min(cluster.mMin[axis], p[axis]);
+					cluster.mMax[axis] = std::max(cluster.mMax[axis], p[axis]);
+				}
+			}
+		}
+		mClusters.push_back(cluster);
+	}
+
+	mTriangleCount += pTriangleCount;
+}
+
+bool PickMesh::intersectBox(const float *pOrigin, const float *pDirection, const float *pMin,
+	const float *pMax, float pMaxDistance, float & pEnter)
+{
+	float enter = 0.0f;
+	float leave = pMaxDistance;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (pDirection[axis] == 0.0f)
+		{
+			if (pOrigin[axis] < pMin[axis] || pOrigin[axis] > pMax[axis])
+			{
+				return false;
+			}
+			continue;
+		}
+		const float inverse = 1.0f / pDirection[axis];
+		float axisEnter = (pMin[axis] - pOrigin[axis]) * inverse;
+		float axisLeave = (pMax[axis] - pOrigin[axis]) * inverse;
+		if (axisEnter > axisLeave)
+		{
+			std::swap(axisEnter, axisLeave);
+		}
+		enter = std::max(enter, axisEnter);
+		leave = std::min(leave, axisLeave);
+		if (enter > leave)
+		{
+			return false;
+		}
+	}
+	pEnter = enter;
+	return true;
+}
+
+bool PickMesh::intersect(const float *pOrigin, const float *pDirection, float pMaxDistance,
+	float & pDistance, int & pSubMesh) const
+{
+	const Float4 originX(pOrigin[0]), originY(pOrigin[1]), originZ(pOrigin[2]);
+	const Float4 directionX(pDirection[0]), directionY(pDirection[1]), directionZ(pDirection[2]);
+	const Float4 zero(0.0f), one(1.0f);
+	const Float4 epsilon(PARALLEL_EPSILON), negativeEpsilon(-PARALLEL_EPSILON);
+	const Float4 minDistance(MIN_DISTANCE);
+
+	float best = pMaxDistance;
+	int bestBlock = -1;
+	for (size_t c = 0; c < mClusters.size(); c++)
+	{
+		const Cluster & cluster = mClusters[c];
+		float enter;
+		if (!intersectBox(pOrigin, pDirection, cluster.mMin, cluster.mMax, best, enter))
+		{
+			continue;
+		}
+
+		for (int b = cluster.mFirstBlock; b < cluster.mFirstBlock + cluster.mBlockCount; b++)
+		{
+			const TriangleBlock & block = mBlocks[b];
+			for (int half = 0; half < BLOCK_SIZE; half += 4)
+			{
+				// moller-trumbore on 4 triangles at once.
+				const Float4 e1x = Float4::load(block.mEdge1[0] + half);
+				const Float4 e1y = Float4::load(block.mEdge1[1] + half);
+				const Float4 e1z = Float4::load(block.mEdge1[2] + half);
+				const Float4 e2x = Float4::load(block.mEdge2[0] + half);
+				const Float4 e2y = Float4::load(block.mEdge2[1] + half);
+				const Float4 e2z = Float4::load(block.mEdge2[2] + half);
+
+				const Float4 px = directionY * e2z - directionZ * e2y;
+				const Float4 py = directionZ * e2x - directionX * e2z;
+				const Float4 pz = directionX * e2y - directionY * e2x;
+				const Float4 determinant = e1x * px + e1y * py + e1z * pz;
+				Float4 mask = maskOr(cmpGreater(determinant, epsilon), cmpLess(determinant, negativeEpsilon));
+				if (moveMask(mask) == 0)
+				{
+					continue;
+				}
+				const Float4 inverse = one / select(mask, determinant, one);
+
+				const Float4 tx = originX - Float4::load(block.mVertex[0] + half);
+				const Float4 ty = originY - Float4::load(block.mVertex[1] + half);
+				const Float4 tz = originZ - Float4::load(block.mVertex[2] + half);
+				const Float4 u = (tx * px + ty * py + tz * pz) * inverse;
+
+				const Float4 qx = ty * e1z - tz * e1y;
+				const Float4 qy = tz * e1x - tx * e1z;
+				const Float4 qz = tx * e1y - ty * e1x;
+				const Float4 v = (directionX * qx + directionY * qy + directionZ * qz) * inverse;
+				const Float4 t = (e2x * qx + e2y * qy + e2z * qz) * inverse;
+
+				mask = maskAnd(mask, maskAnd(cmpGreaterEqual(u, zero), cmpGreaterEqual(v, zero)));
+				mask = maskAnd(mask, cmpGreaterEqual(one, u + v));
+				mask = maskAnd(mask, maskAnd(cmpGreater(t, minDistance), cmpLess(t, Float4(best))));
+				const int hits = moveMask(mask);
+				if (hits == 0)
+				{
+					continue;
+				}
+
+				float distances[4];
+				t.store(distances);
+				for (int lane = 0; lane < 4; lane++)
+				{
+					if ((hits & (1 << lane)) && distances[lane] < best)
+					{
+						best = distances[lane];
+						bestBlock = b;
+					}
+				}
+			}
+		}
+	}
+
+	if (bestBlock < 0)
+	{
+		return false;
+	}
+	pDistance = best;
+	pSubMesh = mBlockSubMesh[bestBlock];
+	return true;
+}
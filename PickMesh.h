@@ -0,0 +1,54 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+
+// cpu copy of the triangles of a VBOMesh for ray picking.
+// triangles are stored 8 at a time as vertex 0 and two edges in structure
+// of arrays layout, so one ray is tested against a whole block with two
+// Float4 halves. blocks are grouped into clusters with a bounding box that
+// is checked before any of its blocks.
+class PickMesh
+{
+public:
+	PickMesh();
+
+	// append the triangles pIndices[pIndexOffset, pIndexOffset + 3 * pTriangleCount)
+	// of the submesh pSubMesh. positions are pStride floats apart.
+	void addTriangles(const GLfloat *pPositions, int pStride, const GLuint *pIndices,
+		int pIndexOffset, int pTriangleCount, int pSubMesh);
+
+	bool isEmpty() const { return mBlocks.empty(); }
+	int getTriangleCount() const { return mTriangleCount; }
+
+	// nearest hit with 0 < t < pMaxDistance along pOrigin + t * pDirection, in
+	// object space. both faces count. on a hit pDistance and pSubMesh are set.
+	bool intersect(const float *pOrigin, const float *pDirection, float pMaxDistance,
+		float & pDistance, int & pSubMesh) const;
+
+	// slab test, pEnter is the entry distance (0 if the origin is inside).
+	static bool intersectBox(const float *pOrigin, const float *pDirection, const float *pMin,
+		const float *pMax, float pMaxDistance, float & pEnter);
+
+private:
+	enum { BLOCK_SIZE = 8, CLUSTER_BLOCK_COUNT = 16 };
+
+	struct TriangleBlock
+	{
+		float mVertex[3][BLOCK_SIZE];
+		float mEdge1[3][BLOCK_SIZE];
+		float mEdge2[3][BLOCK_SIZE];
+	};
+
+	struct Cluster
+	{
+		float mMin[3];
+		float mMax[3];
+		int mFirstBlock;
+		int mBlockCount;
+	};
+
+	std::vector<TriangleBlock> mBlocks;
+	std::vector<int> mBlockSubMesh;
+	std::vector<Cluster> mClusters;
+	int mTriangleCount;
+};
@@ -0,0 +1,392 @@
+#include "RenderQueue.h"
+#include "GameContext.h"
+#include "SceneCache.h"
+#include "ShaderProgram.h"
+#include "FrameUniforms.h"
+#include "GLStateCache.h"
+#include <algorithm>
+
+namespace
+{
+	// key layout, most significant first.
+	const int PASS_BITS = 2;
+	const int PROGRAM_BITS = 4;
+	const int MATERIAL_BITS = 16;
+	const int MESH_BITS = 18;
+	const int DEPTH_BITS = 24;
+
+	const int MESH_SHIFT = DEPTH_BITS;
+	const int MATERIAL_SHIFT = MESH_SHIFT + MESH_BITS;
+	const int PROGRAM_SHIFT = MATERIAL_SHIFT + MATERIAL_BITS;
+	const int PASS_SHIFT = PROGRAM_SHIFT + PROGRAM_BITS;
+
+	const int RADIX_BITS = 8;
+	const int RADIX_SIZE = 1 << RADIX_BITS;
+
+	// program field of the key
+	const unsigned int SCENE_PROGRAM = 0;
+	const unsigned int INSTANCED_PROGRAM = 1;
+
+	// model matrix (16), normal matrix (9) and texture layer per instance.
+	const int INSTANCE_FLOATS = 26;
+
+	inline unsigned long long keyField(unsigned int pValue, int pBits, int pShift)
+	{
+		return static_cast<unsigned long long>(pValue & ((1u << pBits) - 1)) << pShift;
+	}
+
+	// positive floats keep their order as integers, the top bits are a coarse depth.
+	unsigned int depthBits(float pDistance)
+	{
+		if (!(pDistance > 0.0f))
+		{
+			return 0;
+		}
+		unsigned int bits;
+		memcpy(&bits, &pDistance, sizeof(bits));
+		return bits >> (32 - DEPTH_BITS);
+	}
+}
+
+RenderQueue::RenderQueue() : mFirstInstanced(0), mInstanceBuffer(0), mInstanceCapacity(0),
+	mLastSubmittedMaterial(NULL), mLastSubmittedMesh(NULL)
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+RenderQueue::~RenderQueue()
+{
+	glDeleteBuffers(1, &mInstanceBuffer);
+}
+
+void RenderQueue::beginFrame()
+{
+	mNodes.clear();
+	mItems.clear();
+	mLastSubmittedMaterial = NULL;
+	mLastSubmittedMesh = NULL;
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+const MaterialCache *RenderQueue::getMaterialCache(FbxNode *pNode, int pSubMesh)
+{
+	const FbxSurfaceMaterial *material = pNode->GetMaterial(pSubMesh);
+	if (!material)
+	{
+		return NULL;
+	}
+	return static_cast<const MaterialCache *>(material->GetUserDataPtr());
+}
+
+void RenderQueue::submit(FbxNode *pNode, const VBOMesh *pMesh, const FbxAMatrix & pGlobalTransform, int pLod,
+	const MeshletView *pMeshletView, const GameContext *gameContext)
+{
+	NodeRecord node;
+	node.mTransform = pGlobalTransform;
+	node.mMesh = pMesh;
+	node.mLod = pLod;
+	node.mHasMeshletView = pMeshletView != NULL;
+	if (pMeshletView)
+	{
+		node.mMeshletView = *pMeshletView;
+	}
+	mNodes.push_back(node);
+
+	// front to back inside a material and mesh, from the center of the bounds.
+	const GLfloat *boundsMin = pMesh->getBoundsMin();
+	const GLfloat *boundsMax = pMesh->getBoundsMax();
+	const FbxVector4 center = pGlobalTransform.MultT(FbxVector4((boundsMin[0] + boundsMax[0]) * 0.5,
+		(boundsMin[1] + boundsMax[1]) * 0.5, (boundsMin[2] + boundsMax[2]) * 0.5));
+	const FbxVector4 toCenter = center - gameContext->eyePos;
+	const unsigned int depth = depthBits(static_cast<float>(toCenter.Length()));
+
+	const ShaderProgram *program = gameContext->mShaderProgram;
+	const int subMeshCount = pMesh->getSubMeshCount();
+	for (int i = 0; i < subMeshCount; i++)
+	{
+		Item item;
+		item.mNode = static_cast<int>(mNodes.size()) - 1;
+		item.mSubMesh = i;
+		item.mMaterial = getMaterialCache(pNode, i);
+		item.mProgram = program;
+		item.mKey = keyField(PASS_OPAQUE, PASS_BITS, PASS_SHIFT)
+			| keyField(SCENE_PROGRAM, PROGRAM_BITS, PROGRAM_SHIFT)
+			| keyField(item.mMaterial ? item.mMaterial->getSortId() : 0, MATERIAL_BITS, MATERIAL_SHIFT)
+			| keyField(pMesh->getId(), MESH_BITS, MESH_SHIFT)
+			| keyField(depth, DEPTH_BITS, 0);
+		mItems.push_back(item);
+
+		if (mItems.size() == 1 || item.mMaterial != mLastSubmittedMaterial)
+		{
+			++mStatistics.mUnsortedMaterialChanges;
+		}
+		if (mItems.size() == 1 || pMesh != mLastSubmittedMesh)
+		{
+			++mStatistics.mUnsortedMeshChanges;
+		}
+		mLastSubmittedMaterial = item.mMaterial;
+		mLastSubmittedMesh = pMesh;
+	}
+}
+
+void RenderQueue::drawNow(FbxNode *pNode, const VBOMesh *pMesh, const FbxAMatrix & pGlobalTransform, int pLod,
+	GameContext *gameContext)
+{
+	NodeRecord node;
+	node.mTransform = pGlobalTransform;
+	node.mMesh = pMesh;
+	node.mLod = pLod;
+	node.mHasMeshletView = false;
+
+	// drawMesh runs with the scene program bound.
+	DrawState state = { gameContext->mShaderProgram, NULL, NULL, -1, false, 0 };
+	for (int i = 0; i < pMesh->getSubMeshCount(); i++)
+	{
+		Item item;
+		item.mKey = 0;
+		item.mNode = -2;
+		item.mSubMesh = i;
+		item.mMaterial = getMaterialCache(pNode, i);
+		item.mProgram = gameContext->mShaderProgram;
+		executeItem(gameContext, item, node, state);
+	}
+	pMesh->endDraw(gameContext);
+}
+
+void RenderQueue::sortItems()
+{
+	const int count = static_cast<int>(mItems.size());
+	mOrder.resize(count);
+	mScratch.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		mOrder[i] = i;
+	}
+
+	// one stable counting pass per byte, bytes equal in every key are skipped.
+	for (int shift = 0; shift < 64; shift += RADIX_BITS)
+	{
+		int histogram[RADIX_SIZE] = { 0 };
+		for (int i = 0; i < count; i++)
+		{
+			++histogram[(mItems[i].mKey >> shift) & (RADIX_SIZE - 1)];
+		}
+		if (histogram[(mItems[0].mKey >> shift) & (RADIX_SIZE - 1)] == count)
+		{
+			continue;
+		}
+
+		int offset = 0;
+		for (int b = 0; b < RADIX_SIZE; b++)
+		{
+			const int bucketCount = histogram[b];
+			histogram[b] = offset;
+			offset += bucketCount;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			const int item = mOrder[i];
+			mScratch[histogram[(mItems[item].mKey >> shift) & (RADIX_SIZE - 1)]++] = item;
+		}
+		mOrder.swap(mScratch);
+	}
+}
+
+void RenderQueue::groupInstances(GameContext *gameContext)
+{
+	const int count = static_cast<int>(mOrder.size());
+	const unsigned long long programMask = keyField(~0u, PROGRAM_BITS, PROGRAM_SHIFT);
+	bool grouped = false;
+	int runStart = 0;
+	for (int i = 1; i <= count; i++)
+	{
+		// pass, program, material and mesh are the same along a run.
+		if (i < count && (mItems[mOrder[i]].mKey >> MESH_SHIFT) == (mItems[mOrder[runStart]].mKey >> MESH_SHIFT))
+		{
+			continue;
+		}
+		if (i - runStart >= MIN_INSTANCE_COUNT)
+		{
+			for (int j = runStart; j < i; j++)
+			{
+				Item & item = mItems[mOrder[j]];
+				item.mKey = (item.mKey & ~programMask) | keyField(INSTANCED_PROGRAM, PROGRAM_BITS, PROGRAM_SHIFT);
+				item.mProgram = gameContext->mInstancedShaderProgram;
+			}
+			grouped = true;
+		}
+		runStart = i;
+	}
+
+	mFirstInstanced = count;
+	if (!grouped)
+	{
+		return;
+	}
+
+	// the instanced items now sort after the others, a second sort is cheaper than merging.
+	sortItems();
+	while (mFirstInstanced > 0 && mItems[mOrder[mFirstInstanced - 1]].mProgram == gameContext->mInstancedShaderProgram)
+	{
+		--mFirstInstanced;
+	}
+
+	mInstanceData.resize((count - mFirstInstanced) * INSTANCE_FLOATS);
+	for (int i = mFirstInstanced; i < count; i++)
+	{
+		GLfloat *instance = &mInstanceData[(i - mFirstInstanced) * INSTANCE_FLOATS];
+		const Item & item = mItems[mOrder[i]];
+		const NodeRecord & node = mNodes[item.mNode];
+		FrameUniforms::computeModelMatrices(node.mTransform, node.mMesh->getPositionDecode(), instance, instance + 16);
+		instance[25] = static_cast<GLfloat>(item.mMaterial ? item.mMaterial->getTextureLayer() : -1);
+	}
+
+	if (!mInstanceBuffer)
+	{
+		glGenBuffers(1, &mInstanceBuffer);
+	}
+	const GLsizeiptr size = mInstanceData.size() * sizeof(GLfloat);
+	mInstanceCapacity = std::max(mInstanceCapacity, size);
+	gameContext->mGLState->bindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+	// a new store each frame, the draws of the last frame may still read the old one.
+	glBufferData(GL_ARRAY_BUFFER, mInstanceCapacity, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, size, &mInstanceData[0]);
+}
+
+bool RenderQueue::isSameInstance(const Item & pItem, const Item & pOther) const
+{
+	const NodeRecord & node = mNodes[pItem.mNode];
+	const NodeRecord & other = mNodes[pOther.mNode];
+	const bool sameMaterial = pItem.mMaterial == pOther.mMaterial
+		|| (pItem.mMaterial && pOther.mMaterial && pItem.mMaterial->isOtherLayerOf(*pOther.mMaterial));
+	return node.mMesh == other.mMesh && pItem.mSubMesh == pOther.mSubMesh && sameMaterial && node.mLod == other.mLod;
+}
+
+void RenderQueue::bindInstanceArrays(GLStateCache *glState, int pFirstInstance) const
+{
+	// attribute pointers and divisors belong to the vertex array of the mesh.
+	glState->bindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+	const GLsizei stride = INSTANCE_FLOATS * sizeof(GLfloat);
+	for (int i = 0; i < INSTANCE_LOCATION_COUNT; i++)
+	{
+		// 4 columns of the model matrix, 3 columns of the normal matrix, then the layer.
+		const int column = i < 4 ? i * 4 : 16 + (i - 4) * 3;
+		const GLint size = i < 4 ? 4 : (i < 7 ? 3 : 1);
+		const GLsizeiptr offset = pFirstInstance * stride + column * sizeof(GLfloat);
+		const GLuint location = INSTANCE_LOCATION + i;
+		glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const GLvoid *>(offset));
+		glVertexAttribDivisor(location, 1);
+		glState->enableVertexAttribArray(location);
+	}
+}
+
+void RenderQueue::applyState(GameContext *gameContext, const Item & pItem, const NodeRecord & pNode, DrawState & pState)
+{
+	if (pItem.mProgram != pState.mProgram)
+	{
+		gameContext->mGLState->useProgram(pItem.mProgram->programObject);
+		pState.mProgram = pItem.mProgram;
+		pState.mHasMaterial = false;
+		pState.mNode = -1;
+		++mStatistics.mProgramChanges;
+	}
+	if (pNode.mMesh != pState.mMesh)
+	{
+		pNode.mMesh->beginDraw(gameContext);
+		pState.mMesh = pNode.mMesh;
+		++mStatistics.mMeshChanges;
+	}
+	if (pState.mHasMaterial && pItem.mMaterial != pState.mMaterial && pItem.mMaterial && pState.mMaterial
+		&& pItem.mMaterial->isOtherLayerOf(*pState.mMaterial))
+	{
+		// the array stays bound, only the layer uniform changes.
+		pItem.mMaterial->setTextureLayer(pItem.mProgram);
+		pState.mMaterial = pItem.mMaterial;
+		++mStatistics.mLayerChanges;
+	}
+	else if (!pState.mHasMaterial || pItem.mMaterial != pState.mMaterial)
+	{
+		if (pItem.mMaterial)
+		{
+			pItem.mMaterial->setCurrentMaterial(pItem.mProgram, gameContext->mGLState);
+			const GLuint texture = pItem.mMaterial->getTextureName();
+			if (texture && texture != pState.mTexture)
+			{
+				pState.mTexture = texture;
+				++mStatistics.mTextureChanges;
+			}
+		}
+		else
+		{
+			MaterialCache::setDefaultMaterial(pItem.mProgram);
+		}
+		pState.mMaterial = pItem.mMaterial;
+		pState.mHasMaterial = true;
+		++mStatistics.mMaterialChanges;
+	}
+}
+
+void RenderQueue::executeItem(GameContext *gameContext, const Item & pItem, const NodeRecord & pNode, DrawState & pState)
+{
+	applyState(gameContext, pItem, pNode, pState);
+	if (pItem.mNode != pState.mNode)
+	{
+		gameContext->mFrameUniforms->setModelMatrix(pItem.mProgram, pNode.mTransform, pNode.mMesh->getPositionDecode());
+		pState.mNode = pItem.mNode;
+	}
+
+	pNode.mMesh->draw(gameContext, pItem.mSubMesh, pNode.mLod, pNode.mHasMeshletView ? &pNode.mMeshletView : NULL);
+	++mStatistics.mItemCount;
+}
+
+void RenderQueue::executeInstanced(GameContext *gameContext, int pFirst, int pCount, DrawState & pState)
+{
+	const Item & item = mItems[mOrder[pFirst]];
+	const NodeRecord & node = mNodes[item.mNode];
+	applyState(gameContext, item, node, pState);
+	bindInstanceArrays(gameContext->mGLState, pFirst - mFirstInstanced);
+
+	node.mMesh->drawInstanced(item.mSubMesh, node.mLod, pCount);
+	mStatistics.mItemCount += pCount;
+	mStatistics.mInstancedItems += pCount;
+	++mStatistics.mInstancedDraws;
+}
+
+void RenderQueue::execute(GameContext *gameContext)
+{
+	if (mItems.empty())
+	{
+		return;
+	}
+	sortItems();
+	groupInstances(gameContext);
+
+	DrawState state = { NULL, NULL, NULL, -1, false, 0 };
+	const int count = static_cast<int>(mOrder.size());
+	for (int i = 0; i < mFirstInstanced; i++)
+	{
+		const Item & item = mItems[mOrder[i]];
+		executeItem(gameContext, item, mNodes[item.mNode], state);
+	}
+	int groupStart = mFirstInstanced;
+	for (int i = mFirstInstanced + 1; i <= count; i++)
+	{
+		if (i == count || !isSameInstance(mItems[mOrder[groupStart]], mItems[mOrder[i]]))
+		{
+			executeInstanced(gameContext, groupStart, i - groupStart, state);
+			groupStart = i;
+		}
+	}
+	state.mMesh->endDraw(gameContext);
+}
+
+void RenderQueue::printStatistics() const
+{
+	cout << "render queue: " << mStatistics.mItemCount << " draws, "
+		<< mStatistics.mProgramChanges << " program changes, "
+		<< mStatistics.mMaterialChanges << " material changes (" << mStatistics.mUnsortedMaterialChanges << " unsorted), "
+		<< mStatistics.mTextureChanges << " texture changes, "
+		<< mStatistics.mLayerChanges << " layer changes, "
+		<< mStatistics.mMeshChanges << " mesh changes (" << mStatistics.mUnsortedMeshChanges << " unsorted), "
+		<< mStatistics.mInstancedItems << " draws in " << mStatistics.mInstancedDraws << " instanced calls" << endl;
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include "preh.h"
+#include "MeshletCuller.h"
+#include <vector>
+
+class GameContext;
+class VBOMesh;
+class MaterialCache;
+class ShaderProgram;
+class GLStateCache;
+
+// the draws of a frame are collected with a 64 bit sort key
+// (pass | program | material | mesh | depth), sorted with an lsd radix sort
+// and executed in that order, so the program, the material and the mesh
+// buffers are only set when their part of the key changes.
+// after the sort, long runs of one mesh and material (the same FbxMesh
+// placed under many nodes) move to the instanced program and are drawn
+// with one glDrawElementsInstanced per submesh and level, their model and
+// normal matrices uploaded once per frame into an instance buffer.
+// materials that only differ in the layer of one texture array count as
+// one material here, the layer goes with the instance.
+class RenderQueue
+{
+public:
+	enum Pass
+	{
+		PASS_OPAQUE,
+		PASS_COUNT
+	};
+
+	// attribute locations of the instanced program: a mat4 model matrix
+	// (4 locations), a mat3 normal matrix (3 locations) and the texture layer.
+	enum
+	{
+		INSTANCE_LOCATION = 3,
+		INSTANCE_LOCATION_COUNT = 8,
+	};
+
+	// shorter runs are cheaper as plain draws than setting the instance arrays.
+	enum { MIN_INSTANCE_COUNT = 8 };
+
+	struct Statistics
+	{
+		int mItemCount;
+		int mProgramChanges;
+		int mMaterialChanges;
+		int mTextureChanges;
+		int mLayerChanges;		// material changes that only set the layer
+		int mMeshChanges;
+		// what the same draws cost in scene order
+		int mUnsortedMaterialChanges;
+		int mUnsortedMeshChanges;
+		// items drawn instanced and the instanced draw calls they took
+		int mInstancedItems;
+		int mInstancedDraws;
+	};
+
+	RenderQueue();
+	~RenderQueue();
+
+	void beginFrame();
+
+	// queue every submesh of the mesh. pMeshletView may be NULL.
+	void submit(FbxNode *pNode, const VBOMesh *pMesh, const FbxAMatrix & pGlobalTransform, int pLod,
+		const MeshletView *pMeshletView, const GameContext *gameContext);
+
+	// draw every submesh right away, for meshes whose vertex buffer is
+	// rewritten per node (deformed meshes).
+	void drawNow(FbxNode *pNode, const VBOMesh *pMesh, const FbxAMatrix & pGlobalTransform, int pLod,
+		GameContext *gameContext);
+
+	// sort and draw the queued items.
+	void execute(GameContext *gameContext);
+
+	const Statistics & getStatistics() const { return mStatistics; }
+	void printStatistics() const;
+
+	// NULL for the default material.
+	static const MaterialCache *getMaterialCache(FbxNode *pNode, int pSubMesh);
+
+private:
+	struct NodeRecord
+	{
+		FbxAMatrix mTransform;
+		const VBOMesh *mMesh;
+		int mLod;
+		bool mHasMeshletView;
+		MeshletView mMeshletView;
+	};
+
+	struct Item
+	{
+		unsigned long long mKey;
+		int mNode;				// index in mNodes
+		int mSubMesh;
+		const MaterialCache *mMaterial;		// NULL for the default material
+		const ShaderProgram *mProgram;
+	};
+
+	// the state the last executed item left behind.
+	struct DrawState
+	{
+		const ShaderProgram *mProgram;
+		const MaterialCache *mMaterial;
+		const VBOMesh *mMesh;
+		int mNode;
+		bool mHasMaterial;
+		GLuint mTexture;
+	};
+
+	void sortItems();
+	// move the runs of at least MIN_INSTANCE_COUNT items to the instanced
+	// program, after the other items of the pass, and upload their matrices.
+	void groupInstances(GameContext *gameContext);
+	bool isSameInstance(const Item & pItem, const Item & pOther) const;
+	void bindInstanceArrays(GLStateCache *glState, int pFirstInstance) const;
+	// set program, mesh and material for pItem.
+	void applyState(GameContext *gameContext, const Item & pItem, const NodeRecord & pNode, DrawState & pState);
+	void executeItem(GameContext *gameContext, const Item & pItem, const NodeRecord & pNode, DrawState & pState);
+	// pCount items from position pFirst of mOrder, all drawn with one call.
+	void executeInstanced(GameContext *gameContext, int pFirst, int pCount, DrawState & pState);
+
+	std::vector<NodeRecord> mNodes;
+	std::vector<Item> mItems;
+	std::vector<int> mOrder;
+	std::vector<int> mScratch;
+	// position in mOrder of the first instanced item, mOrder.size() if none
+	int mFirstInstanced;
+	std::vector<GLfloat> mInstanceData;
+	GLuint mInstanceBuffer;
+	// the buffer only grows, so vertex arrays never point past its end.
+	GLsizeiptr mInstanceCapacity;
+	const MaterialCache *mLastSubmittedMaterial;
+	const VBOMesh *mLastSubmittedMesh;
+	Statistics mStatistics;
+};
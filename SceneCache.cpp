@@ -3,20 +3,105 @@
 #include "GameContext.h"
 #include "ShaderProgram.h"
 #include "Transform.h"
+#include "MeshSimplifier.h"
+#include "FrameUniforms.h"
+#include "GLStateCache.h"
+#include "VertexPacking.h"
+#include "VertexWelder.h"
+#include "IndexOptimizer.h"
+#include "WorkerPool.h"
+#include "Simd.h"
+#include "TextureLoader.h"
+#include <algorithm>
 namespace
 {
 	const int TRIANGLE_VERTEX_COUNT = 3;
 
+	// meshes below this triangle count keep a single level.
+	const int MIN_LOD_TRIANGLES = 64;
+
+	// every level targets this fraction of the triangles of the previous one.
+	const float LOD_REDUCTION = 0.5f;
+
+	// a level that keeps more than this fraction of the previous one is dropped.
+	const float MIN_LOD_REDUCTION = 0.9f;
+
+	// screen space error allowed for a simplified level, in pixels.
+	const double LOD_PIXEL_ERROR = 1.0;
+
+	// smaller submeshes are culled with the whole mesh only.
+	const int MIN_MESHLET_SUBMESH_TRIANGLES = 256;
+
 	const int VERTEX_STRIDE = 4;
 
 	const int NORMAL_STRIDE = 3;
 
 	const int UV_STRIDE = 2;
 
+	// the uvs of untextured materials and whole textures.
+	const GLfloat IDENTITY_UV_TRANSFORM[4] = { 1.0f, 1.0f, 0.0f, 0.0f };
+
+	// larger meshes are not merged into static batches, they keep their levels and meshlets.
+	const int MAX_BATCHED_TRIANGLES = 256;
+
+	// a cluster may split where its cache misses stay under this factor of its ACMR.
+	const float OVERDRAW_THRESHOLD = 1.05f;
+
+	// a full ring region is polled this long at a time, in nanoseconds.
+	const GLuint64 DYNAMIC_WAIT_NANOSECONDS = 1000000;
+
+	// packed meshes whose error passes these go back to floats. in object units,
+	// a tenth of a millimetre in a centimetre scene.
+	const float MAX_PACKED_POSITION_ERROR = 0.01f;
+	// half a texel of a 1024 texture, half floats pass it up to a uv of 2.
+	const float MAX_PACKED_UV_ERROR = 1.0f / 2048.0f;
+
+	// deformed meshes with more vertices expand their positions on the workers.
+	const int MIN_PARALLEL_VERTICES = 8192;
+	const int VERTICES_PER_TASK = 4096;
+
+	// position of every vertex in [pBegin, pEnd) from its control point.
+	void expandControlPoints(const FbxVector4 *pControlPoints, const GLuint *pRemap, int pBegin, int pEnd, GLfloat *pVertices)
+	{
+		for (int i = pBegin; i < pEnd; ++i)
+		{
+			Float4::loadDouble3(pControlPoints[pRemap[i]].mData, 1.0f).store(pVertices + i * VERTEX_STRIDE);
+		}
+	}
+
+	// optimizeVertexCache over the vertices of one meshlet rather than the
+	// whole mesh. pLocal maps mesh vertices to meshlet ones, it is all -1
+	// before and after.
+	void optimizeMeshletVertexCache(GLuint *pIndices, int pTriangleCount, std::vector<int> & pLocal)
+	{
+		const int indexCount = pTriangleCount * TRIANGLE_VERTEX_COUNT;
+		std::vector<GLuint> meshVertices;
+		std::vector<GLuint> localIndices(indexCount);
+		for (int i = 0; i < indexCount; i++)
+		{
+			int & local = pLocal[pIndices[i]];
+			if (local < 0)
+			{
+				local = static_cast<int>(meshVertices.size());
+				meshVertices.push_back(pIndices[i]);
+			}
+			localIndices[i] = static_cast<GLuint>(local);
+		}
+		optimizeVertexCache(&localIndices[0], pTriangleCount, static_cast<int>(meshVertices.size()), VERTEX_CACHE_SIZE, NULL);
+		for (int i = 0; i < indexCount; i++)
+		{
+			pIndices[i] = meshVertices[localIndices[i]];
+		}
+		for (size_t i = 0; i < meshVertices.size(); i++)
+		{
+			pLocal[meshVertices[i]] = -1;
+		}
+	}
+
 	FbxDouble3 getMaterialProperty(const FbxSurfaceMaterial *pMaterial,
 		const char *pPropertyName,
 		const char *pFactorPropertyName,
-		GLuint &pTextureName)
+		const TextureHandle *&pTexture)
 	{
 		FbxDouble3 result(0, 0, 0);
 		const FbxProperty property = pMaterial->FindProperty(pPropertyName);
@@ -41,7 +126,7 @@ namespace
 				const FbxFileTexture *texture = property.GetSrcObject<FbxFileTexture>();
 				if (texture && texture->GetUserDataPtr())
 				{
-					pTextureName = *(static_cast<GLuint *>(texture->GetUserDataPtr()));
+					pTexture = static_cast<const TextureHandle *>(texture->GetUserDataPtr());
 				}
 			}
 		}
@@ -49,16 +134,40 @@ namespace
 	}
 }
 
-VBOMesh::VBOMesh() : mHasNormal(false), mHasUV(false), mAllByControlPoint(true)
+int VBOMesh::sMeshCount = 0;
+
+VBOMesh::VBOMesh() : mVertexArray(0), mHasNormal(false), mHasUV(false), mAllByControlPoint(true), mId(++sMeshCount),
+	mVertexFormat(VERTEX_FORMAT_FLOAT), mLodCount(1), mDynamicSlotSize(0), mDynamicSlotCount(1), mDynamicRegion(-1),
+	mDynamicFrame(-1), mDynamicSlot(0)
 {
 	for (int i = 0; i < VBO_COUNT; i++)
 	{
 		mVBONames[i] = 0;
 	}
+	for (int i = 0; i < DYNAMIC_RING_SIZE; i++)
+	{
+		mDynamicFences[i] = 0;
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		mBoundsMin[i] = 0;
+		mBoundsMax[i] = 0;
+		mPositionDecode[i] = 0;
+		mPositionDecode[3 + i] = 1;
+	}
+	for (int i = 0; i < MAX_LOD_COUNT; i++)
+	{
+		mLodError[i] = 0;
+	}
 }
 
 VBOMesh::~VBOMesh()
 {
+	for (int i = 0; i < DYNAMIC_RING_SIZE; i++)
+	{
+		glDeleteSync(mDynamicFences[i]);
+	}
+	glDeleteVertexArrays(1, &mVertexArray);
 	glDeleteBuffers(VBO_COUNT, mVBONames);
 	for (int i = 0; i < mSubMeshes.GetCount(); i++)
 	{
@@ -67,7 +176,7 @@ VBOMesh::~VBOMesh()
 	mSubMeshes.Clear();
 }
 
-bool VBOMesh::initialize(const FbxMesh* mesh)
+bool VBOMesh::initialize(const FbxMesh* mesh, VertexFormat pFormat)
 {
 	if (!mesh->GetNode())
 	{
@@ -224,11 +333,25 @@ bool VBOMesh::initialize(const FbxMesh* mesh)
 				}
 				currentUV = uvElement->GetDirectArray().GetAt(uvIndex);
 				uvs[i * UV_STRIDE] = static_cast<GLfloat>(currentUV[0]);
-				uvs[i * UV_STRIDE] = static_cast<GLfloat>(currentUV[1]);
+				uvs[i * UV_STRIDE + 1] = static_cast<GLfloat>(currentUV[1]);
 			}
 		}
 	}
 
+	// control point of every polygon vertex, for the welded vertices below.
+	std::vector<GLuint> vertexControlPoints;
+	if (!mAllByControlPoint)
+	{
+		vertexControlPoints.assign(polygonVertexCount, 0);
+	}
+	else
+	{
+		for (int i = 0; i < polygonVertexCount; i++)
+		{
+			vertexControlPoints.push_back(static_cast<GLuint>(i));
+		}
+	}
+
 	int vertexCount = 0;
 	for (int polygonIndex = 0; polygonIndex < polygonCount; polygonIndex++)
 	{
@@ -252,6 +375,7 @@ bool VBOMesh::initialize(const FbxMesh* mesh)
 				else
 				{
 					indices[indexOffset + verticeIndex] = static_cast<GLuint>(vertexCount);
+					vertexControlPoints[vertexCount] = static_cast<GLuint>(controlPointIndex);
 					currentVertex = controlPoints[controlPointIndex];
 					vertices[vertexCount * VERTEX_STRIDE] = static_cast<GLfloat>(currentVertex[0]);
 					vertices[vertexCount * VERTEX_STRIDE + 1] = static_cast<GLfloat>(currentVertex[1]);
@@ -281,95 +405,272 @@ bool VBOMesh::initialize(const FbxMesh* mesh)
 		mSubMeshes[materialIndex]->TriangleCount += 1;
 	}
 
-	glGenBuffers(VBO_COUNT, mVBONames);
+	// deformed meshes rewrite their float positions every frame.
+	const bool deformed = mesh->GetDeformerCount(FbxDeformer::eSkin) > 0;
 
-	glBindBuffer(GL_ARRAY_BUFFER, mVBONames[VERTEX_VBO]);
-	glBufferData(GL_ARRAY_BUFFER, polygonVertexCount * VERTEX_STRIDE * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
-	delete[] vertices;
-	
+	// corners with the same position, normal and uv become one vertex. the
+	// skin follows the control point, so deformed corners also need the same one.
+	std::vector<int> source;
+	if (!mAllByControlPoint)
+	{
+		const int weldedCount = weldVertices(vertices, VERTEX_STRIDE, normals, uvs,
+			deformed ? &vertexControlPoints[0] : NULL, polygonVertexCount,
+			indices, polygonCount * TRIANGLE_VERTEX_COUNT, source);
+		cout << "weld: " << mesh->GetNode()->GetName() << " " << polygonVertexCount << " -> " << weldedCount << " vertices" << endl;
+		// source only grows, the control points compact in place.
+		for (int i = 0; i < weldedCount; i++)
+		{
+			vertexControlPoints[i] = vertexControlPoints[source[i]];
+		}
+		vertexControlPoints.resize(weldedCount);
+		polygonVertexCount = weldedCount;
+	}
+
+	// triangles in vertex cache order, clustered against overdraw, then the
+	// vertices in the order the triangles first use them.
+	const int indexCount = polygonCount * TRIANGLE_VERTEX_COUNT;
+	VertexCacheStatistics cacheBefore;
+	measureVertexCache(indices, polygonCount, polygonVertexCount, VERTEX_CACHE_SIZE, cacheBefore);
+	std::vector<int> clusters;
+	for (int i = 0; i < mSubMeshes.GetCount(); i++)
+	{
+		GLuint *subMeshIndices = indices + mSubMeshes[i]->IndexOffset;
+		optimizeVertexCache(subMeshIndices, mSubMeshes[i]->TriangleCount, polygonVertexCount, VERTEX_CACHE_SIZE, &clusters);
+		optimizeOverdraw(subMeshIndices, mSubMeshes[i]->TriangleCount, vertices, VERTEX_STRIDE, polygonVertexCount,
+			clusters, VERTEX_CACHE_SIZE, OVERDRAW_THRESHOLD);
+	}
+	polygonVertexCount = optimizeVertexFetch(indices, indexCount, polygonVertexCount, source);
+	remapVertexAttribute(vertices, VERTEX_STRIDE, source);
 	if (mHasNormal)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, mVBONames[NORMAL_VBO]);
-		glBufferData(GL_ARRAY_BUFFER, polygonVertexCount * NORMAL_STRIDE * sizeof(GLfloat), normals, GL_STATIC_DRAW);
-		delete[] normals;
+		remapVertexAttribute(normals, NORMAL_STRIDE, source);
 	}
 	if (mHasUV)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, mVBONames[UV_VBO]);
-		glBufferData(GL_ARRAY_BUFFER, polygonVertexCount * UV_STRIDE * sizeof(GLfloat), uvs, GL_STATIC_DRAW);
-		delete[] uvs;
+		remapVertexAttribute(uvs, UV_STRIDE, source);
+	}
+	if (deformed)
+	{
+		mVertexControlPoints.resize(polygonVertexCount);
+		for (int i = 0; i < polygonVertexCount; i++)
+		{
+			mVertexControlPoints[i] = vertexControlPoints[source[i]];
+		}
 	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mVBONames[INDEX_VBO]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, polygonCount * TRIANGLE_VERTEX_COUNT * sizeof(GLuint), indices, GL_STATIC_DRAW);
-	delete[] indices;
+	for (int i = 0; i < polygonVertexCount; i++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const GLfloat value = vertices[i * VERTEX_STRIDE + axis];
+			if (i == 0 || value < mBoundsMin[axis])
+			{
+				mBoundsMin[axis] = value;
+			}
+			if (i == 0 || value > mBoundsMax[axis])
+			{
+				mBoundsMax[axis] = value;
+			}
+		}
+	}
 
-	mVerticesCount = polygonVertexCount * VERTEX_STRIDE;
-	mIndicesCount = polygonCount * TRIANGLE_VERTEX_COUNT;
-	return true;
-}
+	// how densely the uvs cover the surface, for the texture streaming.
+	for (int i = 0; mHasUV && i < mSubMeshes.GetCount(); i++)
+	{
+		double surfaceArea = 0.0;
+		double uvArea = 0.0;
+		const GLuint *triangles = indices + mSubMeshes[i]->IndexOffset;
+		for (int t = 0; t < mSubMeshes[i]->TriangleCount; t++)
+		{
+			const GLfloat *p0 = vertices + triangles[t * 3] * VERTEX_STRIDE;
+			const GLfloat *p1 = vertices + triangles[t * 3 + 1] * VERTEX_STRIDE;
+			const GLfloat *p2 = vertices + triangles[t * 3 + 2] * VERTEX_STRIDE;
+			const FbxVector4 edge1(p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2], 0);
+			const FbxVector4 edge2(p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2], 0);
+			surfaceArea += edge1.CrossProduct(edge2).Length();
+
+			const GLfloat *uv0 = uvs + triangles[t * 3] * UV_STRIDE;
+			const GLfloat *uv1 = uvs + triangles[t * 3 + 1] * UV_STRIDE;
+			const GLfloat *uv2 = uvs + triangles[t * 3 + 2] * UV_STRIDE;
+			uvArea += fabs((uv1[0] - uv0[0]) * (uv2[1] - uv0[1]) - (uv2[0] - uv0[0]) * (uv1[1] - uv0[1]));
+		}
+		mSubMeshes[i]->UVDensity = surfaceArea > 0.0 ? static_cast<float>(sqrt(uvArea / surfaceArea)) : 0.0f;
+	}
 
-void VBOMesh::updateVertexPosition(const FbxMesh* pMesh, const FbxVector4* pVertices) const
-{
-	// convert to the same sequence with data in gpu.
-	float *vertices = NULL;
-	int vertexCount = 0;
+	// meshlets reorder the full detail triangles, everything below uses the new order.
+	std::vector<int> meshletVertices(polygonVertexCount, -1);
+	for (int i = 0; i < mSubMeshes.GetCount(); i++)
+	{
+		SubMesh *subMesh = mSubMeshes[i];
+		if (subMesh->TriangleCount >= MIN_MESHLET_SUBMESH_TRIANGLES)
+		{
+			subMesh->FirstMeshlet = static_cast<int>(mMeshlets.size());
+			buildMeshlets(vertices, VERTEX_STRIDE, indices, subMesh->IndexOffset, subMesh->TriangleCount, mMeshlets);
+			subMesh->MeshletCount = static_cast<int>(mMeshlets.size()) - subMesh->FirstMeshlet;
+			// the meshlets keep their triangles and vertex ranges, only the order inside changes.
+			for (int m = subMesh->FirstMeshlet; m < subMesh->FirstMeshlet + subMesh->MeshletCount; m++)
+			{
+				optimizeMeshletVertexCache(indices + mMeshlets[m].mIndexOffset, mMeshlets[m].mTriangleCount, meshletVertices);
+			}
+		}
+	}
 
-	if (mAllByControlPoint)
+	VertexCacheStatistics cacheAfter;
+	measureVertexCache(indices, polygonCount, polygonVertexCount, VERTEX_CACHE_SIZE, cacheAfter);
+	cout << "index order: " << mesh->GetNode()->GetName() << " acmr " << cacheBefore.mACMR << " -> " << cacheAfter.mACMR
+		<< " atvr " << cacheBefore.mATVR << " -> " << cacheAfter.mATVR << endl;
+
+	for (int i = 0; i < mSubMeshes.GetCount(); i++)
 	{
-		vertexCount = pMesh->GetControlPointsCount();
-		vertices = new GLfloat[vertexCount * VERTEX_STRIDE];
-		for (int i = 0; i < vertexCount; ++i)
+		mPickMesh.addTriangles(vertices, VERTEX_STRIDE, indices, mSubMeshes[i]->IndexOffset, mSubMeshes[i]->TriangleCount, i);
+	}
+
+	mIndicesCount = indexCount;
+	std::vector<GLuint> lodIndices;
+	buildLods(mesh, vertices, normals, uvs, polygonVertexCount, indices, lodIndices);
+
+	mVertexFormat = deformed ? VERTEX_FORMAT_FLOAT : pFormat;
+
+	if (polygonCount <= MAX_BATCHED_TRIANGLES && !deformed)
+	{
+		mVertexData.mPositions.assign(vertices, vertices + polygonVertexCount * VERTEX_STRIDE);
+		if (mHasNormal)
 		{
-			vertices[i * VERTEX_STRIDE] = static_cast<GLfloat>(pVertices[i][0]);
-			vertices[i * VERTEX_STRIDE + 1] = static_cast<GLfloat>(pVertices[i][1]);
-			vertices[i * VERTEX_STRIDE + 2] = static_cast<GLfloat>(pVertices[i][2]);
-			vertices[i * VERTEX_STRIDE + 3] = 1;
+			mVertexData.mNormals.assign(normals, normals + polygonVertexCount * NORMAL_STRIDE);
+		}
+		if (mHasUV)
+		{
+			mVertexData.mUVs.assign(uvs, uvs + polygonVertexCount * UV_STRIDE);
+		}
+		mVertexData.mIndices.assign(indices, indices + mIndicesCount);
+	}
+
+	std::vector<PackedVertex> packed;
+	if (mVertexFormat == VERTEX_FORMAT_PACKED)
+	{
+		packed.resize(polygonVertexCount);
+		PackingError error;
+		packVertices(vertices, mHasNormal ? normals : NULL, mHasUV ? uvs : NULL, polygonVertexCount,
+			mBoundsMin, mBoundsMax, &packed[0], error);
+
+		const bool precise = error.mPosition <= MAX_PACKED_POSITION_ERROR && error.mUV <= MAX_PACKED_UV_ERROR;
+		cout << "vertex format: " << mesh->GetNode()->GetName() << (precise ? " packed " : " float, packed ")
+			<< sizeof(PackedVertex) << " bytes (float "
+			<< (VERTEX_STRIDE + (mHasNormal ? NORMAL_STRIDE : 0) + (mHasUV ? UV_STRIDE : 0)) * sizeof(GLfloat)
+			<< "), error position " << error.mPosition << " normal " << error.mNormalDegrees
+			<< " degrees uv " << error.mUV << endl;
+		if (!precise)
+		{
+			mVertexFormat = VERTEX_FORMAT_FLOAT;
+		}
+	}
+
+	glGenBuffers(VBO_COUNT, mVBONames);
+
+	if (mVertexFormat == VERTEX_FORMAT_PACKED)
+	{
+		// one interleaved stream in VERTEX_VBO, the other two stay empty.
+		glBindBuffer(GL_ARRAY_BUFFER, mVBONames[VERTEX_VBO]);
+		glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), &packed[0], GL_STATIC_DRAW);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			mPositionDecode[axis] = mBoundsMin[axis];
+			mPositionDecode[3 + axis] = mBoundsMax[axis] - mBoundsMin[axis];
 		}
 	}
 	else
 	{
-		const int polygonCount = pMesh->GetPolygonCount();
-		vertexCount = polygonCount * TRIANGLE_VERTEX_COUNT;
-		vertices = new GLfloat[vertexCount * VERTEX_STRIDE];
+		glBindBuffer(GL_ARRAY_BUFFER, mVBONames[VERTEX_VBO]);
+		if (deformed)
+		{
+			// the ring updateVertexPosition streams into, the bind pose until the first update.
+			mDynamicSlotSize = polygonVertexCount * VERTEX_STRIDE * sizeof(GLfloat);
+			glBufferData(GL_ARRAY_BUFFER, mDynamicSlotSize * mDynamicSlotCount * DYNAMIC_RING_SIZE, NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, mDynamicSlotSize, vertices);
+		}
+		else
+		{
+			glBufferData(GL_ARRAY_BUFFER, polygonVertexCount * VERTEX_STRIDE * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+		}
 
-		vertexCount = 0;
-		for (int polygonIndex = 0; polygonIndex < polygonCount; ++polygonIndex)
+		if (mHasNormal)
 		{
-			for (int verticeIndex = 0; verticeIndex < TRIANGLE_VERTEX_COUNT; ++verticeIndex)
-			{
-				const int controlPointIndex = pMesh->GetPolygonVertex(polygonIndex, verticeIndex);
-				// if the controlPointIndex is -1, we probably have a corrupted mesh data.
-				// at this point, it is not guaranted that the cache will work as expected.
-				if (controlPointIndex >= 0)
-				{
-					vertices[vertexCount * VERTEX_STRIDE] = static_cast<GLfloat>(pVertices[controlPointIndex][0]);
-					vertices[vertexCount * VERTEX_STRIDE + 1] = static_cast<GLfloat>(pVertices[controlPointIndex][1]);
-					vertices[vertexCount * VERTEX_STRIDE + 2] = static_cast<GLfloat>(pVertices[controlPointIndex][2]);
-					vertices[vertexCount * VERTEX_STRIDE + 3] = 1;
-				}
-				++vertexCount;
-			}
+			glBindBuffer(GL_ARRAY_BUFFER, mVBONames[NORMAL_VBO]);
+			glBufferData(GL_ARRAY_BUFFER, polygonVertexCount * NORMAL_STRIDE * sizeof(GLfloat), normals, GL_STATIC_DRAW);
+		}
+		if (mHasUV)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, mVBONames[UV_VBO]);
+			glBufferData(GL_ARRAY_BUFFER, polygonVertexCount * UV_STRIDE * sizeof(GLfloat), uvs, GL_STATIC_DRAW);
 		}
 	}
+	delete[] vertices;
+	delete[] normals;
+	delete[] uvs;
 
-	if (vertices)
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mVBONames[INDEX_VBO]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (mIndicesCount + lodIndices.size()) * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, mIndicesCount * sizeof(GLuint), indices);
+	if (!lodIndices.empty())
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, mVBONames[VERTEX_VBO]);
-		glBufferData(GL_ARRAY_BUFFER, vertexCount * VERTEX_STRIDE * sizeof(float), vertices, GL_STATIC_DRAW);
-		delete[] vertices;
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mIndicesCount * sizeof(GLuint), lodIndices.size() * sizeof(GLuint), &lodIndices[0]);
 	}
+	delete[] indices;
+
+	recordVertexArray();
+
+	mVerticesCount = polygonVertexCount * VERTEX_STRIDE;
+	return true;
 }
 
+void VBOMesh::releaseVertexData()
+{
+	// swap, clear() keeps the capacity.
+	VertexData empty;
+	std::swap(mVertexData.mPositions, empty.mPositions);
+	std::swap(mVertexData.mNormals, empty.mNormals);
+	std::swap(mVertexData.mUVs, empty.mUVs);
+	std::swap(mVertexData.mIndices, empty.mIndices);
+}
 
-void VBOMesh::beginDraw() const
+void VBOMesh::recordVertexArray()
 {
+	glGenVertexArrays(1, &mVertexArray);
+	glBindVertexArray(mVertexArray);
+
+	if (mVertexFormat == VERTEX_FORMAT_PACKED)
+	{
+		// the 10_10_10_2 normal needs 4 components, the shader reads xyz.
+		const GLsizei stride = sizeof(PackedVertex);
+		glBindBuffer(GL_ARRAY_BUFFER, mVBONames[VERTEX_VBO]);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+			reinterpret_cast<const GLvoid *>(offsetof(PackedVertex, mPosition)));
+		if (mHasNormal)
+		{
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+				reinterpret_cast<const GLvoid *>(offsetof(PackedVertex, mNormal)));
+		}
+		if (mHasUV)
+		{
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+				reinterpret_cast<const GLvoid *>(offsetof(PackedVertex, mUV)));
+		}
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mVBONames[INDEX_VBO]);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+
 	glBindBuffer(GL_ARRAY_BUFFER, mVBONames[VERTEX_VBO]);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, VERTEX_STRIDE, GL_FLOAT, GL_FALSE, 0, 0);
 
-	
-	//todo normals
+	// a missing channel keeps its array disabled, the shader reads the default.
 	if (mHasNormal)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, mVBONames[NORMAL_VBO]);
@@ -377,7 +678,6 @@ void VBOMesh::beginDraw() const
 		glVertexAttribPointer(1, NORMAL_STRIDE, GL_FLOAT, GL_FALSE, 0, 0);
 	}
 
-	//todo uvs
 	if (mHasUV)
 	{
 		glBindBuffer(GL_ARRAY_BUFFER, mVBONames[UV_VBO]);
@@ -386,17 +686,239 @@ void VBOMesh::beginDraw() const
 	}
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mVBONames[INDEX_VBO]);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void VBOMesh::buildLods(const FbxMesh *pMesh, const GLfloat *pVertices, const GLfloat *pNormals, const GLfloat *pUVs,
+	int pVertexCount, const GLuint *pIndices, std::vector<GLuint> & pLodIndices)
+{
+	const int subMeshCount = mSubMeshes.GetCount();
+	for (int i = 0; i < subMeshCount; i++)
+	{
+		mSubMeshes[i]->LodIndexOffset[0] = mSubMeshes[i]->IndexOffset;
+		mSubMeshes[i]->LodTriangleCount[0] = mSubMeshes[i]->TriangleCount;
+	}
+	mLodCount = 1;
+	mLodError[0] = 0;
+
+	const int triangleCount = mIndicesCount / TRIANGLE_VERTEX_COUNT;
+	if (triangleCount < MIN_LOD_TRIANGLES)
+	{
+		return;
+	}
+
+	MeshSimplifier simplifier(pVertices, VERTEX_STRIDE, pVertexCount, pNormals, pUVs);
+	std::vector<GLuint> source, simplified;
+	int previousCount = triangleCount;
+	for (int lod = 1; lod < MAX_LOD_COUNT; lod++)
+	{
+		const size_t levelStart = pLodIndices.size();
+		float levelError = 0;
+		int levelCount = 0;
+		for (int i = 0; i < subMeshCount; i++)
+		{
+			SubMesh *subMesh = mSubMeshes[i];
+			const int count = subMesh->LodTriangleCount[lod - 1];
+			if (lod == 1)
+			{
+				source.assign(pIndices + subMesh->IndexOffset, pIndices + subMesh->IndexOffset + count * 3);
+			}
+			else
+			{
+				const size_t begin = subMesh->LodIndexOffset[lod - 1] - mIndicesCount;
+				source.assign(pLodIndices.begin() + begin, pLodIndices.begin() + begin + count * 3);
+			}
+
+			const float error = count > 0 ? simplifier.simplify(source.data(), count,
+				static_cast<int>(count * LOD_REDUCTION), simplified) : 0.0f;
+			subMesh->LodIndexOffset[lod] = mIndicesCount + static_cast<int>(pLodIndices.size());
+			subMesh->LodTriangleCount[lod] = static_cast<int>(simplified.size()) / 3;
+			optimizeVertexCache(simplified.data(), subMesh->LodTriangleCount[lod], pVertexCount, VERTEX_CACHE_SIZE, NULL);
+			pLodIndices.insert(pLodIndices.end(), simplified.begin(), simplified.end());
+			simplified.clear();
+
+			levelError = std::max(levelError, error);
+			levelCount += subMesh->LodTriangleCount[lod];
+		}
+
+		if (levelCount > previousCount * MIN_LOD_REDUCTION)
+		{
+			pLodIndices.resize(levelStart);
+			break;
+		}
+		// errors add up, every level is simplified from the previous one.
+		mLodError[lod] = mLodError[lod - 1] + levelError;
+		previousCount = levelCount;
+		++mLodCount;
+	}
+
+	cout << "lod: " << pMesh->GetNode()->GetName() << " " << triangleCount;
+	for (int lod = 1; lod < mLodCount; lod++)
+	{
+		int levelCount = 0;
+		for (int i = 0; i < subMeshCount; i++)
+		{
+			levelCount += mSubMeshes[i]->LodTriangleCount[lod];
+		}
+		cout << " -> " << levelCount << " (" << levelCount * 100 / triangleCount << "%, error " << mLodError[lod] << ")";
+	}
+	cout << endl;
 }
 
-GLfloat *getMatrix(FbxMatrix mat)
+bool VBOMesh::projectBounds(const GameContext *gameContext, const FbxAMatrix & pGlobalTransform, double & pScale,
+	double & pPixelsPerUnit) const
 {
-	GLfloat *ret = new GLfloat[16];
-	double *tmp = (double *)mat;
-	for (int i = 0; i < 16; i++)
+	// bounding sphere of the mesh in world space.
+	const FbxVector4 localCenter((mBoundsMin[0] + mBoundsMax[0]) * 0.5, (mBoundsMin[1] + mBoundsMax[1]) * 0.5,
+		(mBoundsMin[2] + mBoundsMax[2]) * 0.5);
+	const FbxVector4 halfExtent((mBoundsMax[0] - mBoundsMin[0]) * 0.5, (mBoundsMax[1] - mBoundsMin[1]) * 0.5,
+		(mBoundsMax[2] - mBoundsMin[2]) * 0.5, 0);
+	const FbxVector4 scaling = pGlobalTransform.GetS();
+	pScale = std::max(fabs(scaling[0]), std::max(fabs(scaling[1]), fabs(scaling[2])));
+	const FbxVector4 center = pGlobalTransform.MultT(localCenter);
+	const FbxVector4 toCenter = center - gameContext->eyePos;
+	const double distance = toCenter.Length() - halfExtent.Length() * pScale;
+	if (distance <= 0)
 	{
-		ret[i] = tmp[i];
+		return false;
 	}
-	return ret;
+
+	// proMatrix[1][1] is cot(fovy / 2), so this is the size of one world unit in pixels.
+	pPixelsPerUnit = gameContext->mHeight * 0.5 * gameContext->proMatrix.Get(1, 1) / distance;
+	return true;
+}
+
+int VBOMesh::selectLod(const GameContext *gameContext, const FbxAMatrix & pGlobalTransform) const
+{
+	double scale = 0.0;
+	double pixelsPerUnit = 0.0;
+	if (mLodCount == 1 || !projectBounds(gameContext, pGlobalTransform, scale, pixelsPerUnit))
+	{
+		return 0;
+	}
+
+	for (int lod = mLodCount - 1; lod > 0; lod--)
+	{
+		if (mLodError[lod] * scale * pixelsPerUnit <= LOD_PIXEL_ERROR)
+		{
+			return lod;
+		}
+	}
+	return 0;
+}
+
+void VBOMesh::requestTextureLevels(FbxNode *pNode, const FbxAMatrix & pGlobalTransform, GameContext *gameContext) const
+{
+	TextureLoader *textureLoader = gameContext->mTextureLoader;
+	if (!textureLoader->isStreaming())
+	{
+		return;
+	}
+
+	// inside the bounds every texel may be close, the finest level is asked for.
+	double scale = 0.0;
+	double pixelsPerUnit = 0.0;
+	const double uvScale = projectBounds(gameContext, pGlobalTransform, scale, pixelsPerUnit)
+		? 1.0 / (scale * pixelsPerUnit) : 0.0;
+	const int subMeshCount = std::min(mSubMeshes.GetCount(), pNode->GetMaterialCount());
+	for (int i = 0; i < subMeshCount; i++)
+	{
+		const FbxSurfaceMaterial *material = pNode->GetMaterial(i);
+		const MaterialCache *materialCache = material ? static_cast<const MaterialCache *>(material->GetUserDataPtr()) : NULL;
+		if (materialCache && materialCache->getDiffuseTexture())
+		{
+			textureLoader->requestLevel(materialCache->getDiffuseTexture(),
+				static_cast<float>(mSubMeshes[i]->UVDensity * uvScale));
+		}
+	}
+}
+
+void VBOMesh::updateVertexPosition(GameContext *gameContext, const FbxVector4* pVertices) const
+{
+	const int vertexCount = static_cast<int>(mVertexControlPoints.size());
+	if (vertexCount == 0 || mDynamicSlotSize == 0)
+	{
+		return;
+	}
+
+	GLStateCache *glState = gameContext->mGLState;
+	const int frame = glState->getFrame();
+	if (frame != mDynamicFrame)
+	{
+		// every draw of the last frame's region is issued by now.
+		if (mDynamicRegion >= 0)
+		{
+			glDeleteSync(mDynamicFences[mDynamicRegion]);
+			mDynamicFences[mDynamicRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+
+		// the gpu only still reads the next region when it is a whole ring behind.
+		const int region = (mDynamicRegion + 1) % DYNAMIC_RING_SIZE;
+		if (mDynamicFences[region])
+		{
+			GLenum status;
+			do
+			{
+				status = glClientWaitSync(mDynamicFences[region], GL_SYNC_FLUSH_COMMANDS_BIT, DYNAMIC_WAIT_NANOSECONDS);
+			} while (status == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(mDynamicFences[region]);
+			mDynamicFences[region] = 0;
+		}
+		mDynamicRegion = region;
+		mDynamicFrame = frame;
+		mDynamicSlot = 0;
+	}
+
+	glState->bindVertexArray(mVertexArray);
+	glState->bindBuffer(GL_ARRAY_BUFFER, mVBONames[VERTEX_VBO]);
+	if (mDynamicSlot == mDynamicSlotCount)
+	{
+		// more instances than any frame before. the draws in flight keep the
+		// old storage, so the new one starts without fences.
+		mDynamicSlotCount *= 2;
+		glBufferData(GL_ARRAY_BUFFER, mDynamicSlotSize * mDynamicSlotCount * DYNAMIC_RING_SIZE, NULL, GL_STREAM_DRAW);
+		for (int i = 0; i < DYNAMIC_RING_SIZE; i++)
+		{
+			glDeleteSync(mDynamicFences[i]);
+			mDynamicFences[i] = 0;
+		}
+	}
+	const GLintptr offset = (mDynamicRegion * mDynamicSlotCount + mDynamicSlot) * mDynamicSlotSize;
+	++mDynamicSlot;
+	GLfloat *vertices = static_cast<GLfloat *>(glMapBufferRange(GL_ARRAY_BUFFER, offset, mDynamicSlotSize,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	if (!vertices)
+	{
+		cout << "error: cannot map the vertices of a deformed mesh" << endl;
+		return;
+	}
+
+	// convert to the same sequence with data in gpu: every vertex, welded
+	// and reordered, takes the position of its control point.
+	const GLuint *remap = &mVertexControlPoints[0];
+	if (vertexCount >= MIN_PARALLEL_VERTICES)
+	{
+		gameContext->mWorkerPool->parallelFor(vertexCount, VERTICES_PER_TASK, [&](int pBegin, int pEnd)
+		{
+			expandControlPoints(pVertices, remap, pBegin, pEnd, vertices);
+		});
+	}
+	else
+	{
+		expandControlPoints(pVertices, remap, 0, vertexCount, vertices);
+	}
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+
+	// the vertex array reads the positions from this slot until the next update.
+	glVertexAttribPointer(0, VERTEX_STRIDE, GL_FLOAT, GL_FALSE, 0, reinterpret_cast<const GLvoid *>(offset));
+}
+
+
+void VBOMesh::beginDraw(GameContext *gameContext) const
+{
+	gameContext->mGLState->bindVertexArray(mVertexArray);
 }
 
 void printMatrix(GLfloat *mat)
@@ -414,33 +936,67 @@ void printMatrix(GLfloat *mat)
 	cout << "===========================\n";
 }
 
-void VBOMesh::draw(GameContext *gameContext, FbxAMatrix globalTransform, int materialIndex) const
+void VBOMesh::draw(GameContext *gameContext, int materialIndex, int pLod, const MeshletView *pMeshletView) const
 {
-	GLfloat* model = getMatrix(globalTransform);
-	glUniformMatrix4fv((gameContext->mShaderProgram)->modelLoc, 1, GL_FALSE, model);
-
-	GLfloat *view = getMatrix(gameContext->viewMatrix);
-	glUniformMatrix4fv((gameContext->mShaderProgram)->viewLoc, 1, GL_FALSE, view);
-
-	GLfloat *projection = getMatrix(gameContext->proMatrix);
-	glUniformMatrix4fv((gameContext->mShaderProgram)->proLoc, 1, GL_FALSE, projection);
+	const SubMesh *subMesh = mSubMeshes[materialIndex];
+	if (pLod == 0 && pMeshletView && subMesh->MeshletCount > 0)
+	{
+		// neighbouring visible meshlets are contiguous, they go in one call.
+		MeshletCuller *meshletCuller = gameContext->mMeshletCuller;
+		const int lastMeshlet = subMesh->FirstMeshlet + subMesh->MeshletCount;
+		int rangeStart = -1;
+		GLuint minVertex = 0, maxVertex = 0;
+		for (int i = subMesh->FirstMeshlet; i <= lastMeshlet; i++)
+		{
+			const bool visible = i < lastMeshlet && meshletCuller->isVisible(*pMeshletView, mMeshlets[i]);
+			if (visible && rangeStart < 0)
+			{
+				rangeStart = i;
+				minVertex = mMeshlets[i].mMinVertex;
+				maxVertex = mMeshlets[i].mMaxVertex;
+			}
+			else if (visible)
+			{
+				minVertex = std::min(minVertex, mMeshlets[i].mMinVertex);
+				maxVertex = std::max(maxVertex, mMeshlets[i].mMaxVertex);
+			}
+			else if (rangeStart >= 0)
+			{
+				const Meshlet & first = mMeshlets[rangeStart];
+				const GLsizei elementCount = (mMeshlets[i - 1].mIndexOffset + mMeshlets[i - 1].mTriangleCount * 3) - first.mIndexOffset;
+				const GLsizei offset = first.mIndexOffset * sizeof(GLuint);
+				glDrawRangeElements(GL_TRIANGLES, minVertex, maxVertex, elementCount, GL_UNSIGNED_INT,
+					reinterpret_cast<const GLvoid *>(offset));
+				meshletCuller->addRange();
+				rangeStart = -1;
+			}
+		}
+		return;
+	}
 
-	delete[] model;
-	delete[] view;
-	delete[] projection;
-	GLsizei offset = mSubMeshes[materialIndex]->IndexOffset * sizeof(GLuint);
-	const GLsizei elementCount = mSubMeshes[materialIndex]->TriangleCount * 3;
+	GLsizei offset = subMesh->LodIndexOffset[pLod] * sizeof(GLuint);
+	const GLsizei elementCount = subMesh->LodTriangleCount[pLod] * 3;
 	glDrawElements(GL_TRIANGLES, elementCount, GL_UNSIGNED_INT, reinterpret_cast<const GLvoid *>(offset));
 }
 
-void VBOMesh::endDraw() const
+void VBOMesh::drawInstanced(int materialIndex, int pLod, GLsizei pInstanceCount) const
 {
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	const SubMesh *subMesh = mSubMeshes[materialIndex];
+	const GLsizei offset = subMesh->LodIndexOffset[pLod] * sizeof(GLuint);
+	const GLsizei elementCount = subMesh->LodTriangleCount[pLod] * 3;
+	glDrawElementsInstanced(GL_TRIANGLES, elementCount, GL_UNSIGNED_INT, reinterpret_cast<const GLvoid *>(offset), pInstanceCount);
 }
 
+void VBOMesh::endDraw(GameContext *gameContext) const
+{
+	// unbinding the index buffer here would change the vertex array itself.
+	gameContext->mGLState->bindVertexArray(0);
+}
+
+
+int MaterialCache::sMaterialCount = 0;
 
-MaterialCache::MaterialCache() :mShininess(0)
+MaterialCache::MaterialCache() :mShininess(0), mId(++sMaterialCount), mLookId(mId)
 {
 
 }
@@ -462,7 +1018,7 @@ void MaterialCache::print()
 bool MaterialCache::initialize(const FbxSurfaceMaterial* pMaterial)
 {
 	const FbxDouble3 emissive = getMaterialProperty(pMaterial,
-		FbxSurfaceMaterial::sEmissive, FbxSurfaceMaterial::sEmissiveFactor, mEmissive.mTextureName);
+		FbxSurfaceMaterial::sEmissive, FbxSurfaceMaterial::sEmissiveFactor, mEmissive.mTexture);
 		mEmissive.mColor[0] = static_cast<GLfloat>(emissive[0]);
 		mEmissive.mColor[1] = static_cast<GLfloat>(emissive[1]);
 		mEmissive.mColor[2] = static_cast<GLfloat>(emissive[2]);
@@ -483,19 +1039,19 @@ bool MaterialCache::initialize(const FbxSurfaceMaterial* pMaterial)
 	//}
 
 	const FbxDouble3 ambient = getMaterialProperty(pMaterial,
-		FbxSurfaceMaterial::sAmbient, FbxSurfaceMaterial::sAmbientFactor, mAmbient.mTextureName);
+		FbxSurfaceMaterial::sAmbient, FbxSurfaceMaterial::sAmbientFactor, mAmbient.mTexture);
 	mAmbient.mColor[0] = static_cast<GLfloat>(ambient[0]);
 	mAmbient.mColor[1] = static_cast<GLfloat>(ambient[1]);
 	mAmbient.mColor[2] = static_cast<GLfloat>(ambient[2]);
 
 	const FbxDouble3 diffuse = getMaterialProperty(pMaterial,
-		FbxSurfaceMaterial::sDiffuse, FbxSurfaceMaterial::sDiffuseFactor, mDiffuse.mTextureName);
+		FbxSurfaceMaterial::sDiffuse, FbxSurfaceMaterial::sDiffuseFactor, mDiffuse.mTexture);
 	mDiffuse.mColor[0] = static_cast<GLfloat>(diffuse[0]);
 	mDiffuse.mColor[1] = static_cast<GLfloat>(diffuse[1]);
 	mDiffuse.mColor[2] = static_cast<GLfloat>(diffuse[2]);
 
 	const FbxDouble3 specular = getMaterialProperty(pMaterial,
-		FbxSurfaceMaterial::sSpecular, FbxSurfaceMaterial::sSpecularFactor, mSpecular.mTextureName);
+		FbxSurfaceMaterial::sSpecular, FbxSurfaceMaterial::sSpecularFactor, mSpecular.mTexture);
 	mSpecular.mColor[0] = static_cast<GLfloat>(specular[0]);
 	mSpecular.mColor[1] = static_cast<GLfloat>(specular[1]);
 	mSpecular.mColor[2] = static_cast<GLfloat>(specular[2]);
@@ -516,24 +1072,73 @@ bool MaterialCache::initialize(const FbxSurfaceMaterial* pMaterial)
 	return true;
 }
 
-void MaterialCache::setCurrentMaterial(GameContext *gameContext) const
+void MaterialCache::setCurrentMaterial(const ShaderProgram *pProgram, GLStateCache *glState) const
 {
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.emissive"), 1, mEmissive.mColor);
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.ambient"), 1, mAmbient.mColor);
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.diffuse"), 1, mDiffuse.mColor);
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.specular"), 1, mSpecular.mColor);
+	pProgram->setVector4(ShaderProgram::MATERIAL_EMISSIVE, mEmissive.mColor);
+	pProgram->setVector4(ShaderProgram::MATERIAL_AMBIENT, mAmbient.mColor);
+	pProgram->setVector4(ShaderProgram::MATERIAL_DIFFUSE, mDiffuse.mColor);
+	pProgram->setVector4(ShaderProgram::MATERIAL_SPECULAR, mSpecular.mColor);
 	
-	glUniform1f(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.shininess"), mShininess);
+	pProgram->setFloat(ShaderProgram::MATERIAL_SHININESS, mShininess);
+
+	if (mDiffuse.mTexture)
+	{
+		// materials on the same atlas page or array keep the binding.
+		const bool layered = mDiffuse.mTexture->mLayer >= 0;
+		glState->activeTexture(layered ? GL_TEXTURE1 : GL_TEXTURE0);
+		glState->bindTexture(layered ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, mDiffuse.mTexture->mName);
+		pProgram->setVector4(ShaderProgram::UV_TRANSFORM, mDiffuse.mTexture->mUVTransform);
+		pProgram->setFloat(ShaderProgram::MATERIAL_TEXTURED, 1.0f);
+	}
+	else
+	{
+		pProgram->setVector4(ShaderProgram::UV_TRANSFORM, IDENTITY_UV_TRANSFORM);
+		pProgram->setFloat(ShaderProgram::MATERIAL_TEXTURED, 0.0f);
+	}
+	setTextureLayer(pProgram);
+}
+
+void MaterialCache::setTextureLayer(const ShaderProgram *pProgram) const
+{
+	pProgram->setFloat(ShaderProgram::TEXTURE_LAYER, static_cast<GLfloat>(getTextureLayer()));
+}
+
+GLuint MaterialCache::getTextureName() const
+{
+	return mDiffuse.mTexture ? mDiffuse.mTexture->mName : 0;
+}
+
+GLint MaterialCache::getTextureLayer() const
+{
+	return mDiffuse.mTexture ? mDiffuse.mTexture->mLayer : -1;
+}
+
+bool MaterialCache::isOtherLayerOf(const MaterialCache & pOther) const
+{
+	return mLookId == pOther.mLookId && getTextureLayer() >= 0 && pOther.getTextureLayer() >= 0
+		&& getTextureName() == pOther.getTextureName();
+}
+
+bool MaterialCache::hasSameLook(const MaterialCache & pOther) const
+{
+	return memcmp(mEmissive.mColor, pOther.mEmissive.mColor, sizeof(mEmissive.mColor)) == 0
+		&& memcmp(mAmbient.mColor, pOther.mAmbient.mColor, sizeof(mAmbient.mColor)) == 0
+		&& memcmp(mDiffuse.mColor, pOther.mDiffuse.mColor, sizeof(mDiffuse.mColor)) == 0
+		&& memcmp(mSpecular.mColor, pOther.mSpecular.mColor, sizeof(mSpecular.mColor)) == 0
+		&& mShininess == pOther.mShininess && hasTexture() == pOther.hasTexture();
 }
 
-void MaterialCache::setDefaultMaterial(GameContext *gameContext)
+void MaterialCache::setDefaultMaterial(const ShaderProgram *pProgram)
 {
 	//todo
 	GLfloat defalutColor[4] = { 1.0, 1.0, 1.0, 1.0};
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.emissive"), 1, defalutColor);
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.ambient"), 1, defalutColor);
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.diffuse"), 1, defalutColor);
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "material.specular"), 1, defalutColor);
+	pProgram->setVector4(ShaderProgram::MATERIAL_EMISSIVE, defalutColor);
+	pProgram->setVector4(ShaderProgram::MATERIAL_AMBIENT, defalutColor);
+	pProgram->setVector4(ShaderProgram::MATERIAL_DIFFUSE, defalutColor);
+	pProgram->setVector4(ShaderProgram::MATERIAL_SPECULAR, defalutColor);
+	pProgram->setVector4(ShaderProgram::UV_TRANSFORM, IDENTITY_UV_TRANSFORM);
+	pProgram->setFloat(ShaderProgram::MATERIAL_TEXTURED, 0.0f);
+	pProgram->setFloat(ShaderProgram::TEXTURE_LAYER, -1.0f);
 }
 
 int LightCache::sLightCount = 0;
@@ -580,7 +1185,7 @@ bool LightCache::initialize(const FbxLight* pLight, FbxAnimLayer* pAnimLayer)
 	return true;
 }
 
-void LightCache::setLight(const FbxTime& pTime) const
+void LightCache::setLight(GameContext *gameContext, const FbxTime& pTime) const
 {
 	const GLfloat lightColor[4] = { mColorRed.get(pTime), mColorGreen.get(pTime), mColorBlue.get(pTime), 1.0 };
 	const GLfloat coneAngle = mConeAngle.get(pTime);
@@ -589,9 +1194,9 @@ void LightCache::setLight(const FbxTime& pTime) const
 	// glcolor3fv(lightColor);
 
 	// visible for double side.
-	glDisable(GL_CULL_FACE);
+	gameContext->mGLState->disable(GL_CULL_FACE);
 	// draw wire-frame geometry
-	glCullFace(GL_BACK);
+	gameContext->mGLState->cullFace(GL_BACK);
 
 	if (mType == FbxLight::eSpot)
 	{
@@ -1,7 +1,13 @@
 #pragma once
 #include "preh.h"
+#include "PickMesh.h"
+#include "MeshletCuller.h"
+#include <vector>
 
 class GameContext;
+class ShaderProgram;
+class GLStateCache;
+struct TextureHandle;
 
 class VBOMesh
 {
@@ -11,12 +17,71 @@ public:
 	VBOMesh();
 	~VBOMesh();
 
-	bool initialize(const FbxMesh *pMesh);
-	void updateVertexPosition(const FbxMesh *pMesh, const FbxVector4 *pVertices) const;
-	void beginDraw() const;
-	void draw(GameContext *gameContext, FbxAMatrix globalTransform, int materialIndex) const;
-	void endDraw() const;
+	enum { MAX_LOD_COUNT = 4 };
+
+	// deformed meshes stream their positions through this many regions of
+	// one buffer, one region a frame with a slot for every instance drawn
+	// in it. a write only waits when the gpu is a whole ring of frames behind.
+	enum { DYNAMIC_RING_SIZE = 3 };
+
+	// see VertexPacking.h, deformed meshes always use floats.
+	enum VertexFormat
+	{
+		VERTEX_FORMAT_FLOAT,
+		VERTEX_FORMAT_PACKED,
+	};
+
+	// cpu copy of the full detail vertices, kept for small undeformed meshes
+	// until the static batches are built. 4 floats of position, 3 of normal
+	// and 2 of uv per vertex, normals and uvs are empty if the mesh has none.
+	struct VertexData
+	{
+		std::vector<GLfloat> mPositions;
+		std::vector<GLfloat> mNormals;
+		std::vector<GLfloat> mUVs;
+		std::vector<GLuint> mIndices;
+	};
+
+	// packed meshes fall back to float if packing loses too much position or uv
+	// precision, deformed meshes are always float.
+	bool initialize(const FbxMesh *pMesh, VertexFormat pFormat);
+	// write the deformed positions into the next slot of this frame's ring
+	// region, without waiting on the draws in flight, and point the vertex
+	// array at it.
+	void updateVertexPosition(GameContext *gameContext, const FbxVector4 *pVertices) const;
+	void beginDraw(GameContext *gameContext) const;
+	// the model matrix must be set already.
+	// with pMeshletView the full detail level is drawn meshlet by meshlet, skipping the culled ones.
+	void draw(GameContext *gameContext, int materialIndex, int pLod = 0, const MeshletView *pMeshletView = NULL) const;
+	// every instance draws the whole level pLod, meshlets are not culled per instance.
+	// the instance arrays must be set on the vertex array already.
+	void drawInstanced(int materialIndex, int pLod, GLsizei pInstanceCount) const;
+	void endDraw(GameContext *gameContext) const;
 	int getSubMeshCount() const { return mSubMeshes.GetCount(); }
+	VertexFormat getVertexFormat() const { return mVertexFormat; }
+	// offset (3) and scale (3) that turn the packed positions back into
+	// object space, NULL for float positions. goes into the model matrix.
+	const GLfloat *getPositionDecode() const { return mVertexFormat == VERTEX_FORMAT_PACKED ? mPositionDecode : NULL; }
+	// full detail range of the submesh in the index buffer, in indices.
+	int getSubMeshIndexOffset(int pSubMesh) const { return mSubMeshes[pSubMesh]->IndexOffset; }
+	int getSubMeshTriangleCount(int pSubMesh) const { return mSubMeshes[pSubMesh]->TriangleCount; }
+	// NULL when the mesh kept no copy or it was released.
+	const VertexData *getVertexData() const { return mVertexData.mPositions.empty() ? NULL : &mVertexData; }
+	void releaseVertexData();
+	// small number that identifies the mesh in render queue keys.
+	int getId() const { return mId; }
+	int getLodCount() const { return mLodCount; }
+	// coarsest level whose error projects to less than LOD_PIXEL_ERROR pixels.
+	int selectLod(const GameContext *gameContext, const FbxAMatrix & pGlobalTransform) const;
+	// tell the texture loader how many uvs a pixel covers on the diffuse
+	// texture of every submesh, from the nearest point of the bounds.
+	void requestTextureLevels(FbxNode *pNode, const FbxAMatrix & pGlobalTransform, GameContext *gameContext) const;
+	// local space bounding box of the vertices.
+	const GLfloat *getBoundsMin() const { return mBoundsMin; }
+	const GLfloat *getBoundsMax() const { return mBoundsMax; }
+	// full detail triangles kept on the cpu for picking.
+	const PickMesh & getPickMesh() const { return mPickMesh; }
+	bool hasMeshlets() const { return !mMeshlets.empty(); }
 	int mCount;
 	int mVerticesCount;
 	int mIndicesCount;
@@ -25,11 +90,39 @@ private:
 	// For every material, record the offsets in every VBO and triangle counts
 	struct SubMesh
 	{
-		SubMesh() : IndexOffset(0), TriangleCount(0) {}
+		SubMesh() : IndexOffset(0), TriangleCount(0), FirstMeshlet(0), MeshletCount(0), UVDensity(0.0f)
+		{
+			for (int i = 0; i < MAX_LOD_COUNT; i++)
+			{
+				LodIndexOffset[i] = 0;
+				LodTriangleCount[i] = 0;
+			}
+		}
 
 		int IndexOffset;
 		int TriangleCount;
+		// index range of every level, level 0 is the full detail range above.
+		int LodIndexOffset[MAX_LOD_COUNT];
+		int LodTriangleCount[MAX_LOD_COUNT];
+		// meshlets of the full detail range, none for small submeshes.
+		int FirstMeshlet;
+		int MeshletCount;
+		// uv units per object space unit, sqrt of uv area over surface area.
+		float UVDensity;
 	};
+
+	// false if the eye is inside the bounding sphere, else the largest axis
+	// scale of the transform and the size of one world unit in pixels at
+	// the nearest point of the sphere.
+	bool projectBounds(const GameContext *gameContext, const FbxAMatrix & pGlobalTransform, double & pScale,
+		double & pPixelsPerUnit) const;
+
+	// simplify every submesh into the coarser levels, their indices go to
+	// pLodIndices and are uploaded after the full detail indices.
+	void buildLods(const FbxMesh *pMesh, const GLfloat *pVertices, const GLfloat *pNormals, const GLfloat *pUVs,
+		int pVertexCount, const GLuint *pIndices, std::vector<GLuint> & pLodIndices);
+	// record the attribute arrays and the index buffer into mVertexArray.
+	void recordVertexArray();
 	enum
 	{
 		VERTEX_VBO,
@@ -39,10 +132,36 @@ private:
 		VBO_COUNT,
 	};
 	GLuint mVBONames[VBO_COUNT];
+	// the attribute pointers keep naming the buffers, so re-uploading the
+	// positions of a deformed mesh does not touch it.
+	GLuint mVertexArray;
 	FbxArray<SubMesh *> mSubMeshes;
 	bool mHasNormal;
 	bool mHasUV;
 	bool mAllByControlPoint;
+	int mId;
+	GLfloat mBoundsMin[3];
+	GLfloat mBoundsMax[3];
+	VertexFormat mVertexFormat;
+	GLfloat mPositionDecode[6];
+	int mLodCount;
+	// object space error of every level
+	float mLodError[MAX_LOD_COUNT];
+	PickMesh mPickMesh;
+	std::vector<Meshlet> mMeshlets;
+	VertexData mVertexData;
+	// control point of every vertex, kept for deformed meshes only.
+	std::vector<GLuint> mVertexControlPoints;
+	// the position ring of deformed meshes, 0 for the others. a region is
+	// fenced once the next frame updates, its draws are all issued by then.
+	GLsizeiptr mDynamicSlotSize;		// the positions of one instance
+	mutable int mDynamicSlotCount;		// per region, grows with the instances of a frame
+	mutable int mDynamicRegion;			// of mDynamicFrame, -1 before the first update
+	mutable int mDynamicFrame;
+	mutable int mDynamicSlot;			// slots of mDynamicFrame written
+	mutable GLsync mDynamicFences[DYNAMIC_RING_SIZE];
+
+	static int sMeshCount;
 };
 class MaterialCache
 {
@@ -52,24 +171,47 @@ public:
 
 	bool initialize(const FbxSurfaceMaterial *pMaterial);
 
-	void setCurrentMaterial(GameContext *gameContext) const;
+	// the material uniforms live in the program, set them on pProgram (bound).
+	// the diffuse texture goes to unit 0, or to unit 1 if it is an array layer.
+	void setCurrentMaterial(const ShaderProgram *pProgram, GLStateCache *glState) const;
+	// after a material this one isOtherLayerOf, only the layer needs setting.
+	void setTextureLayer(const ShaderProgram *pProgram) const;
+
+	bool hasTexture() const { return mDiffuse.mTexture != NULL; }
+	const TextureHandle *getDiffuseTexture() const { return mDiffuse.mTexture; }
+	// the texture bound for the material, atlas pages and arrays are shared by many. 0 for none.
+	GLuint getTextureName() const;
+	// the array layer of the diffuse texture, -1 if it is not in an array.
+	GLint getTextureLayer() const;
 
-	bool hasTexture() const { return mDiffuse.mTextureName != 0; }
+	// the same colors and another layer of the same texture array.
+	bool isOtherLayerOf(const MaterialCache & pOther) const;
+	// the same colors, the textures aside.
+	bool hasSameLook(const MaterialCache & pOther) const;
+	// the id of the first material with the same look, for the render queue keys.
+	void setLookId(int pLookId) { mLookId = pLookId; }
 
-	static void setDefaultMaterial(GameContext *gameContext);
+	// small number that identifies the material in render queue keys, 0 is the default material.
+	int getId() const { return mId; }
+	// materials whose textures are layers of arrays sort by their look, so
+	// the layers of one array draw together.
+	int getSortId() const { return getTextureLayer() >= 0 ? mLookId : mId; }
+
+	static void setDefaultMaterial(const ShaderProgram *pProgram);
 
 	void print();
 private:
 	struct ColorChannel
 	{
-		ColorChannel() :mTextureName(0)
+		ColorChannel() :mTexture(NULL)
 		{
 			mColor[0] = 0.0f;
 			mColor[1] = 0.0f;
 			mColor[2] = 0.0f;
 			mColor[3] = 1.0f;
 		}
-		GLuint mTextureName;
+		// the texture loader changes the name behind it.
+		const TextureHandle *mTexture;
 		GLfloat mColor[4];
 	};
 	ColorChannel mEmissive;
@@ -77,6 +219,10 @@ private:
 	ColorChannel mDiffuse;
 	ColorChannel mSpecular;
 	GLfloat mShininess;
+	int mId;
+	int mLookId;
+
+	static int sMaterialCount;
 };
 
 struct PropertyChannel
@@ -114,7 +260,7 @@ public:
 
 	// draw a geometry (sphere for point and directional light,
 	// cone for spot spot light). and set light attributes.
-	void setLight(const FbxTime & pTime) const;
+	void setLight(GameContext *gameContext, const FbxTime & pTime) const;
 private:
 	static int sLightCount;
 
@@ -2,15 +2,96 @@
 #include "SceneContext.h"
 #include "SceneCache.h"
 #include "ShaderProgram.h"
-#include "targa.h"
 #include "GetPosition.h"
+#include "OcclusionCuller.h"
+#include "OcclusionQuery.h"
+#include "ScenePicker.h"
+#include "MeshletCuller.h"
+#include "FrameUniforms.h"
+#include "RenderQueue.h"
+#include "GLStateCache.h"
+#include "StaticBatcher.h"
+#include "TextureLoader.h"
+#include <set>
+
+namespace
+{
+	// uvs this far outside the image still count as inside.
+	const double UV_EPSILON = 1e-3;
+
+	// the textures of meshes with uvs outside the image, they repeat and cannot go to the atlas.
+	void collectRepeatedTextures(FbxNode *pNode, std::set<const FbxFileTexture *> & pTextures)
+	{
+		const FbxMesh *mesh = pNode->GetMesh();
+		bool repeated = false;
+		for (int i = 0; mesh && i < mesh->GetElementUVCount() && !repeated; i++)
+		{
+			const FbxLayerElementArrayTemplate<FbxVector2> & uvs = mesh->GetElementUV(i)->GetDirectArray();
+			for (int j = 0; j < uvs.GetCount() && !repeated; j++)
+			{
+				const FbxVector2 uv = uvs.GetAt(j);
+				repeated = uv[0] < -UV_EPSILON || uv[0] > 1.0 + UV_EPSILON || uv[1] < -UV_EPSILON || uv[1] > 1.0 + UV_EPSILON;
+			}
+		}
+
+		if (repeated)
+		{
+			const char *channels[] = { FbxSurfaceMaterial::sEmissive, FbxSurfaceMaterial::sAmbient,
+				FbxSurfaceMaterial::sDiffuse, FbxSurfaceMaterial::sSpecular };
+			for (int i = 0; i < pNode->GetMaterialCount(); i++)
+			{
+				for (size_t j = 0; j < sizeof(channels) / sizeof(channels[0]); j++)
+				{
+					const FbxProperty property = pNode->GetMaterial(i)->FindProperty(channels[j]);
+					for (int k = 0; property.IsValid() && k < property.GetSrcObjectCount<FbxFileTexture>(); k++)
+					{
+						pTextures.insert(property.GetSrcObject<FbxFileTexture>(k));
+					}
+				}
+			}
+		}
+
+		for (int i = 0; i < pNode->GetChildCount(); i++)
+		{
+			collectRepeatedTextures(pNode->GetChild(i), pTextures);
+		}
+	}
+
+	// textured materials with the same colors share the id of the first, so
+	// their draws can merge once their textures are layers of one array.
+	void groupMaterialLooks(FbxScene *pScene)
+	{
+		std::vector<MaterialCache *> looks;
+		for (int i = 0; i < pScene->GetMaterialCount(); i++)
+		{
+			MaterialCache *material = static_cast<MaterialCache *>(pScene->GetMaterial(i)->GetUserDataPtr());
+			if (!material || !material->hasTexture())
+			{
+				continue;
+			}
+			size_t look = 0;
+			while (look < looks.size() && !looks[look]->hasSameLook(*material))
+			{
+				++look;
+			}
+			if (look < looks.size())
+			{
+				material->setLookId(looks[look]->getId());
+			}
+			else
+			{
+				looks.push_back(material);
+			}
+		}
+	}
+}
 FbxManager *mManager;
 FbxScene *mScene;
 FbxImporter *mImporter;
 SceneContext::SceneContext(const char* pFileName)
 : mFileName(pFileName), mSceneStatus(UNLOADED),
 mManager(NULL), mScene(NULL), mImporter(NULL), mCurrentAnimLayer(NULL),
-mPoseIndex(-1), mPause(false)
+mPoseIndex(-1), mPause(false), mSelectedNode(NULL), mPackVertices(true)
 {
 	if (mFileName == NULL)
 	{
@@ -59,6 +140,24 @@ SceneContext::~SceneContext()
 	
 }
 
+void SceneContext::unloadTextures(GameContext *gameContext)
+{
+	if (!mScene)
+	{
+		return;
+	}
+	const int count = mScene->GetTextureCount();
+	for (int i = 0; i < count; i++)
+	{
+		FbxFileTexture *fileTexture = FbxCast<FbxFileTexture>(mScene->GetTexture(i));
+		if (fileTexture && fileTexture->GetUserDataPtr())
+		{
+			gameContext->mTextureLoader->release(static_cast<const TextureHandle *>(fileTexture->GetUserDataPtr()));
+			fileTexture->SetUserDataPtr(NULL);
+		}
+	}
+}
+
 bool SceneContext::loadFile(GameContext *gameContext)
 {
 	if (mSceneStatus == MUST_BE_LOADED)
@@ -163,8 +262,12 @@ bool SceneContext::loadFile(GameContext *gameContext)
 void SceneContext::loadCacheRecursive(FbxScene* pScene, FbxAnimLayer *pAnimLayer, GameContext *gameContext)
 {
 	loadTestLight(gameContext);
+	gameContext->mOcclusionQuery->initialize();
 	
 	//load the textures into gpu, only for file texture now
+	std::set<const FbxFileTexture *> repeatedTextures;
+	collectRepeatedTextures(pScene->GetRootNode(), repeatedTextures);
+
 	const int count = pScene->GetTextureCount();
 	for (int i = 0; i < count; i++)
 	{
@@ -180,41 +283,29 @@ void SceneContext::loadCacheRecursive(FbxScene* pScene, FbxAnimLayer *pAnimLayer
 				continue;
 			}
 
-			GLuint textureObject = 0;
-			bool status = loadTextureFromFile(fileName, textureObject);
-
 			const FbxString absFbxFileName = FbxPathUtils::Resolve(absFbxFileName);
 			const FbxString absFolderName = FbxPathUtils::GetFolderName(absFbxFileName);
-			if (!status)
-			{
-				// load texture from relative file name (relative to fbx file)
-				const FbxString resolvedFileName = FbxPathUtils::Bind(absFolderName, fileTexture->GetRelativeFileName());
-				status = loadTextureFromFile(resolvedFileName, textureObject);
-			}
-
-			if (!status)
-			{
-				// load texture from file name only (relative to fbx file)
-				const FbxString textureFileName = FbxPathUtils::GetFileName(fileName);
-				const FbxString resolvedFileName = FbxPathUtils::Bind(absFolderName, textureFileName);
-				status = loadTextureFromFile(resolvedFileName, textureObject);
-			}
 
-			if (!status)
-			{
-				cout << "failed to load texture file: " << fileName.Buffer() << endl;
-				continue;
-			}
+			// the file name, then relative to the fbx file, then the file name only next to the fbx file.
+			std::vector<std::string> candidates;
+			candidates.push_back(fileName.Buffer());
+			candidates.push_back(FbxPathUtils::Bind(absFolderName, fileTexture->GetRelativeFileName()).Buffer());
+			candidates.push_back(FbxPathUtils::Bind(absFolderName, FbxPathUtils::GetFileName(fileName)).Buffer());
 
-			if (status)
-			{
-				GLuint *textureName = new GLuint(textureObject);
-				fileTexture->SetUserDataPtr(textureName);
-			}
+			// the materials keep the handle, it names the placeholder until the data arrives.
+			const bool atlasAllowed = repeatedTextures.find(fileTexture) == repeatedTextures.end();
+			fileTexture->SetUserDataPtr(const_cast<TextureHandle *>(gameContext->mTextureLoader->request(candidates, atlasAllowed)));
 		}
 
 	}
 	loadCacheRecursive(pScene->GetRootNode(), pAnimLayer);
+	groupMaterialLooks(pScene);
+
+	gameContext->mOcclusionCuller->bakeOccluders(pScene->GetRootNode());
+	gameContext->mStaticBatcher->build(pScene->GetRootNode());
+
+	// the uploads above bind buffers and textures behind the back of the state cache.
+	gameContext->mGLState->invalidate();
 }
 
 
@@ -246,7 +337,7 @@ void SceneContext::loadCacheRecursive(FbxNode* pNode, FbxAnimLayer *pAnimLayer)
 			if (lMesh && !lMesh->GetUserDataPtr())
 			{
 				FbxAutoPtr<VBOMesh> lMeshCache(new VBOMesh);
-				if (lMeshCache->initialize(lMesh))
+				if (lMeshCache->initialize(lMesh, mPackVertices ? VBOMesh::VERTEX_FORMAT_PACKED : VBOMesh::VERTEX_FORMAT_FLOAT))
 				{
 					lMesh->SetUserDataPtr(lMeshCache.Release());
 				}
@@ -273,45 +364,6 @@ void SceneContext::loadCacheRecursive(FbxNode* pNode, FbxAnimLayer *pAnimLayer)
 	}
 }
 
-bool SceneContext::loadTextureFromFile(const FbxString& pFilePath, unsigned& pTextureObject)
-{
-	if (pFilePath.Right(3).Upper() == "TGA")
-	{
-		tga_image tgaImage;
-
-		if (tga_read(&tgaImage, pFilePath.Buffer()) == TGA_NOERR)
-		{
-			if (tga_is_right_to_left(&tgaImage))
-			{
-				tga_flip_horiz(&tgaImage);
-			}
-
-			if (tga_is_top_to_bottom(&tgaImage))
-			{
-				tga_flip_vert(&tgaImage);
-			}
-
-			tga_convert_depth(&tgaImage, 24);
-
-			glGenTextures(1, &pTextureObject);
-			glBindTexture(GL_TEXTURE_2D, pTextureObject);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-			// todo ? gltexEnvi
-
-			glTexImage2D(GL_TEXTURE_2D, 0, 3, tgaImage.width, tgaImage.height, 0, GL_RGB,
-				GL_UNSIGNED_BYTE, tgaImage.image_data);
-			glBindTexture(GL_TEXTURE_2D, 0);
-
-			tga_free_buffers(&tgaImage);
-			return true;
-		}
-	}
-	return false;
-}
 // compute the transform matrix that the cluster will transform the vertex.
 void computeClusterDeformation(
 	FbxAMatrix & pGlobalPosition,
@@ -733,6 +785,45 @@ void drawMesh(FbxNode *pNode, GameContext *gameContext, FbxTime &pTime, FbxAnimL
 	const bool hasShape = false;
 	const bool hasSkin = lMesh->GetDeformerCount(FbxDeformer::eSkin) > 0;
 	const bool hasDeformation = hasVertexCache || hasShape || hasSkin;
+
+	// the same transform is used to draw the mesh below.
+	const FbxAMatrix globalTransform = pNode->EvaluateGlobalTransform();
+
+	// picking works on everything in the view, culled or not.
+	if (lMeshCache)
+	{
+		gameContext->mScenePicker->addItem(pNode, lMeshCache, globalTransform);
+	}
+
+	// deformed meshes leave their bind pose bounds, they are never culled.
+	OcclusionCuller *occlusionCuller = gameContext->mOcclusionCuller;
+	if (lMeshCache && !hasDeformation && occlusionCuller->isEnabled()
+		&& !occlusionCuller->isVisible(globalTransform, lMeshCache->getBoundsMin(), lMeshCache->getBoundsMax()))
+	{
+		return;
+	}
+
+	// the gpu queries answer one frame late, the proxy of the mesh is drawn after the scene.
+	OcclusionQuery *occlusionQuery = gameContext->mOcclusionQuery;
+	if (lMeshCache && !hasDeformation && occlusionQuery->isEnabled()
+		&& !occlusionQuery->testVisibility(pNode, globalTransform, lMeshCache->getBoundsMin(),
+			lMeshCache->getBoundsMax(), gameContext->eyePos))
+	{
+		return;
+	}
+
+	// the texture streaming looks at everything drawn, batched or not.
+	if (lMeshCache)
+	{
+		lMeshCache->requestTextureLevels(pNode, globalTransform, gameContext);
+	}
+
+	// merged into a static batch, the batch draws it after the traversal.
+	if (lMeshCache && !hasDeformation && gameContext->mStaticBatcher->markVisible(pNode))
+	{
+		return;
+	}
+
 	FbxVector4 *vertexArray = NULL;
 	if (!lMeshCache || hasDeformation)
 	{
@@ -770,37 +861,33 @@ void drawMesh(FbxNode *pNode, GameContext *gameContext, FbxTime &pTime, FbxAnimL
 
 		if (lMeshCache)
 		{
-			lMeshCache->updateVertexPosition(lMesh, vertexArray);
+			lMeshCache->updateVertexPosition(gameContext, vertexArray);
 		}
 	}
 	
 	if (lMeshCache)
 	{
-		// begin draw
-		lMeshCache->beginDraw();
-		const int subMeshCount = lMeshCache->getSubMeshCount();
-		for (int i = 0; i < subMeshCount; i++)
+		const int lod = lMeshCache->selectLod(gameContext, globalTransform);
+
+		// meshlet bounds are bind pose bounds, deformed meshes are drawn whole.
+		MeshletView meshletView;
+		const MeshletView *drawMeshletView = NULL;
+		if (lod == 0 && !hasDeformation && lMeshCache->hasMeshlets() && gameContext->mMeshletCuller->isEnabled())
 		{
-			const FbxSurfaceMaterial *material = pNode->GetMaterial(i);
-			if (material)
-			{
-				const MaterialCache *materialCache = static_cast<const MaterialCache *>(material->GetUserDataPtr());
+			gameContext->mMeshletCuller->setupView(gameContext, globalTransform, meshletView);
+			drawMeshletView = &meshletView;
+		}
 
-				if (materialCache)
-				{
-					materialCache->setCurrentMaterial(gameContext);
-				}
-				else
-				{
-					materialCache->setDefaultMaterial(gameContext);
-				}
-			}
-			
-			// draw
-			lMeshCache->draw(gameContext, pNode->EvaluateGlobalTransform(), i);
+		// the vertex buffer of a deformed mesh holds this node's vertices only until
+		// the next instance of the mesh is deformed, so it cannot wait in the queue.
+		if (hasDeformation)
+		{
+			gameContext->mRenderQueue->drawNow(pNode, lMeshCache, globalTransform, lod, gameContext);
+		}
+		else
+		{
+			gameContext->mRenderQueue->submit(pNode, lMeshCache, globalTransform, lod, drawMeshletView, gameContext);
 		}
-		//end draw
-		lMeshCache->endDraw();
 	}
 	else
 	{
@@ -860,29 +947,22 @@ bool SceneContext::onDisplay(GameContext* gameContext)
 	glViewport(0, 0, gameContext->mWidth, gameContext->mHeight);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
+	GLStateCache *glState = gameContext->mGLState;
+	glState->beginFrame();
+	// a few finished textures replace their placeholders each frame.
+	gameContext->mTextureLoader->update();
+	glState->enable(GL_DEPTH_TEST);
+	glState->enable(GL_CULL_FACE);
+	glState->cullFace(GL_BACK);
 	
-	glUseProgram(gameContext->mLightShaderProgram->programObject);
-	gameContext->mLightShaderProgram->modelLoc = glGetUniformLocation(gameContext->mLightShaderProgram->programObject, "modelMatrix");
-	gameContext->mLightShaderProgram->viewLoc = glGetUniformLocation(gameContext->mLightShaderProgram->programObject, "viewMatrix");
-	gameContext->mLightShaderProgram->proLoc = glGetUniformLocation(gameContext->mLightShaderProgram->programObject, "proMatrix");
+	// view, projection, eye and light go to the frame block once for all programs.
+	gameContext->mFrameUniforms->update(gameContext);
+
+	glState->useProgram(gameContext->mLightShaderProgram->programObject);
 	
 	displayTestLight(gameContext);
 	
-	glUseProgram(gameContext->mShaderProgram->programObject);
-
-	gameContext->mShaderProgram->modelLoc = glGetUniformLocation(gameContext->mShaderProgram->programObject, "modelMatrix");
-	gameContext->mShaderProgram->viewLoc = glGetUniformLocation(gameContext->mShaderProgram->programObject, "viewMatrix");
-	gameContext->mShaderProgram->proLoc = glGetUniformLocation(gameContext->mShaderProgram->programObject, "proMatrix");
-
-	GLfloat eyePosition[] = {gameContext->eyePos[0], gameContext->eyePos[1], gameContext->eyePos[2]};
-	glUniform3fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "view_position"), 1, eyePosition);
-
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "light_color"), 1, gameContext->lightColor);
-	
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "light_position"), 1, gameContext->lightPosition);
+	glState->useProgram(gameContext->mShaderProgram->programObject);
 
 
 	FbxPose *pose = NULL;
@@ -891,20 +971,46 @@ bool SceneContext::onDisplay(GameContext* gameContext)
 		pose = mScene->GetPose(mPoseIndex);
 	}
 
+	gameContext->mOcclusionQuery->beginFrame();
+	gameContext->mScenePicker->beginFrame();
+	gameContext->mMeshletCuller->beginFrame();
+	gameContext->mRenderQueue->beginFrame();
+	gameContext->mStaticBatcher->beginFrame();
+
+	// rasterize the occluders before any mesh is tested against them.
+	if (gameContext->mOcclusionCuller->isEnabled())
+	{
+		gameContext->mOcclusionCuller->renderOccluders(gameContext->proMatrix * gameContext->viewMatrix,
+			gameContext->mWorkerPool);
+	}
+
 	// if one node is selected, draw it and its children.
 	FbxAMatrix dummyGlobalPosition;
 
-	// todo mSelectedNode
-	if (false)
+	if (mSelectedNode)
 	{
-		// set the lighting before other things.
-		
+		FbxAMatrix parentGlobalPosition;
+		if (mSelectedNode->GetParent())
+		{
+			parentGlobalPosition = getGlobalPosition(mSelectedNode->GetParent(), mCurrentTime, pose);
+		}
+		drawNodeRecursive(mSelectedNode, gameContext, mCurrentTime, mCurrentAnimLayer, parentGlobalPosition, pose);
+		displayGrid(gameContext, dummyGlobalPosition);
 	}
 	else // otherwise, draw the whole scene.
 	{
 		drawNodeRecursive(rootNode, gameContext, mCurrentTime, mCurrentAnimLayer, dummyGlobalPosition, pose);
 		displayGrid(gameContext, dummyGlobalPosition);
 	}
+
+	// the traversal only queued the static meshes.
+	gameContext->mRenderQueue->execute(gameContext);
+	gameContext->mStaticBatcher->draw(gameContext);
+
+	if (gameContext->mOcclusionQuery->isEnabled())
+	{
+		gameContext->mOcclusionQuery->issueQueries(gameContext);
+	}
 	
 	return true;
 }
@@ -961,33 +1067,21 @@ void SceneContext::displayGrid(GameContext *gameContext, const FbxAMatrix & pTra
 //	}
 //	return ret;
 //}
-GLfloat *getMatrix(FbxMatrix mat);
 void SceneContext::displayTestLight(GameContext *gameContext)
 {
-	glBindBuffer(GL_ARRAY_BUFFER, testLightVBO);
-	glEnableVertexAttribArray(0);
+	GLStateCache *glState = gameContext->mGLState;
+	glState->bindVertexArray(0);
+	glState->bindBuffer(GL_ARRAY_BUFFER, testLightVBO);
+	glState->enableVertexAttribArray(0);
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	glState->disableVertexAttribArray(1);
+	glState->disableVertexAttribArray(2);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, testLightIndiceVBO);
-
-	FbxMatrix globalTransform;
-	globalTransform.SetIdentity();
-	GLfloat* model = getMatrix(globalTransform);
-	glUniformMatrix4fv((gameContext->mLightShaderProgram)->modelLoc, 1, GL_FALSE, model);
+	glState->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, testLightIndiceVBO);
 
-	GLfloat *view = getMatrix(gameContext->viewMatrix);
-	glUniformMatrix4fv((gameContext->mLightShaderProgram)->viewLoc, 1, GL_FALSE, view);
-
-	GLfloat *projection = getMatrix(gameContext->proMatrix);
-	glUniformMatrix4fv((gameContext->mLightShaderProgram)->proLoc, 1, GL_FALSE, projection);
-
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "light_color"), 1, gameContext->lightColor);
-	glUniform4fv(glGetUniformLocation(gameContext->mShaderProgram->programObject, "light_position"), 1, gameContext->lightPosition);
-
-	
-	delete[] model;
-	delete[] view;
-	delete[] projection;
+	// the cube is built in world space.
+	const FbxAMatrix identity;
+	gameContext->mFrameUniforms->setModelMatrix(gameContext->mLightShaderProgram, identity);
 	
 	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
 	
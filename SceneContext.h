@@ -32,12 +32,21 @@ public:
 	
 	bool loadFile(GameContext *gameContext);
 	bool onDisplay(GameContext *gameContext);
+	// give the texture handles back, shared textures go with their last user.
+	void unloadTextures(GameContext *gameContext);
+
+	// only the selected node and its children are drawn, NULL draws the whole scene.
+	void setSelectedNode(FbxNode *pNode) { mSelectedNode = pNode; }
+	FbxNode *getSelectedNode() const { return mSelectedNode; }
+
+	// set before loadFile. false keeps the meshes in floats, for scenes whose
+	// tiled uvs or sizes are beyond the packed format.
+	void setPackVertices(bool pPackVertices) { mPackVertices = pPackVertices; }
 
 private:
 	void displayGrid(GameContext *gameContext, const FbxAMatrix & pTransform);
 	void displayTestLight(GameContext *gameContext);
 	void loadTestLight(GameContext *gameContext);
-	bool loadTextureFromFile(const FbxString & pFilePath, unsigned int & pTextureObject);
 	void loadCacheRecursive(FbxScene *pScene, FbxAnimLayer *pAnimLayer, GameContext *gameContext);
 	void loadCacheRecursive(FbxNode *pNode, FbxAnimLayer *pAnimLayer);
 
@@ -60,4 +69,6 @@ private:
 	FbxArray<FbxPose *> mPoseArray;
 
 	bool mPause;
+	FbxNode *mSelectedNode;
+	bool mPackVertices;
 };
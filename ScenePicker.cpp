@@ -0,0 +1,158 @@
+#include "ScenePicker.h"
+#include "SceneCache.h"
+#include "GameContext.h"
+#include "PickMesh.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+
+namespace
+{
+	// column major, like the matrices handed to gl.
+	void transformPoint(const double *pMatrix, double x, double y, double z, double w, double *pResult)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			pResult[i] = pMatrix[i] * x + pMatrix[4 + i] * y + pMatrix[8 + i] * z + pMatrix[12 + i] * w;
+		}
+	}
+
+	struct Candidate
+	{
+		float mEnter;
+		int mItem;
+
+		bool operator<(const Candidate & pOther) const { return mEnter < pOther.mEnter; }
+	};
+}
+
+ScenePicker::ScenePicker() : mLastPickTime(0)
+{
+}
+
+void ScenePicker::beginFrame()
+{
+	mItems.clear();
+}
+
+void ScenePicker::addItem(FbxNode *pNode, const VBOMesh *pMesh, const FbxAMatrix & pGlobalTransform)
+{
+	if (pMesh->getPickMesh().isEmpty())
+	{
+		return;
+	}
+
+	Item item;
+	item.mNode = pNode;
+	item.mMesh = pMesh;
+	item.mTransform = pGlobalTransform;
+
+	// world box of the transformed local box: center moves, extent goes through |m|.
+	const double *m = (const double *)pGlobalTransform;
+	const GLfloat *boundsMin = pMesh->getBoundsMin();
+	const GLfloat *boundsMax = pMesh->getBoundsMax();
+	double center[4];
+	transformPoint(m, (boundsMin[0] + boundsMax[0]) * 0.5, (boundsMin[1] + boundsMax[1]) * 0.5,
+		(boundsMin[2] + boundsMax[2]) * 0.5, 1.0, center);
+	const double extent[3] = { (boundsMax[0] - boundsMin[0]) * 0.5, (boundsMax[1] - boundsMin[1]) * 0.5,
+		(boundsMax[2] - boundsMin[2]) * 0.5 };
+	for (int i = 0; i < 3; i++)
+	{
+		const double radius = fabs(m[i]) * extent[0] + fabs(m[4 + i]) * extent[1] + fabs(m[8 + i]) * extent[2];
+		item.mMin[i] = static_cast<float>(center[i] - radius);
+		item.mMax[i] = static_cast<float>(center[i] + radius);
+	}
+	mItems.push_back(item);
+}
+
+void ScenePicker::getRay(const GameContext *gameContext, float pX, float pY,
+	FbxVector4 & pOrigin, FbxVector4 & pDirection)
+{
+	const double x = 2.0 * (pX + 0.5) / gameContext->mWidth - 1.0;
+	const double y = 1.0 - 2.0 * (pY + 0.5) / gameContext->mHeight;
+
+	const FbxMatrix inverseViewProj = (gameContext->proMatrix * gameContext->viewMatrix).Inverse();
+	const double *m = (const double *)inverseViewProj;
+	double nearPoint[4], farPoint[4];
+	transformPoint(m, x, y, -1.0, 1.0, nearPoint);
+	transformPoint(m, x, y, 1.0, 1.0, farPoint);
+
+	pOrigin.Set(nearPoint[0] / nearPoint[3], nearPoint[1] / nearPoint[3], nearPoint[2] / nearPoint[3], 1.0);
+	pDirection.Set(farPoint[0] / farPoint[3] - pOrigin[0], farPoint[1] / farPoint[3] - pOrigin[1],
+		farPoint[2] / farPoint[3] - pOrigin[2], 0.0);
+	pDirection.Normalize();
+}
+
+bool ScenePicker::pick(const GameContext *gameContext, float pX, float pY, PickResult & pResult) const
+{
+	const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	FbxVector4 origin, direction;
+	getRay(gameContext, pX, pY, origin, direction);
+	const float worldOrigin[3] = { static_cast<float>(origin[0]), static_cast<float>(origin[1]), static_cast<float>(origin[2]) };
+	const float worldDirection[3] = { static_cast<float>(direction[0]), static_cast<float>(direction[1]), static_cast<float>(direction[2]) };
+
+	std::vector<Candidate> candidates;
+	for (size_t i = 0; i < mItems.size(); i++)
+	{
+		Candidate candidate;
+		if (PickMesh::intersectBox(worldOrigin, worldDirection, mItems[i].mMin, mItems[i].mMax, FLT_MAX, candidate.mEnter))
+		{
+			candidate.mItem = static_cast<int>(i);
+			candidates.push_back(candidate);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	// the ray goes to object space, an affine transform keeps the distance along it.
+	float best = FLT_MAX;
+	int bestItem = -1, bestSubMesh = -1;
+	for (size_t i = 0; i < candidates.size() && candidates[i].mEnter < best; i++)
+	{
+		const Item & item = mItems[candidates[i].mItem];
+		const FbxAMatrix inverse = item.mTransform.Inverse();
+		const double *m = (const double *)inverse;
+		double localOrigin[4], localDirection[4];
+		transformPoint(m, origin[0], origin[1], origin[2], 1.0, localOrigin);
+		transformPoint(m, direction[0], direction[1], direction[2], 0.0, localDirection);
+		const float rayOrigin[3] = { static_cast<float>(localOrigin[0]), static_cast<float>(localOrigin[1]), static_cast<float>(localOrigin[2]) };
+		const float rayDirection[3] = { static_cast<float>(localDirection[0]), static_cast<float>(localDirection[1]), static_cast<float>(localDirection[2]) };
+
+		float distance;
+		int subMesh;
+		if (item.mMesh->getPickMesh().intersect(rayOrigin, rayDirection, best, distance, subMesh))
+		{
+			best = distance;
+			bestItem = candidates[i].mItem;
+			bestSubMesh = subMesh;
+		}
+	}
+
+	mLastPickTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	if (bestItem < 0)
+	{
+		return false;
+	}
+	pResult.mNode = mItems[bestItem].mNode;
+	pResult.mSubMesh = bestSubMesh;
+	pResult.mDistance = best;
+	pResult.mPosition = origin + direction * best;
+	pResult.mPosition[3] = 1.0;
+	return true;
+}
+
+void ScenePicker::printPick(const GameContext *gameContext, float pX, float pY) const
+{
+	PickResult result;
+	if (pick(gameContext, pX, pY, result))
+	{
+		cout << "pick: " << result.mNode->GetName() << " submesh " << result.mSubMesh << " at "
+			<< result.mPosition[0] << " " << result.mPosition[1] << " " << result.mPosition[2]
+			<< " (" << mLastPickTime << " ms)" << endl;
+	}
+	else
+	{
+		cout << "pick: nothing (" << mLastPickTime << " ms)" << endl;
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+
+class GameContext;
+class VBOMesh;
+
+struct PickResult
+{
+	PickResult() : mNode(NULL), mSubMesh(-1), mDistance(0) {}
+
+	FbxNode *mNode;
+	int mSubMesh;			// material index of the hit triangle
+	FbxVector4 mPosition;	// world space
+	double mDistance;		// from the near plane along the ray
+};
+
+// ray picking against the meshes drawn in the last frame.
+// drawMesh records every mesh with its world transform and world bounds, a
+// pick tests the bounds first, then the PickMesh triangles of the hit meshes
+// from the nearest box on, stopping as soon as no box can be closer.
+// deformed meshes are tested with their bind pose triangles.
+class ScenePicker
+{
+public:
+	ScenePicker();
+
+	void beginFrame();
+	void addItem(FbxNode *pNode, const VBOMesh *pMesh, const FbxAMatrix & pGlobalTransform);
+
+	// world space ray through the pixel (pX, pY) of the client area, y down.
+	static void getRay(const GameContext *gameContext, float pX, float pY,
+		FbxVector4 & pOrigin, FbxVector4 & pDirection);
+
+	bool pick(const GameContext *gameContext, float pX, float pY, PickResult & pResult) const;
+
+	// pick at (pX, pY) and print the node hit and the time the pick took.
+	void printPick(const GameContext *gameContext, float pX, float pY) const;
+
+	// milliseconds spent in the last pick.
+	double getLastPickTime() const { return mLastPickTime; }
+
+private:
+	struct Item
+	{
+		FbxNode *mNode;
+		const VBOMesh *mMesh;
+		FbxAMatrix mTransform;
+		float mMin[3];
+		float mMax[3];
+	};
+
+	std::vector<Item> mItems;
+	mutable double mLastPickTime;
+};
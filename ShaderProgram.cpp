@@ -0,0 +1,126 @@
+#include "ShaderProgram.h"
+#include <algorithm>
+
+namespace
+{
+	struct UniformSlot
+	{
+		const char *mName;
+		GLenum mType;
+	};
+
+	// same order as ShaderProgram::Uniform.
+	const UniformSlot UNIFORM_SLOTS[ShaderProgram::UNIFORM_COUNT] = {
+		{ "modelMatrix", GL_FLOAT_MAT4 },
+		{ "normalMatrix", GL_FLOAT_MAT3 },
+		{ "material.emissive", GL_FLOAT_VEC4 },
+		{ "material.ambient", GL_FLOAT_VEC4 },
+		{ "material.diffuse", GL_FLOAT_VEC4 },
+		{ "material.specular", GL_FLOAT_VEC4 },
+		{ "material.shininess", GL_FLOAT },
+		{ "material.textured", GL_FLOAT },
+		{ "our_texture", GL_SAMPLER_2D },
+		{ "our_texture_array", GL_SAMPLER_2D_ARRAY },
+		{ "uvTransform", GL_FLOAT_VEC4 },
+		{ "textureLayer", GL_FLOAT },
+	};
+}
+
+ShaderProgram::ShaderProgram() : programObject(0)
+{
+	for (int i = 0; i < UNIFORM_COUNT; i++)
+	{
+		mLocations[i] = -1;
+	}
+}
+
+bool ShaderProgram::reflect(GLuint pProgram)
+{
+	programObject = pProgram;
+	mUniforms.clear();
+	mBlocks.clear();
+
+	GLint maxLength = 0;
+	glGetProgramiv(pProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	GLint blockNameLength = 0;
+	glGetProgramiv(pProgram, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &blockNameLength);
+	std::vector<GLchar> name(std::max(maxLength, blockNameLength) + 1);
+
+	GLint uniformCount = 0;
+	glGetProgramiv(pProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+	for (GLint i = 0; i < uniformCount; i++)
+	{
+		UniformInfo uniform;
+		GLsizei length = 0;
+		glGetActiveUniform(pProgram, i, static_cast<GLsizei>(name.size()), &length, &uniform.mSize, &uniform.mType, &name[0]);
+		uniform.mName.assign(&name[0], length);
+		const size_t bracket = uniform.mName.find("[0]");
+		if (bracket != std::string::npos)
+		{
+			uniform.mName.erase(bracket);
+		}
+
+		const GLuint index = static_cast<GLuint>(i);
+		glGetActiveUniformsiv(pProgram, 1, &index, GL_UNIFORM_BLOCK_INDEX, &uniform.mBlockIndex);
+		uniform.mLocation = uniform.mBlockIndex == -1 ? glGetUniformLocation(pProgram, &name[0]) : -1;
+		mUniforms.push_back(uniform);
+	}
+
+	GLint blockCount = 0;
+	glGetProgramiv(pProgram, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+	for (GLint i = 0; i < blockCount; i++)
+	{
+		BlockInfo block;
+		GLsizei length = 0;
+		glGetActiveUniformBlockName(pProgram, i, static_cast<GLsizei>(name.size()), &length, &name[0]);
+		block.mName.assign(&name[0], length);
+		block.mIndex = static_cast<GLuint>(i);
+		glGetActiveUniformBlockiv(pProgram, block.mIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &block.mDataSize);
+		mBlocks.push_back(block);
+	}
+
+	// a slot only resolves to a uniform of the expected type.
+	bool result = true;
+	for (int i = 0; i < UNIFORM_COUNT; i++)
+	{
+		mLocations[i] = -1;
+		const UniformInfo *uniform = findUniform(UNIFORM_SLOTS[i].mName);
+		if (!uniform)
+		{
+			continue;
+		}
+		if (uniform->mType != UNIFORM_SLOTS[i].mType)
+		{
+			cout << "error: uniform " << uniform->mName << " of program " << pProgram << " has type 0x"
+				<< hex << uniform->mType << dec << endl;
+			result = false;
+			continue;
+		}
+		mLocations[i] = uniform->mLocation;
+	}
+	return result;
+}
+
+const ShaderProgram::UniformInfo *ShaderProgram::findUniform(const char *pName) const
+{
+	for (size_t i = 0; i < mUniforms.size(); i++)
+	{
+		if (mUniforms[i].mName == pName)
+		{
+			return &mUniforms[i];
+		}
+	}
+	return NULL;
+}
+
+const ShaderProgram::BlockInfo *ShaderProgram::findBlock(const char *pName) const
+{
+	for (size_t i = 0; i < mBlocks.size(); i++)
+	{
+		if (mBlocks[i].mName == pName)
+		{
+			return &mBlocks[i];
+		}
+	}
+	return NULL;
+}
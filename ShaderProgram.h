@@ -1,11 +1,70 @@
 #pragma once
 #include "preh.h"
+#include <string>
+#include <vector>
 
+// a linked program with its active uniforms and uniform blocks enumerated
+// once after link. the uniforms the renderer sets are resolved into typed
+// slots, so the draw path never looks up a name.
 class ShaderProgram
 {
 public:
+	enum Uniform
+	{
+		MODEL_MATRIX,
+		NORMAL_MATRIX,
+		MATERIAL_EMISSIVE,
+		MATERIAL_AMBIENT,
+		MATERIAL_DIFFUSE,
+		MATERIAL_SPECULAR,
+		MATERIAL_SHININESS,
+		MATERIAL_TEXTURED,
+		DIFFUSE_TEXTURE,
+		DIFFUSE_TEXTURE_ARRAY,
+		UV_TRANSFORM,
+		TEXTURE_LAYER,
+		UNIFORM_COUNT
+	};
+
+	struct UniformInfo
+	{
+		std::string mName;		// without the [0] of arrays
+		GLenum mType;
+		GLint mSize;
+		GLint mLocation;		// -1 for members of uniform blocks
+		GLint mBlockIndex;		// -1 for default block uniforms
+	};
+
+	struct BlockInfo
+	{
+		std::string mName;
+		GLuint mIndex;
+		GLint mDataSize;
+	};
+
+	ShaderProgram();
+
+	// enumerate the uniforms and blocks of the linked pProgram and resolve the slots.
+	bool reflect(GLuint pProgram);
+
+	// -1 when the program does not use the uniform.
+	GLint getLocation(Uniform pUniform) const { return mLocations[pUniform]; }
+	bool hasUniform(Uniform pUniform) const { return mLocations[pUniform] != -1; }
+
+	// load time lookups.
+	const UniformInfo *findUniform(const char *pName) const;
+	const BlockInfo *findBlock(const char *pName) const;
+
+	void setMatrix4(Uniform pUniform, const GLfloat *pValue) const { glUniformMatrix4fv(mLocations[pUniform], 1, GL_FALSE, pValue); }
+	void setMatrix3(Uniform pUniform, const GLfloat *pValue) const { glUniformMatrix3fv(mLocations[pUniform], 1, GL_FALSE, pValue); }
+	void setVector4(Uniform pUniform, const GLfloat *pValue) const { glUniform4fv(mLocations[pUniform], 1, pValue); }
+	void setFloat(Uniform pUniform, GLfloat pValue) const { glUniform1f(mLocations[pUniform], pValue); }
+	void setInt(Uniform pUniform, GLint pValue) const { glUniform1i(mLocations[pUniform], pValue); }
+
 	GLint programObject;
-	GLint modelLoc;
-	GLint viewLoc;
-	GLint proLoc;
+
+private:
+	std::vector<UniformInfo> mUniforms;
+	std::vector<BlockInfo> mBlocks;
+	GLint mLocations[UNIFORM_COUNT];
 };
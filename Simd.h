@@ -0,0 +1,121 @@
+#pragma once
+
+// 4-wide float helpers for the cpu side loops (software depth buffer,
+// picking, texture filters). sse2 on x86/x64, plain c++ everywhere else.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+struct Float4
+{
+#ifdef SIMD_SSE2
+	__m128 v;
+	Float4() {}
+	Float4(__m128 pValue) : v(pValue) {}
+	explicit Float4(float pValue) : v(_mm_set1_ps(pValue)) {}
+	Float4(float pX, float pY, float pZ, float pW) : v(_mm_setr_ps(pX, pY, pZ, pW)) {}
+
+	static Float4 load(const float *pSrc) { return _mm_loadu_ps(pSrc); }
+	// x, y, z from doubles (fbx vectors), w given.
+	static Float4 loadDouble3(const double *pSrc, float pW)
+	{
+		const __m128 xy = _mm_cvtpd_ps(_mm_loadu_pd(pSrc));
+		const __m128 zw = _mm_cvtpd_ps(_mm_set_pd(pW, pSrc[2]));
+		return _mm_movelh_ps(xy, zw);
+	}
+	void store(float *pDst) const { _mm_storeu_ps(pDst, v); }
+#else
+	float v[4];
+	Float4() {}
+	explicit Float4(float pValue) { v[0] = v[1] = v[2] = v[3] = pValue; }
+	Float4(float pX, float pY, float pZ, float pW) { v[0] = pX; v[1] = pY; v[2] = pZ; v[3] = pW; }
+
+	static Float4 load(const float *pSrc) { return Float4(pSrc[0], pSrc[1], pSrc[2], pSrc[3]); }
+	static Float4 loadDouble3(const double *pSrc, float pW)
+	{
+		return Float4(static_cast<float>(pSrc[0]), static_cast<float>(pSrc[1]), static_cast<float>(pSrc[2]), pW);
+	}
+	void store(float *pDst) const { pDst[0] = v[0]; pDst[1] = v[1]; pDst[2] = v[2]; pDst[3] = v[3]; }
+#endif
+};
+
+#ifdef SIMD_SSE2
+inline Float4 operator+(const Float4 & a, const Float4 & b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(const Float4 & a, const Float4 & b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(const Float4 & a, const Float4 & b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(const Float4 & a, const Float4 & b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 minOf(const Float4 & a, const Float4 & b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 maxOf(const Float4 & a, const Float4 & b) { return _mm_max_ps(a.v, b.v); }
+
+// comparisons return an all-ones / all-zeros lane mask.
+inline Float4 cmpGreater(const Float4 & a, const Float4 & b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 cmpGreaterEqual(const Float4 & a, const Float4 & b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Float4 cmpLess(const Float4 & a, const Float4 & b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 maskAnd(const Float4 & a, const Float4 & b) { return _mm_and_ps(a.v, b.v); }
+inline Float4 maskOr(const Float4 & a, const Float4 & b) { return _mm_or_ps(a.v, b.v); }
+
+// per lane pMask ? a : b
+inline Float4 select(const Float4 & pMask, const Float4 & a, const Float4 & b)
+{
+	return _mm_or_ps(_mm_and_ps(pMask.v, a.v), _mm_andnot_ps(pMask.v, b.v));
+}
+
+// one bit per lane, lane 0 in bit 0.
+inline int moveMask(const Float4 & pMask) { return _mm_movemask_ps(pMask.v); }
+#else
+#define SIMD_LANE_OP(name, expr) \
+	inline Float4 name(const Float4 & a, const Float4 & b) \
+	{ \
+		Float4 r; \
+		for (int i = 0; i < 4; i++) { r.v[i] = (expr); } \
+		return r; \
+	}
+
+inline float simdLaneMask(bool pValue)
+{
+	union { unsigned int u; float f; } bits;
+	bits.u = pValue ? 0xFFFFFFFFu : 0u;
+	return bits.f;
+}
+
+inline bool simdLaneSet(float pValue)
+{
+	union { unsigned int u; float f; } bits;
+	bits.f = pValue;
+	return bits.u != 0;
+}
+
+SIMD_LANE_OP(operator+, a.v[i] + b.v[i])
+SIMD_LANE_OP(operator-, a.v[i] - b.v[i])
+SIMD_LANE_OP(operator*, a.v[i] * b.v[i])
+SIMD_LANE_OP(operator/, a.v[i] / b.v[i])
+SIMD_LANE_OP(minOf, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+SIMD_LANE_OP(maxOf, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+SIMD_LANE_OP(cmpGreater, simdLaneMask(a.v[i] > b.v[i]))
+SIMD_LANE_OP(cmpGreaterEqual, simdLaneMask(a.v[i] >= b.v[i]))
+SIMD_LANE_OP(cmpLess, simdLaneMask(a.v[i] < b.v[i]))
+SIMD_LANE_OP(maskAnd, simdLaneMask(simdLaneSet(a.v[i]) && simdLaneSet(b.v[i])))
+SIMD_LANE_OP(maskOr, simdLaneMask(simdLaneSet(a.v[i]) || simdLaneSet(b.v[i])))
+#undef SIMD_LANE_OP
+
+inline Float4 select(const Float4 & pMask, const Float4 & a, const Float4 & b)
+{
+	Float4 r;
+	for (int i = 0; i < 4; i++)
+	{
+		r.v[i] = simdLaneSet(pMask.v[i]) ? a.v[i] : b.v[i];
+	}
+	return r;
+}
+
+inline int moveMask(const Float4 & pMask)
+{
+	int bits = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		bits |= simdLaneSet(pMask.v[i]) ? (1 << i) : 0;
+	}
+	return bits;
+}
+#endif
@@ -0,0 +1,243 @@
+#include "SoftwareDepthBuffer.h"
+#include "Simd.h"
+#include <algorithm>
+
+namespace
+{
+	// vertices closer than this to the eye are clipped.
+	const float NEAR_W = 1e-4f;
+
+	// size of the smallest level kept in the hierarchy.
+	const int MIN_LEVEL_SIZE = 4;
+}
+
+bool SoftwareDepthBuffer::isClipped(const float *pClip)
+{
+	return pClip[3] <= NEAR_W || pClip[2] < -pClip[3];
+}
+
+void SoftwareDepthBuffer::reject(RasterTriangle & pTriangle)
+{
+	pTriangle.mMinX = 1;
+	pTriangle.mMinY = 1;
+	pTriangle.mMaxX = 0;
+	pTriangle.mMaxY = 0;
+}
+
+SoftwareDepthBuffer::SoftwareDepthBuffer(int pWidth, int pHeight)
+{
+	// rows are processed four pixels at a time.
+	mWidth = (pWidth + 3) & ~3;
+	mHeight = pHeight > 0 ? pHeight : 1;
+
+	mLevelCount = 0;
+	int width = mWidth, height = mHeight;
+	while (mLevelCount < MAX_LEVEL_COUNT)
+	{
+		mLevelWidth[mLevelCount] = width;
+		mLevelHeight[mLevelCount] = height;
+		mLevels[mLevelCount] = new float[width * height];
+		++mLevelCount;
+
+		if (width <= MIN_LEVEL_SIZE && height <= MIN_LEVEL_SIZE)
+		{
+			break;
+		}
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+	clear();
+}
+
+SoftwareDepthBuffer::~SoftwareDepthBuffer()
+{
+	for (int i = 0; i < mLevelCount; i++)
+	{
+		delete[] mLevels[i];
+	}
+}
+
+void SoftwareDepthBuffer::clear()
+{
+	for (int i = 0; i < mLevelCount; i++)
+	{
+		std::fill(mLevels[i], mLevels[i] + mLevelWidth[i] * mLevelHeight[i], 1.0f);
+	}
+}
+
+int SoftwareDepthBuffer::setupTriangles(const float* pClipVertices, const GLuint* pIndices, int pTriangleCount,
+	RasterTriangle* pTriangles) const
+{
+	int acceptedCount = 0;
+	for (int i = 0; i < pTriangleCount; i++)
+	{
+		RasterTriangle & triangle = pTriangles[i];
+		reject(triangle);
+
+		float x[3], y[3], z[3];
+		bool rejected = false;
+		for (int k = 0; k < 3; k++)
+		{
+			const float *clip = pClipVertices + pIndices[i * 3 + k] * 4;
+			if (isClipped(clip))
+			{
+				rejected = true;
+				break;
+			}
+			const float invW = 1.0f / clip[3];
+			x[k] = (clip[0] * invW * 0.5f + 0.5f) * mWidth;
+			y[k] = (clip[1] * invW * 0.5f + 0.5f) * mHeight;
+			z[k] = clip[2] * invW * 0.5f + 0.5f;
+		}
+		if (rejected)
+		{
+			continue;
+		}
+
+		// counter clockwise is front facing, like glCullFace(GL_BACK).
+		const float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (area <= 0.0f)
+		{
+			continue;
+		}
+
+		const float minX = std::min(x[0], std::min(x[1], x[2]));
+		const float maxX = std::max(x[0], std::max(x[1], x[2]));
+		const float minY = std::min(y[0], std::min(y[1], y[2]));
+		const float maxY = std::max(y[0], std::max(y[1], y[2]));
+		triangle.mMinX = std::max(0, static_cast<int>(minX));
+		triangle.mMinY = std::max(0, static_cast<int>(minY));
+		triangle.mMaxX = std::min(mWidth - 1, static_cast<int>(maxX));
+		triangle.mMaxY = std::min(mHeight - 1, static_cast<int>(maxY));
+		if (triangle.mMinX > triangle.mMaxX || triangle.mMinY > triangle.mMaxY)
+		{
+			reject(triangle);
+			continue;
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			const int next = (k + 1) % 3;
+			triangle.mEdgeA[k] = y[k] - y[next];
+			triangle.mEdgeB[k] = x[next] - x[k];
+			triangle.mEdgeC[k] = x[k] * y[next] - x[next] * y[k];
+		}
+
+		const float invArea = 1.0f / area;
+		triangle.mDepthA = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * invArea;
+		triangle.mDepthB = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * invArea;
+		triangle.mDepthC = z[0] - triangle.mDepthA * x[0] - triangle.mDepthB * y[0];
+		++acceptedCount;
+	}
+	return acceptedCount;
+}
+
+void SoftwareDepthBuffer::rasterizeRows(const RasterTriangle* pTriangles, int pTriangleCount, int pBeginRow, int pEndRow)
+{
+	const Float4 laneOffset(0.5f, 1.5f, 2.5f, 3.5f);
+	const Float4 zero(0.0f);
+	float *depth = mLevels[0];
+
+	for (int i = 0; i < pTriangleCount; i++)
+	{
+		const RasterTriangle & triangle = pTriangles[i];
+		const int beginRow = std::max(triangle.mMinY, pBeginRow);
+		const int endRow = std::min(triangle.mMaxY + 1, pEndRow);
+		if (isRejected(triangle) || beginRow >= endRow)
+		{
+			continue;
+		}
+
+		const Float4 edgeA0(triangle.mEdgeA[0]), edgeA1(triangle.mEdgeA[1]), edgeA2(triangle.mEdgeA[2]);
+		const Float4 depthA(triangle.mDepthA);
+		const int beginColumn = triangle.mMinX & ~3;
+
+		for (int row = beginRow; row < endRow; row++)
+		{
+			const float py = row + 0.5f;
+			const Float4 rowEdge0(triangle.mEdgeB[0] * py + triangle.mEdgeC[0]);
+			const Float4 rowEdge1(triangle.mEdgeB[1] * py + triangle.mEdgeC[1]);
+			const Float4 rowEdge2(triangle.mEdgeB[2] * py + triangle.mEdgeC[2]);
+			const Float4 rowDepth(triangle.mDepthB * py + triangle.mDepthC);
+			float *rowDepthBuffer = depth + row * mWidth;
+
+			for (int column = beginColumn; column <= triangle.mMaxX; column += 4)
+			{
+				const Float4 px = Float4(static_cast<float>(column)) + laneOffset;
+				// pixel centers on an edge belong to both triangles, so no crack
+				// opens between the triangles of a mesh.
+				const Float4 inside = maskAnd(maskAnd(
+					cmpGreaterEqual(edgeA0 * px + rowEdge0, zero),
+					cmpGreaterEqual(edgeA1 * px + rowEdge1, zero)),
+					cmpGreaterEqual(edgeA2 * px + rowEdge2, zero));
+				if (moveMask(inside) == 0)
+				{
+					continue;
+				}
+
+				const Float4 current = Float4::load(rowDepthBuffer + column);
+				const Float4 triangleDepth = depthA * px + rowDepth;
+				select(inside, minOf(current, triangleDepth), current).store(rowDepthBuffer + column);
+			}
+		}
+	}
+}
+
+void SoftwareDepthBuffer::buildHierarchy()
+{
+	for (int level = 1; level < mLevelCount; level++)
+	{
+		const float *source = mLevels[level - 1];
+		const int sourceWidth = mLevelWidth[level - 1];
+		const int sourceHeight = mLevelHeight[level - 1];
+		float *destination = mLevels[level];
+
+		for (int y = 0; y < mLevelHeight[level]; y++)
+		{
+			const int y0 = y * 2;
+			const int y1 = std::min(y0 + 1, sourceHeight - 1);
+			for (int x = 0; x < mLevelWidth[level]; x++)
+			{
+				const int x0 = x * 2;
+				const int x1 = std::min(x0 + 1, sourceWidth - 1);
+				const float top = std::max(source[y0 * sourceWidth + x0], source[y0 * sourceWidth + x1]);
+				const float bottom = std::max(source[y1 * sourceWidth + x0], source[y1 * sourceWidth + x1]);
+				destination[y * mLevelWidth[level] + x] = std::max(top, bottom);
+			}
+		}
+	}
+}
+
+bool SoftwareDepthBuffer::isOccluded(float pMinX, float pMinY, float pMaxX, float pMaxY, float pMinDepth) const
+{
+	const int minX = std::max(0, static_cast<int>(pMinX));
+	const int minY = std::max(0, static_cast<int>(pMinY));
+	const int maxX = std::min(mWidth - 1, static_cast<int>(pMaxX));
+	const int maxY = std::min(mHeight - 1, static_cast<int>(pMaxY));
+	if (minX > maxX || minY > maxY)
+	{
+		return false;
+	}
+
+	// pick the level where the rectangle covers a few texels only.
+	const int size = std::max(maxX - minX, maxY - minY) + 1;
+	int level = 0;
+	while (level + 1 < mLevelCount && (size >> level) > MIN_LEVEL_SIZE)
+	{
+		++level;
+	}
+
+	const float *depth = mLevels[level];
+	const int width = mLevelWidth[level];
+	for (int y = minY >> level; y <= (maxY >> level); y++)
+	{
+		for (int x = minX >> level; x <= (maxX >> level); x++)
+		{
+			if (depth[y * width + x] >= pMinDepth)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+// no preh.h, the rasterizer and its test build without the fbx sdk.
+#include <GLES3/gl3.h>
+
+// triangle prepared for the software rasterizer, in depth buffer pixels.
+// edges are e(x, y) = a * x + b * y + c, positive inside.
+struct RasterTriangle
+{
+	int mMinX, mMinY, mMaxX, mMaxY;
+	float mEdgeA[3], mEdgeB[3], mEdgeC[3];
+	float mDepthA, mDepthB, mDepthC;	// depth = a * x + b * y + c
+};
+
+// low resolution depth buffer with a max-depth hierarchy on top of it.
+// pure cpu code, it only needs clip space vertices and indices.
+class SoftwareDepthBuffer
+{
+public:
+	SoftwareDepthBuffer(int pWidth, int pHeight);
+	~SoftwareDepthBuffer();
+
+	int getWidth() const { return mWidth; }
+	int getHeight() const { return mHeight; }
+	const float *getDepth(int pLevel = 0) const { return mLevels[pLevel]; }
+
+	void clear();
+
+	// the clip space (xyzw) vertex is too close to the eye or before the near plane.
+	static bool isClipped(const float *pClip);
+	// an empty rectangle, nothing to rasterize.
+	static bool isRejected(const RasterTriangle & pTriangle)
+	{
+		return pTriangle.mMinX > pTriangle.mMaxX || pTriangle.mMinY > pTriangle.mMaxY;
+	}
+
+	// build the raster triangles of an indexed clip space (xyzw) triangle list.
+	// back faces and triangles crossing the near plane are rejected (see
+	// isRejected), which keeps the occlusion conservative.
+	// returns the number of accepted triangles.
+	int setupTriangles(const float *pClipVertices, const GLuint *pIndices, int pTriangleCount,
+		RasterTriangle *pTriangles) const;
+
+	// rasterize rows [pBeginRow, pEndRow) of the triangles, keeping the nearest depth.
+	// disjoint row ranges can be rasterized at the same time.
+	void rasterizeRows(const RasterTriangle *pTriangles, int pTriangleCount, int pBeginRow, int pEndRow);
+
+	// rebuild the max-depth levels from level 0.
+	void buildHierarchy();
+
+	// true if the screen rectangle (pixels of level 0) is behind the stored depth everywhere.
+	bool isOccluded(float pMinX, float pMinY, float pMaxX, float pMaxY, float pMinDepth) const;
+
+private:
+	enum { MAX_LEVEL_COUNT = 8 };
+
+	static void reject(RasterTriangle & pTriangle);
+
+	int mWidth, mHeight;
+	int mLevelCount;
+	int mLevelWidth[MAX_LEVEL_COUNT];
+	int mLevelHeight[MAX_LEVEL_COUNT];
+	float *mLevels[MAX_LEVEL_COUNT];
+};
@@ -0,0 +1,308 @@
+#include "StaticBatcher.h"
+#include "GameContext.h"
+#include "SceneCache.h"
+#include "ShaderProgram.h"
+#include "FrameUniforms.h"
+#include "RenderQueue.h"
+#include "GLStateCache.h"
+#include <algorithm>
+
+namespace
+{
+	const int POSITION_STRIDE = 4;
+	const int NORMAL_STRIDE = 3;
+	const int UV_STRIDE = 2;
+}
+
+StaticBatcher::StaticBatcher() : mEnabled(true), mMaxBatchVertices(DEFAULT_MAX_BATCH_VERTICES)
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+}
+
+StaticBatcher::~StaticBatcher()
+{
+	for (size_t i = 0; i < mBatches.size(); i++)
+	{
+		glDeleteVertexArrays(1, &mBatches[i]->mVertexArray);
+		glDeleteBuffers(BUFFER_COUNT, mBatches[i]->mBuffers);
+		delete mBatches[i];
+	}
+}
+
+void StaticBatcher::collectNodes(FbxNode *pNode, std::vector<FbxNode *> & pNodes,
+	std::unordered_map<VBOMesh *, int> & pMeshUse)
+{
+	const FbxNodeAttribute *attribute = pNode->GetNodeAttribute();
+	if (attribute && attribute->GetAttributeType() == FbxNodeAttribute::eMesh)
+	{
+		VBOMesh *mesh = static_cast<VBOMesh *>(pNode->GetMesh()->GetUserDataPtr());
+		if (mesh)
+		{
+			pNodes.push_back(pNode);
+			++pMeshUse[mesh];
+		}
+	}
+	for (int i = 0; i < pNode->GetChildCount(); i++)
+	{
+		collectNodes(pNode->GetChild(i), pNodes, pMeshUse);
+	}
+}
+
+void StaticBatcher::build(FbxNode *pRoot)
+{
+	std::vector<FbxNode *> nodes;
+	std::unordered_map<VBOMesh *, int> meshUse;
+	collectNodes(pRoot, nodes, meshUse);
+
+	// the batch of every material that still takes vertices.
+	std::unordered_map<const MaterialCache *, int> openBatches;
+	int batchedNodeCount = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		FbxNode *node = nodes[i];
+		VBOMesh *mesh = static_cast<VBOMesh *>(node->GetMesh()->GetUserDataPtr());
+		if (!mesh->getVertexData() || meshUse[mesh] >= RenderQueue::MIN_INSTANCE_COUNT)
+		{
+			continue;
+		}
+
+		GLfloat model[16], normal[9];
+		FrameUniforms::computeModelMatrices(node->EvaluateGlobalTransform(), NULL, model, normal);
+
+		std::vector<std::pair<int, int> > & ranges = mNodeRanges[node];
+		for (int subMesh = 0; subMesh < mesh->getSubMeshCount(); subMesh++)
+		{
+			const int triangleCount = mesh->getSubMeshTriangleCount(subMesh);
+			if (triangleCount == 0)
+			{
+				continue;
+			}
+
+			const MaterialCache *material = RenderQueue::getMaterialCache(node, subMesh);
+			std::unordered_map<const MaterialCache *, int>::iterator open = openBatches.find(material);
+			if (open == openBatches.end()
+				|| static_cast<int>(mBatches[open->second]->mPositions.size()) / POSITION_STRIDE + triangleCount * 3 > mMaxBatchVertices)
+			{
+				Batch *batch = new Batch;
+				batch->mMaterial = material;
+				batch->mVertexArray = 0;
+				batch->mVisibleCount = 0;
+				mBatches.push_back(batch);
+				openBatches[material] = static_cast<int>(mBatches.size()) - 1;
+				open = openBatches.find(material);
+			}
+
+			const int range = addSubMesh(*mBatches[open->second], *mesh, subMesh, model, normal);
+			ranges.push_back(std::make_pair(open->second, range));
+		}
+		++batchedNodeCount;
+	}
+
+	for (size_t i = 0; i < mBatches.size(); i++)
+	{
+		upload(*mBatches[i]);
+	}
+
+	// nothing else reads the cpu copies.
+	for (std::unordered_map<VBOMesh *, int>::iterator it = meshUse.begin(); it != meshUse.end(); ++it)
+	{
+		it->first->releaseVertexData();
+	}
+
+	cout << "static batches: " << batchedNodeCount << " nodes merged into " << mBatches.size() << " batches" << endl;
+}
+
+int StaticBatcher::addSubMesh(Batch & pBatch, const VBOMesh & pMesh, int pSubMesh, const GLfloat *pModel, const GLfloat *pNormal)
+{
+	const VBOMesh::VertexData & data = *pMesh.getVertexData();
+	const int vertexCount = static_cast<int>(data.mPositions.size()) / POSITION_STRIDE;
+	std::vector<int> remap(vertexCount, -1);
+
+	Range range;
+	range.mIndexOffset = static_cast<int>(pBatch.mIndices.size());
+	range.mIndexCount = pMesh.getSubMeshTriangleCount(pSubMesh) * 3;
+	range.mMinVertex = 0xFFFFFFFFu;
+	range.mMaxVertex = 0;
+
+	const int first = pMesh.getSubMeshIndexOffset(pSubMesh);
+	for (int i = first; i < first + range.mIndexCount; i++)
+	{
+		const GLuint vertex = data.mIndices[i];
+		if (remap[vertex] < 0)
+		{
+			remap[vertex] = static_cast<int>(pBatch.mPositions.size()) / POSITION_STRIDE;
+
+			// column major, world = model * position and normal matrix * normal.
+			const GLfloat *p = &data.mPositions[vertex * POSITION_STRIDE];
+			for (int r = 0; r < 3; r++)
+			{
+				pBatch.mPositions.push_back(pModel[r] * p[0] + pModel[4 + r] * p[1] + pModel[8 + r] * p[2] + pModel[12 + r]);
+			}
+			pBatch.mPositions.push_back(1.0f);
+
+			// a mesh without normals or uvs reads zeros, as a disabled array reads (0, 0, 0).
+			const GLfloat *n = data.mNormals.empty() ? NULL : &data.mNormals[vertex * NORMAL_STRIDE];
+			for (int r = 0; r < 3; r++)
+			{
+				pBatch.mNormals.push_back(n ? pNormal[r] * n[0] + pNormal[3 + r] * n[1] + pNormal[6 + r] * n[2] : 0.0f);
+			}
+			for (int k = 0; k < UV_STRIDE; k++)
+			{
+				pBatch.mUVs.push_back(data.mUVs.empty() ? 0.0f : data.mUVs[vertex * UV_STRIDE + k]);
+			}
+		}
+		const GLuint batchVertex = static_cast<GLuint>(remap[vertex]);
+		pBatch.mIndices.push_back(batchVertex);
+		range.mMinVertex = std::min(range.mMinVertex, batchVertex);
+		range.mMaxVertex = std::max(range.mMaxVertex, batchVertex);
+	}
+
+	pBatch.mRanges.push_back(range);
+	pBatch.mVisible.push_back(0);
+	return static_cast<int>(pBatch.mRanges.size()) - 1;
+}
+
+void StaticBatcher::upload(Batch & pBatch)
+{
+	glGenBuffers(BUFFER_COUNT, pBatch.mBuffers);
+	glGenVertexArrays(1, &pBatch.mVertexArray);
+	glBindVertexArray(pBatch.mVertexArray);
+
+	// the same attribute locations as VBOMesh.
+	glBindBuffer(GL_ARRAY_BUFFER, pBatch.mBuffers[POSITION_BUFFER]);
+	glBufferData(GL_ARRAY_BUFFER, pBatch.mPositions.size() * sizeof(GLfloat), &pBatch.mPositions[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, POSITION_STRIDE, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, pBatch.mBuffers[NORMAL_BUFFER]);
+	glBufferData(GL_ARRAY_BUFFER, pBatch.mNormals.size() * sizeof(GLfloat), &pBatch.mNormals[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, NORMAL_STRIDE, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, pBatch.mBuffers[UV_BUFFER]);
+	glBufferData(GL_ARRAY_BUFFER, pBatch.mUVs.size() * sizeof(GLfloat), &pBatch.mUVs[0], GL_STATIC_DRAW);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, UV_STRIDE, GL_FLOAT, GL_FALSE, 0, 0);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pBatch.mBuffers[INDEX_BUFFER]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, pBatch.mIndices.size() * sizeof(GLuint), &pBatch.mIndices[0], GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	std::vector<GLfloat>().swap(pBatch.mPositions);
+	std::vector<GLfloat>().swap(pBatch.mNormals);
+	std::vector<GLfloat>().swap(pBatch.mUVs);
+	std::vector<GLuint>().swap(pBatch.mIndices);
+}
+
+void StaticBatcher::beginFrame()
+{
+	memset(&mStatistics, 0, sizeof(mStatistics));
+	for (size_t i = 0; i < mBatches.size(); i++)
+	{
+		Batch *batch = mBatches[i];
+		if (batch->mVisibleCount > 0)
+		{
+			std::fill(batch->mVisible.begin(), batch->mVisible.end(), 0);
+			batch->mVisibleCount = 0;
+		}
+	}
+}
+
+bool StaticBatcher::markVisible(const FbxNode *pNode)
+{
+	if (!mEnabled)
+	{
+		return false;
+	}
+	std::unordered_map<const FbxNode *, std::vector<std::pair<int, int> > >::const_iterator it = mNodeRanges.find(pNode);
+	if (it == mNodeRanges.end())
+	{
+		return false;
+	}
+	const std::vector<std::pair<int, int> > & ranges = it->second;
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		Batch *batch = mBatches[ranges[i].first];
+		char & visible = batch->mVisible[ranges[i].second];
+		if (!visible)
+		{
+			visible = 1;
+			++batch->mVisibleCount;
+		}
+	}
+	return true;
+}
+
+void StaticBatcher::draw(GameContext *gameContext)
+{
+	if (!mEnabled || mBatches.empty())
+	{
+		return;
+	}
+
+	GLStateCache *glState = gameContext->mGLState;
+	const ShaderProgram *program = gameContext->mShaderProgram;
+	glState->useProgram(program->programObject);
+	// the vertices are in world space already.
+	const FbxAMatrix identity;
+	gameContext->mFrameUniforms->setModelMatrix(program, identity);
+
+	for (size_t b = 0; b < mBatches.size(); b++)
+	{
+		const Batch *batch = mBatches[b];
+		if (batch->mVisibleCount == 0)
+		{
+			continue;
+		}
+		glState->bindVertexArray(batch->mVertexArray);
+		if (batch->mMaterial)
+		{
+			batch->mMaterial->setCurrentMaterial(program, glState);
+		}
+		else
+		{
+			MaterialCache::setDefaultMaterial(program);
+		}
+		++mStatistics.mBatchCount;
+
+		// neighbouring visible ranges are contiguous, they go in one call.
+		const int rangeCount = static_cast<int>(batch->mRanges.size());
+		int runStart = -1;
+		GLuint minVertex = 0, maxVertex = 0;
+		for (int i = 0; i <= rangeCount; i++)
+		{
+			const bool visible = i < rangeCount && batch->mVisible[i];
+			if (visible)
+			{
+				const Range & range = batch->mRanges[i];
+				minVertex = runStart < 0 ? range.mMinVertex : std::min(minVertex, range.mMinVertex);
+				maxVertex = runStart < 0 ? range.mMaxVertex : std::max(maxVertex, range.mMaxVertex);
+				if (runStart < 0)
+				{
+					runStart = i;
+				}
+				++mStatistics.mRangeCount;
+			}
+			else if (runStart >= 0)
+			{
+				const Range & first = batch->mRanges[runStart];
+				const Range & last = batch->mRanges[i - 1];
+				const GLsizei elementCount = last.mIndexOffset + last.mIndexCount - first.mIndexOffset;
+				const GLsizei offset = first.mIndexOffset * sizeof(GLuint);
+				glDrawRangeElements(GL_TRIANGLES, minVertex, maxVertex, elementCount, GL_UNSIGNED_INT,
+					reinterpret_cast<const GLvoid *>(offset));
+				++mStatistics.mDrawCount;
+				runStart = -1;
+			}
+		}
+	}
+	glState->bindVertexArray(0);
+}
+
+void StaticBatcher::printStatistics() const
+{
+	cout << "static batches: " << mStatistics.mRangeCount << " ranges in " << mStatistics.mBatchCount << " batches, "
+		<< mStatistics.mDrawCount << " draws" << endl;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+#include <unordered_map>
+
+class GameContext;
+class VBOMesh;
+class MaterialCache;
+
+// load time merge of the small undeformed meshes into a few large vertex
+// and index buffers per material, with the vertices already in world space.
+// every node keeps the index range of each of its submeshes, so drawMesh
+// still culls node by node and only marks the ranges that survive. a batch
+// then draws its marked ranges with one glDrawRangeElements per run of
+// neighbouring ranges. meshes placed often enough to be instanced are left
+// to the render queue. node transforms are evaluated once, as drawMesh does.
+class StaticBatcher
+{
+public:
+	enum { DEFAULT_MAX_BATCH_VERTICES = 65536 };
+
+	struct Statistics
+	{
+		int mBatchCount;		// batches with a visible range
+		int mRangeCount;		// visible ranges
+		int mDrawCount;			// glDrawRangeElements calls after merging neighbours
+	};
+
+	StaticBatcher();
+	~StaticBatcher();
+
+	void setEnabled(bool pEnabled) { mEnabled = pEnabled; }
+	bool isEnabled() const { return mEnabled; }
+
+	// a batch is closed when the next submesh could take it over pMaxVertices.
+	void setMaxBatchVertices(int pMaxVertices) { mMaxBatchVertices = pMaxVertices; }
+
+	// merge the meshes under pRoot, needs a current gl context. the cpu
+	// copies of the meshes are released afterwards.
+	void build(FbxNode *pRoot);
+
+	void beginFrame();
+
+	// true if the node is drawn by the batches, its ranges are drawn this frame.
+	bool markVisible(const FbxNode *pNode);
+
+	// the marked ranges, after the traversal.
+	void draw(GameContext *gameContext);
+
+	const Statistics & getStatistics() const { return mStatistics; }
+	void printStatistics() const;
+
+private:
+	enum
+	{
+		POSITION_BUFFER,
+		NORMAL_BUFFER,
+		UV_BUFFER,
+		INDEX_BUFFER,
+		BUFFER_COUNT,
+	};
+
+	struct Range
+	{
+		int mIndexOffset;
+		int mIndexCount;
+		GLuint mMinVertex;
+		GLuint mMaxVertex;
+	};
+
+	struct Batch
+	{
+		const MaterialCache *mMaterial;		// NULL for the default material
+		GLuint mBuffers[BUFFER_COUNT];
+		GLuint mVertexArray;
+		std::vector<Range> mRanges;
+		std::vector<char> mVisible;
+		int mVisibleCount;
+		// released after the upload
+		std::vector<GLfloat> mPositions;
+		std::vector<GLfloat> mNormals;
+		std::vector<GLfloat> mUVs;
+		std::vector<GLuint> mIndices;
+	};
+
+	static void collectNodes(FbxNode *pNode, std::vector<FbxNode *> & pNodes,
+		std::unordered_map<VBOMesh *, int> & pMeshUse);
+	// append the submesh transformed by pModel, returns the index of its range.
+	static int addSubMesh(Batch & pBatch, const VBOMesh & pMesh, int pSubMesh, const GLfloat *pModel, const GLfloat *pNormal);
+	static void upload(Batch & pBatch);
+
+	bool mEnabled;
+	int mMaxBatchVertices;
+	std::vector<Batch *> mBatches;
+	// node -> (batch, range) of each of its submeshes
+	std::unordered_map<const FbxNode *, std::vector<std::pair<int, int> > > mNodeRanges;
+	Statistics mStatistics;
+};
@@ -0,0 +1,140 @@
+#include "TextureArray.h"
+#include "GLStateCache.h"
+#include <algorithm>
+
+TextureArray::TextureArray(GLStateCache *pGLState) : mGLState(pGLState)
+{
+}
+
+TextureArray::~TextureArray()
+{
+	for (size_t i = 0; i < mArrays.size(); i++)
+	{
+		if (mArrays[i])
+		{
+			mGLState->deleteTextures(1, &mArrays[i]->mTexture);
+			delete mArrays[i];
+		}
+	}
+}
+
+bool TextureArray::accepts(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels)
+{
+	return pFormat.mFormat == 0 && !pLevels.empty();
+}
+
+int TextureArray::allocate(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels, int pCount,
+	Layer *pLayers)
+{
+	const int width = pLevels[0].mWidth;
+	const int height = pLevels[0].mHeight;
+	const int levelCount = static_cast<int>(pLevels.size());
+	int count = 0;
+	int emptyArray = -1;
+	for (size_t i = 0; i < mArrays.size() && count < pCount; i++)
+	{
+		Array *array = mArrays[i];
+		if (!array)
+		{
+			emptyArray = static_cast<int>(i);
+			continue;
+		}
+		if (array->mInternalFormat != pFormat.mInternalFormat || array->mWidth != width || array->mHeight != height
+			|| array->mLevelCount != levelCount)
+		{
+			continue;
+		}
+		for (size_t layer = 0; layer < array->mUsed.size() && count < pCount; layer++)
+		{
+			if (!array->mUsed[layer])
+			{
+				array->mUsed[layer] = 1;
+				++array->mUsedCount;
+				pLayers[count].mArray = static_cast<int>(i);
+				pLayers[count].mLayer = static_cast<int>(layer);
+				++count;
+			}
+		}
+	}
+
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	maxLayers = std::min<GLint>(maxLayers, MAX_LAYER_COUNT);
+	while (pCount - count >= MIN_LAYER_COUNT && maxLayers >= MIN_LAYER_COUNT)
+	{
+		Array *array = new Array();
+		array->mInternalFormat = pFormat.mInternalFormat;
+		array->mWidth = width;
+		array->mHeight = height;
+		array->mLevelCount = levelCount;
+		array->mUsed.assign(std::min(pCount - count, static_cast<int>(maxLayers)), 1);
+		array->mUsedCount = static_cast<int>(array->mUsed.size());
+		glGenTextures(1, &array->mTexture);
+		mGLState->bindTexture(GL_TEXTURE_2D_ARRAY, array->mTexture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, pFormat.mInternalFormat, width, height, array->mUsedCount);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		// like a texture of its own.
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		if (emptyArray < 0)
+		{
+			emptyArray = static_cast<int>(mArrays.size());
+			mArrays.push_back(NULL);
+		}
+		mArrays[emptyArray] = array;
+		for (int layer = 0; layer < array->mUsedCount; layer++)
+		{
+			pLayers[count].mArray = emptyArray;
+			pLayers[count].mLayer = layer;
+			++count;
+		}
+		emptyArray = -1;
+	}
+	return count;
+}
+
+void TextureArray::release(const Layer & pLayer)
+{
+	Array *array = mArrays[pLayer.mArray];
+	array->mUsed[pLayer.mLayer] = 0;
+	if (--array->mUsedCount == 0)
+	{
+		mGLState->deleteTextures(1, &array->mTexture);
+		delete array;
+		mArrays[pLayer.mArray] = NULL;
+	}
+}
+
+void TextureArray::upload(const Layer & pLayer, const std::vector<TextureLevelData> & pLevels)
+{
+	const Array *array = mArrays[pLayer.mArray];
+	mGLState->bindTexture(GL_TEXTURE_2D_ARRAY, array->mTexture);
+	for (size_t level = 0; level < pLevels.size(); level++)
+	{
+		const TextureLevelData & data = pLevels[level];
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level), 0, 0, pLayer.mLayer, data.mWidth,
+			data.mHeight, 1, array->mInternalFormat, static_cast<GLsizei>(data.mSize), data.mData);
+	}
+}
+
+int TextureArray::getArrayCount() const
+{
+	int count = 0;
+	for (size_t i = 0; i < mArrays.size(); i++)
+	{
+		count += mArrays[i] ? 1 : 0;
+	}
+	return count;
+}
+
+int TextureArray::getLayerCount() const
+{
+	int count = 0;
+	for (size_t i = 0; i < mArrays.size(); i++)
+	{
+		count += mArrays[i] ? mArrays[i]->mUsedCount : 0;
+	}
+	return count;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "preh.h"
+#include "TextureFile.h"
+#include <vector>
+
+class GLStateCache;
+
+// keeps the compressed textures of one size, format and level count in the
+// layers of 2d array textures, so materials that only differ in their
+// texture share one binding and instanced draws pick the layer per
+// instance. unlike atlas tiles the layers wrap, so repeated textures fit.
+// an array is created for a whole group of textures at once, later textures
+// of its kind only get the layers freed in it.
+class TextureArray
+{
+public:
+	enum
+	{
+		// fewer textures of a kind keep textures of their own.
+		MIN_LAYER_COUNT = 2,
+		MAX_LAYER_COUNT = 64,
+	};
+
+	struct Layer
+	{
+		int mArray;		// -1 for none
+		int mLayer;
+	};
+
+	TextureArray(GLStateCache *pGLState);
+	~TextureArray();
+
+	// compressed levels, the storage of the array needs a sized format.
+	static bool accepts(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels);
+
+	// up to pCount layers for textures like pLevels into pLayers, returns how
+	// many. free layers are used first, the rest go to new arrays if there
+	// are at least MIN_LAYER_COUNT of them.
+	int allocate(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels, int pCount, Layer *pLayers);
+	// the array goes with its last layer.
+	void release(const Layer & pLayer);
+
+	// copy the levels into the layer, their data are offsets into the bound pixel unpack buffer.
+	void upload(const Layer & pLayer, const std::vector<TextureLevelData> & pLevels);
+
+	GLuint getArrayTexture(int pArray) const { return mArrays[pArray]->mTexture; }
+	int getArrayCount() const;
+	int getLayerCount() const;
+
+private:
+	struct Array
+	{
+		GLuint mTexture;
+		GLenum mInternalFormat;
+		int mWidth;
+		int mHeight;
+		int mLevelCount;
+		std::vector<char> mUsed;
+		int mUsedCount;
+	};
+
+	GLStateCache *mGLState;
+	// NULL for deleted arrays, the layers keep their index.
+	std::vector<Array *> mArrays;
+};
@@ -0,0 +1,349 @@
+#include "TextureAtlas.h"
+#include "GLStateCache.h"
+#include "Etc2Encoder.h"
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+	const int BLOCK_SIZE = 4;
+	const int BLOCK_BYTES = 8;
+
+	bool isPowerOfTwo(int pValue)
+	{
+		return pValue > 0 && (pValue & (pValue - 1)) == 0;
+	}
+
+	int getLevelBlocks(int pSize, int pLevel)
+	{
+		return (pSize >> pLevel) / BLOCK_SIZE;
+	}
+
+	// encode a block aligned rectangle of the padded pixels into its place among the padded blocks.
+	void encodeRectangle(const std::vector<unsigned char> & pPixels, int pPixelWidth, int pX, int pY, int pWidth,
+		int pHeight, int pBlockWidth, unsigned char *pTarget)
+	{
+		std::vector<unsigned char> pixels(static_cast<size_t>(pWidth) * pHeight * 3);
+		for (int y = 0; y < pHeight; y++)
+		{
+			memcpy(&pixels[static_cast<size_t>(y) * pWidth * 3], &pPixels[(static_cast<size_t>(pY + y) * pPixelWidth + pX) * 3],
+				static_cast<size_t>(pWidth) * 3);
+		}
+		std::vector<unsigned char> blocks;
+		encodeEtc2(&pixels[0], pWidth, pHeight, 3, ETC2_QUALITY_FAST, NULL, blocks);
+
+		const int blockWidth = pWidth / BLOCK_SIZE;
+		const int blockHeight = pHeight / BLOCK_SIZE;
+		for (int by = 0; by < blockHeight; by++)
+		{
+			memcpy(pTarget + ((pY / BLOCK_SIZE + by) * pBlockWidth + pX / BLOCK_SIZE) * BLOCK_BYTES,
+				&blocks[static_cast<size_t>(by) * blockWidth * BLOCK_BYTES], static_cast<size_t>(blockWidth) * BLOCK_BYTES);
+		}
+	}
+}
+
+RectanglePacker::RectanglePacker(int pWidth, int pHeight) : mWidth(pWidth), mHeight(pHeight), mUsedArea(0)
+{
+	Rectangle all = { 0, 0, pWidth, pHeight };
+	mFree.push_back(all);
+}
+
+bool RectanglePacker::insert(int pWidth, int pHeight, int & pX, int & pY)
+{
+	int best = -1;
+	int bestShortSide = INT_MAX;
+	int bestLongSide = INT_MAX;
+	for (size_t i = 0; i < mFree.size(); i++)
+	{
+		const Rectangle & candidate = mFree[i];
+		if (candidate.mWidth < pWidth || candidate.mHeight < pHeight)
+		{
+			continue;
+		}
+		const int leftWidth = candidate.mWidth - pWidth;
+		const int leftHeight = candidate.mHeight - pHeight;
+		const int shortSide = std::min(leftWidth, leftHeight);
+		const int longSide = std::max(leftWidth, leftHeight);
+		if (shortSide < bestShortSide || (shortSide == bestShortSide && longSide < bestLongSide))
+		{
+			best = static_cast<int>(i);
+			bestShortSide = shortSide;
+			bestLongSide = longSide;
+		}
+	}
+	if (best < 0)
+	{
+		return false;
+	}
+
+	const Rectangle used = { mFree[best].mX, mFree[best].mY, pWidth, pHeight };
+	split(used);
+	prune();
+	mUsedArea += static_cast<long long>(pWidth) * pHeight;
+	pX = used.mX;
+	pY = used.mY;
+	return true;
+}
+
+void RectanglePacker::remove(int pX, int pY, int pWidth, int pHeight)
+{
+	const Rectangle freed = { pX, pY, pWidth, pHeight };
+	mFree.push_back(freed);
+	prune();
+	mUsedArea -= static_cast<long long>(pWidth) * pHeight;
+}
+
+float RectanglePacker::getOccupancy() const
+{
+	return static_cast<float>(mUsedArea) / (static_cast<float>(mWidth) * mHeight);
+}
+
+void RectanglePacker::split(const Rectangle & pUsed)
+{
+	const size_t count = mFree.size();
+	for (size_t i = 0; i < count; i++)
+	{
+		const Rectangle rectangle = mFree[i];
+		if (pUsed.mX >= rectangle.mX + rectangle.mWidth || pUsed.mX + pUsed.mWidth <= rectangle.mX
+			|| pUsed.mY >= rectangle.mY + rectangle.mHeight || pUsed.mY + pUsed.mHeight <= rectangle.mY)
+		{
+			continue;
+		}
+
+		// the parts of the free rectangle on each side of the used one.
+		if (pUsed.mX > rectangle.mX)
+		{
+			const Rectangle left = { rectangle.mX, rectangle.mY, pUsed.mX - rectangle.mX, rectangle.mHeight };
+			mFree.push_back(left);
+		}
+		if (pUsed.mX + pUsed.mWidth < rectangle.mX + rectangle.mWidth)
+		{
+			const Rectangle right = { pUsed.mX + pUsed.mWidth, rectangle.mY, rectangle.mX + rectangle.mWidth - pUsed.mX - pUsed.mWidth, rectangle.mHeight };
+			mFree.push_back(right);
+		}
+		if (pUsed.mY > rectangle.mY)
+		{
+			const Rectangle bottom = { rectangle.mX, rectangle.mY, rectangle.mWidth, pUsed.mY - rectangle.mY };
+			mFree.push_back(bottom);
+		}
+		if (pUsed.mY + pUsed.mHeight < rectangle.mY + rectangle.mHeight)
+		{
+			const Rectangle top = { rectangle.mX, pUsed.mY + pUsed.mHeight, rectangle.mWidth, rectangle.mY + rectangle.mHeight - pUsed.mY - pUsed.mHeight };
+			mFree.push_back(top);
+		}
+		mFree[i].mWidth = 0;
+	}
+	mFree.erase(std::remove_if(mFree.begin(), mFree.end(), [](const Rectangle & pFree) { return pFree.mWidth == 0; }),
+		mFree.end());
+}
+
+void RectanglePacker::prune()
+{
+	// drop the rectangles inside another one, of two equal ones the first stays.
+	for (size_t i = 0; i < mFree.size(); i++)
+	{
+		const Rectangle & a = mFree[i];
+		for (size_t j = 0; j < mFree.size(); j++)
+		{
+			const Rectangle & b = mFree[j];
+			if (i == j || b.mWidth == 0)
+			{
+				continue;
+			}
+			const bool inside = a.mX >= b.mX && a.mY >= b.mY
+				&& a.mX + a.mWidth <= b.mX + b.mWidth && a.mY + a.mHeight <= b.mY + b.mHeight;
+			const bool same = a.mX == b.mX && a.mY == b.mY && a.mWidth == b.mWidth && a.mHeight == b.mHeight;
+			if (inside && (!same || j < i))
+			{
+				mFree[i].mWidth = 0;
+				break;
+			}
+		}
+	}
+	mFree.erase(std::remove_if(mFree.begin(), mFree.end(), [](const Rectangle & pFree) { return pFree.mWidth == 0; }),
+		mFree.end());
+}
+
+TextureAtlas::TextureAtlas(GLStateCache *pGLState) : mGLState(pGLState)
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+	for (size_t i = 0; i < mPages.size(); i++)
+	{
+		if (mPages[i])
+		{
+			mGLState->deleteTextures(1, &mPages[i]->mTexture);
+			delete mPages[i];
+		}
+	}
+}
+
+bool TextureAtlas::accepts(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels)
+{
+	if (pFormat.mFormat != 0 || pFormat.mInternalFormat != getEtc2Format(3) || pLevels.size() < LEVEL_COUNT)
+	{
+		return false;
+	}
+	const int width = pLevels[0].mWidth;
+	const int height = pLevels[0].mHeight;
+	return isPowerOfTwo(width) && isPowerOfTwo(height) && width >= MIN_TILE_SIZE && height >= MIN_TILE_SIZE
+		&& width <= MAX_TILE_SIZE && height <= MAX_TILE_SIZE;
+}
+
+bool TextureAtlas::allocate(int pWidth, int pHeight, Tile & pTile)
+{
+	// the sides are multiples of PADDING, so every corner lands on a block of every level.
+	const int width = pWidth + 2 * PADDING;
+	const int height = pHeight + 2 * PADDING;
+	int emptyPage = -1;
+	for (size_t i = 0; i < mPages.size(); i++)
+	{
+		if (!mPages[i])
+		{
+			emptyPage = static_cast<int>(i);
+		}
+		else if (mPages[i]->mPacker.insert(width, height, pTile.mX, pTile.mY))
+		{
+			pTile.mPage = static_cast<int>(i);
+			pTile.mWidth = width;
+			pTile.mHeight = height;
+			++mPages[i]->mTileCount;
+			return true;
+		}
+	}
+
+	Page *page = new Page();
+	if (!page->mPacker.insert(width, height, pTile.mX, pTile.mY))
+	{
+		delete page;
+		return false;
+	}
+	glGenTextures(1, &page->mTexture);
+	mGLState->bindTexture(GL_TEXTURE_2D, page->mTexture);
+	glTexStorage2D(GL_TEXTURE_2D, LEVEL_COUNT, getEtc2Format(3), PAGE_SIZE, PAGE_SIZE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	page->mTileCount = 1;
+	if (emptyPage < 0)
+	{
+		emptyPage = static_cast<int>(mPages.size());
+		mPages.push_back(NULL);
+	}
+	mPages[emptyPage] = page;
+	pTile.mPage = emptyPage;
+	pTile.mWidth = width;
+	pTile.mHeight = height;
+	return true;
+}
+
+void TextureAtlas::release(const Tile & pTile)
+{
+	Page *page = mPages[pTile.mPage];
+	page->mPacker.remove(pTile.mX, pTile.mY, pTile.mWidth, pTile.mHeight);
+	if (--page->mTileCount == 0)
+	{
+		mGLState->deleteTextures(1, &page->mTexture);
+		delete page;
+		mPages[pTile.mPage] = NULL;
+	}
+}
+
+int TextureAtlas::getPageCount() const
+{
+	int count = 0;
+	for (size_t i = 0; i < mPages.size(); i++)
+	{
+		count += mPages[i] ? 1 : 0;
+	}
+	return count;
+}
+
+int TextureAtlas::getTileCount() const
+{
+	int count = 0;
+	for (size_t i = 0; i < mPages.size(); i++)
+	{
+		count += mPages[i] ? mPages[i]->mTileCount : 0;
+	}
+	return count;
+}
+
+void TextureAtlas::getUVTransform(const Tile & pTile, GLfloat *pTransform)
+{
+	const GLfloat scale = 1.0f / PAGE_SIZE;
+	pTransform[0] = (pTile.mWidth - 2 * PADDING) * scale;
+	pTransform[1] = (pTile.mHeight - 2 * PADDING) * scale;
+	pTransform[2] = (pTile.mX + PADDING) * scale;
+	pTransform[3] = (pTile.mY + PADDING) * scale;
+}
+
+size_t TextureAtlas::getTileSize(const Tile & pTile)
+{
+	size_t size = 0;
+	for (int level = 0; level < LEVEL_COUNT; level++)
+	{
+		size += static_cast<size_t>(getLevelBlocks(pTile.mWidth, level)) * getLevelBlocks(pTile.mHeight, level) * BLOCK_BYTES;
+	}
+	return size;
+}
+
+void TextureAtlas::padTile(const std::vector<TextureLevelData> & pLevels, const Tile & pTile, unsigned char *pTarget)
+{
+	for (int level = 0; level < LEVEL_COUNT; level++)
+	{
+		const TextureLevelData & data = pLevels[level];
+		const int padding = PADDING >> level;
+		const int width = pTile.mWidth >> level;
+		const int height = pTile.mHeight >> level;
+		const int blockWidth = width / BLOCK_SIZE;
+
+		// the tile blocks as they are.
+		const int tileBlockWidth = data.mWidth / BLOCK_SIZE;
+		const int tileBlockHeight = data.mHeight / BLOCK_SIZE;
+		const int paddingBlocks = padding / BLOCK_SIZE;
+		for (int by = 0; by < tileBlockHeight; by++)
+		{
+			memcpy(pTarget + ((paddingBlocks + by) * blockWidth + paddingBlocks) * BLOCK_BYTES,
+				data.mData + static_cast<size_t>(by) * tileBlockWidth * BLOCK_BYTES, static_cast<size_t>(tileBlockWidth) * BLOCK_BYTES);
+		}
+
+		// the ring around it from the clamped edge texels, in four strips.
+		std::vector<unsigned char> tilePixels(static_cast<size_t>(data.mWidth) * data.mHeight * 3);
+		decodeEtc2(data.mData, data.mWidth, data.mHeight, 3, &tilePixels[0]);
+		std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 3);
+		for (int y = 0; y < height; y++)
+		{
+			const int sourceY = std::min(std::max(y - padding, 0), data.mHeight - 1);
+			for (int x = 0; x < width; x++)
+			{
+				const int sourceX = std::min(std::max(x - padding, 0), data.mWidth - 1);
+				memcpy(&pixels[(static_cast<size_t>(y) * width + x) * 3], &tilePixels[(static_cast<size_t>(sourceY) * data.mWidth + sourceX) * 3], 3);
+			}
+		}
+		encodeRectangle(pixels, width, 0, 0, width, padding, blockWidth, pTarget);
+		encodeRectangle(pixels, width, 0, height - padding, width, padding, blockWidth, pTarget);
+		encodeRectangle(pixels, width, 0, padding, padding, height - 2 * padding, blockWidth, pTarget);
+		encodeRectangle(pixels, width, width - padding, padding, padding, height - 2 * padding, blockWidth, pTarget);
+
+		pTarget += static_cast<size_t>(blockWidth) * (height / BLOCK_SIZE) * BLOCK_BYTES;
+	}
+}
+
+void TextureAtlas::upload(const Tile & pTile)
+{
+	mGLState->bindTexture(GL_TEXTURE_2D, mPages[pTile.mPage]->mTexture);
+	size_t offset = 0;
+	for (int level = 0; level < LEVEL_COUNT; level++)
+	{
+		const int width = pTile.mWidth >> level;
+		const int height = pTile.mHeight >> level;
+		const GLsizei size = (width / BLOCK_SIZE) * (height / BLOCK_SIZE) * BLOCK_BYTES;
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, level, pTile.mX >> level, pTile.mY >> level, width, height,
+			getEtc2Format(3), size, reinterpret_cast<const void *>(offset));
+		offset += size;
+	}
+}
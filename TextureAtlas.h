@@ -0,0 +1,102 @@
+#pragma once
+#include "preh.h"
+#include "TextureFile.h"
+#include <vector>
+
+class GLStateCache;
+
+// max rects packing of rectangles into a fixed area, best short side fit.
+// the free area is kept as maximal, possibly overlapping rectangles.
+class RectanglePacker
+{
+public:
+	RectanglePacker(int pWidth, int pHeight);
+
+	bool insert(int pWidth, int pHeight, int & pX, int & pY);
+	// give a placed rectangle back, it is not merged with its free neighbours.
+	void remove(int pX, int pY, int pWidth, int pHeight);
+
+	// used / whole area.
+	float getOccupancy() const;
+
+private:
+	struct Rectangle
+	{
+		int mX, mY, mWidth, mHeight;
+	};
+
+	void split(const Rectangle & pUsed);
+	void prune();
+
+	int mWidth;
+	int mHeight;
+	long long mUsedArea;
+	std::vector<Rectangle> mFree;
+};
+
+// packs the small etc2 textures into pages, so the materials using them
+// bind one texture and read their part through a uv scale and offset. the
+// tiles go in as they are, block by block, with a ring of clamped edge
+// texels around them so the filtering and the first mip levels never reach
+// the neighbours. tiles and padding are multiples of a block on every level
+// of the page, which has LEVEL_COUNT levels only.
+class TextureAtlas
+{
+public:
+	enum
+	{
+		PAGE_SIZE = 1024,
+		MIN_TILE_SIZE = 16,
+		MAX_TILE_SIZE = 256,
+		// texels around every tile on the first level, one block on the last.
+		PADDING = 16,
+		LEVEL_COUNT = 3,
+	};
+
+	// the padded rectangle of a tile on the first level.
+	struct Tile
+	{
+		int mPage;		// -1 for none
+		int mX, mY;
+		int mWidth, mHeight;
+	};
+
+	TextureAtlas(GLStateCache *pGLState);
+	~TextureAtlas();
+
+	// rgb etc2 with power of two sides in the tile range and enough levels.
+	static bool accepts(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels);
+
+	// a tile for a pWidth x pHeight texture, on a new page if none has room.
+	bool allocate(int pWidth, int pHeight, Tile & pTile);
+	// the page goes with its last tile.
+	void release(const Tile & pTile);
+
+	GLuint getPageTexture(int pPage) const { return mPages[pPage]->mTexture; }
+	int getPageCount() const;
+	int getTileCount() const;
+
+	// scale and offset from the uvs of the texture to the uvs of its page.
+	static void getUVTransform(const Tile & pTile, GLfloat *pTransform);
+
+	// bytes of the padded levels of a tile.
+	static size_t getTileSize(const Tile & pTile);
+	// worker side, writes the padded levels of pLevels into pTarget.
+	static void padTile(const std::vector<TextureLevelData> & pLevels, const Tile & pTile, unsigned char *pTarget);
+	// copy the padded levels from the bound pixel unpack buffer, from offset 0.
+	void upload(const Tile & pTile);
+
+private:
+	struct Page
+	{
+		GLuint mTexture;
+		RectanglePacker mPacker;
+		int mTileCount;
+
+		Page() : mTexture(0), mPacker(PAGE_SIZE, PAGE_SIZE), mTileCount(0) {}
+	};
+
+	GLStateCache *mGLState;
+	// NULL for deleted pages, the pages of the tiles keep their index.
+	std::vector<Page *> mPages;
+};
@@ -0,0 +1,238 @@
+#include "TextureFile.h"
+#include <stdint.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char FILE_MAGIC[8] = { 'G', 'T', 'E', 'X', '\r', '\n', '\x1a', '\n' };
+	const uint32_t FILE_VERSION = 2;
+
+	// every level starts on this many bytes.
+	const size_t LEVEL_ALIGNMENT = 16;
+
+	struct FileHeader
+	{
+		char mMagic[8];
+		uint32_t mVersion;
+		uint32_t mInternalFormat;
+		uint32_t mFormat;
+		uint32_t mType;
+		uint32_t mLevelCount;
+		uint32_t mReserved;
+		uint64_t mContentHash;
+	};
+
+	// the level table follows the header.
+	struct FileLevel
+	{
+		uint32_t mWidth;
+		uint32_t mHeight;
+		uint64_t mOffset;
+		uint64_t mSize;
+	};
+
+	size_t alignLevel(size_t pOffset)
+	{
+		return (pOffset + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+	}
+}
+
+void uploadTextureLevels(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels)
+{
+	// uncompressed small levels have rows of any byte count.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t level = 0; level < pLevels.size(); level++)
+	{
+		const TextureLevelData & data = pLevels[level];
+		if (pFormat.mFormat == 0)
+		{
+			glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), pFormat.mInternalFormat, data.mWidth,
+				data.mHeight, 0, static_cast<GLsizei>(data.mSize), data.mData);
+		}
+		else
+		{
+			glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), pFormat.mInternalFormat, data.mWidth, data.mHeight,
+				0, pFormat.mFormat, pFormat.mType, data.mData);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+TextureFile::TextureFile() : mData(NULL), mSize(0), mContentHash(0)
+#ifdef _WIN32
+	, mFile(INVALID_HANDLE_VALUE), mMapping(NULL)
+#endif
+{
+	mFormat.mInternalFormat = 0;
+	mFormat.mFormat = 0;
+	mFormat.mType = 0;
+}
+
+TextureFile::~TextureFile()
+{
+	close();
+}
+
+bool TextureFile::open(const char *pPath, const char *pSourcePath)
+{
+	close();
+
+	struct stat fileStat, sourceStat;
+	if (stat(pPath, &fileStat) != 0 || stat(pSourcePath, &sourceStat) != 0 || fileStat.st_mtime < sourceStat.st_mtime)
+	{
+		return false;
+	}
+	const size_t size = static_cast<size_t>(fileStat.st_size);
+	if (size < sizeof(FileHeader))
+	{
+		return false;
+	}
+
+#ifdef _WIN32
+	mFile = CreateFileA(pPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mMapping)
+	{
+		mData = static_cast<const unsigned char *>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	}
+#else
+	const int file = ::open(pPath, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (mapping != MAP_FAILED)
+	{
+		mData = static_cast<const unsigned char *>(mapping);
+	}
+#endif
+	if (!mData)
+	{
+		close();
+		return false;
+	}
+	mSize = size;
+
+	FileHeader header;
+	memcpy(&header, mData, sizeof(header));
+	const size_t tableEnd = sizeof(FileHeader) + static_cast<size_t>(header.mLevelCount) * sizeof(FileLevel);
+	if (memcmp(header.mMagic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.mVersion != FILE_VERSION
+		|| header.mLevelCount == 0 || tableEnd > mSize)
+	{
+		close();
+		return false;
+	}
+	mFormat.mInternalFormat = header.mInternalFormat;
+	mFormat.mFormat = header.mFormat;
+	mFormat.mType = header.mType;
+	mContentHash = header.mContentHash;
+
+	for (uint32_t i = 0; i < header.mLevelCount; i++)
+	{
+		FileLevel level;
+		memcpy(&level, mData + sizeof(FileHeader) + i * sizeof(FileLevel), sizeof(level));
+		if (level.mOffset > mSize || level.mSize > mSize - level.mOffset)
+		{
+			close();
+			return false;
+		}
+		TextureLevelData data;
+		data.mWidth = static_cast<int>(level.mWidth);
+		data.mHeight = static_cast<int>(level.mHeight);
+		data.mData = mData + level.mOffset;
+		data.mSize = static_cast<size_t>(level.mSize);
+		mLevels.push_back(data);
+	}
+	return true;
+}
+
+void TextureFile::close()
+{
+#ifdef _WIN32
+	if (mData)
+	{
+		UnmapViewOfFile(mData);
+	}
+	if (mMapping)
+	{
+		CloseHandle(mMapping);
+		mMapping = NULL;
+	}
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (mData)
+	{
+		munmap(const_cast<unsigned char *>(mData), mSize);
+	}
+#endif
+	mData = NULL;
+	mSize = 0;
+	mContentHash = 0;
+	mLevels.clear();
+}
+
+bool TextureFile::write(const char *pPath, const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels,
+	uint64_t pContentHash)
+{
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.mMagic, FILE_MAGIC, sizeof(FILE_MAGIC));
+	header.mVersion = FILE_VERSION;
+	header.mInternalFormat = pFormat.mInternalFormat;
+	header.mFormat = pFormat.mFormat;
+	header.mType = pFormat.mType;
+	header.mLevelCount = static_cast<uint32_t>(pLevels.size());
+	header.mContentHash = pContentHash;
+
+	std::vector<FileLevel> table(pLevels.size());
+	size_t offset = alignLevel(sizeof(FileHeader) + table.size() * sizeof(FileLevel));
+	for (size_t i = 0; i < pLevels.size(); i++)
+	{
+		table[i].mWidth = static_cast<uint32_t>(pLevels[i].mWidth);
+		table[i].mHeight = static_cast<uint32_t>(pLevels[i].mHeight);
+		table[i].mOffset = offset;
+		table[i].mSize = pLevels[i].mSize;
+		offset = alignLevel(offset + pLevels[i].mSize);
+	}
+
+	FILE *file = fopen(pPath, "wb");
+	if (!file)
+	{
+		return false;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	written = written && (table.empty() || fwrite(&table[0], sizeof(FileLevel), table.size(), file) == table.size());
+	const char padding[LEVEL_ALIGNMENT] = { 0 };
+	size_t position = sizeof(FileHeader) + table.size() * sizeof(FileLevel);
+	for (size_t i = 0; i < pLevels.size() && written; i++)
+	{
+		const size_t pad = static_cast<size_t>(table[i].mOffset) - position;
+		written = (pad == 0 || fwrite(padding, 1, pad, file) == pad)
+			&& fwrite(pLevels[i].mData, 1, pLevels[i].mSize, file) == pLevels[i].mSize;
+		position = static_cast<size_t>(table[i].mOffset) + pLevels[i].mSize;
+	}
+	written = fclose(file) == 0 && written;
+	if (!written)
+	{
+		// a half written file would be taken for a fresh one next time.
+		remove(pPath);
+	}
+	return written;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "preh.h"
+#include <stdint.h>
+#include <vector>
+
+// the gl format of the levels. mFormat and mType are 0 for compressed
+// levels, which go through glCompressedTexImage2D.
+struct TextureFormat
+{
+	GLenum mInternalFormat;
+	GLenum mFormat;
+	GLenum mType;
+};
+
+struct TextureLevelData
+{
+	int mWidth;
+	int mHeight;
+	const unsigned char *mData;
+	size_t mSize;
+};
+
+// upload every level to the texture bound to GL_TEXTURE_2D.
+void uploadTextureLevels(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels);
+
+// a file of gpu ready texture levels (oriented, swizzled, mip mapped and
+// compressed), written next to the source image the first time it loads.
+// later runs map it and upload the levels straight from the mapping.
+class TextureFile
+{
+public:
+	TextureFile();
+	~TextureFile();
+
+	// map pPath. false if it is missing, older than pSourcePath or damaged.
+	bool open(const char *pPath, const char *pSourcePath);
+	void close();
+
+	const TextureFormat & getFormat() const { return mFormat; }
+	// the data points into the mapping, valid until close.
+	const std::vector<TextureLevelData> & getLevels() const { return mLevels; }
+	// hash of the source pixels the levels were made from.
+	uint64_t getContentHash() const { return mContentHash; }
+
+	static bool write(const char *pPath, const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels,
+		uint64_t pContentHash);
+
+private:
+	TextureFile(const TextureFile &);
+	TextureFile & operator=(const TextureFile &);
+
+	const unsigned char *mData;
+	size_t mSize;
+#ifdef _WIN32
+	void *mFile;
+	void *mMapping;
+#endif
+	TextureFormat mFormat;
+	uint64_t mContentHash;
+	std::vector<TextureLevelData> mLevels;
+};
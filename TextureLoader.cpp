@@ -0,0 +1,1078 @@
+#include "TextureLoader.h"
+#include "WorkerPool.h"
+#include "GLStateCache.h"
+#include "MipGenerator.h"
+#include "Etc2Encoder.h"
+#include "targa.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace
+{
+	// the gpu ready levels of a.tga are kept in a.tga.gtex.
+	const char *TEXTURE_FILE_EXTENSION = ".gtex";
+
+	const unsigned char PLACEHOLDER_PIXEL[3] = { 255, 255, 255 };
+	const GLfloat IDENTITY_UV_TRANSFORM[4] = { 1.0f, 1.0f, 0.0f, 0.0f };
+
+	const uint64_t HASH_MULTIPLIER_0 = 0x87c37b91114253d5ULL;
+	const uint64_t HASH_MULTIPLIER_1 = 0x4cf5ad432745937fULL;
+
+	bool isTga(const std::string & pPath)
+	{
+		if (pPath.size() < 3)
+		{
+			return false;
+		}
+		std::string extension = pPath.substr(pPath.size() - 3);
+		for (size_t i = 0; i < extension.size(); i++)
+		{
+			extension[i] = static_cast<char>(toupper(extension[i]));
+		}
+		return extension == "TGA";
+	}
+
+	uint64_t mixHash(uint64_t pHash)
+	{
+		pHash ^= pHash >> 33;
+		pHash *= 0xff51afd7ed558ccdULL;
+		pHash ^= pHash >> 33;
+		pHash *= 0xc4ceb9fe1a85ec53ULL;
+		pHash ^= pHash >> 33;
+		return pHash;
+	}
+
+	// eight bytes a step, the image size is part of the hash.
+	uint64_t hashPixels(const unsigned char *pPixels, int pWidth, int pHeight, int pChannels)
+	{
+		const size_t size = static_cast<size_t>(pWidth) * pHeight * pChannels;
+		uint64_t hash = mixHash((static_cast<uint64_t>(pWidth) << 32) ^ (static_cast<uint64_t>(pHeight) << 8)
+			^ static_cast<uint64_t>(pChannels));
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, pPixels + i, sizeof(word));
+			word *= HASH_MULTIPLIER_0;
+			word = (word << 31) | (word >> 33);
+			hash ^= word * HASH_MULTIPLIER_1;
+			hash = ((hash << 27) | (hash >> 37)) * 5 + 0x52dce729;
+		}
+		uint64_t tail = 0;
+		for (; i < size; i++)
+		{
+			tail = (tail << 8) | pPixels[i];
+		}
+		return mixHash(hash ^ tail ^ size);
+	}
+
+	// orders the textures by what an array layer must match.
+	bool isKindBefore(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels,
+		const TextureFormat & pOtherFormat, const std::vector<TextureLevelData> & pOtherLevels)
+	{
+		if (pFormat.mInternalFormat != pOtherFormat.mInternalFormat)
+		{
+			return pFormat.mInternalFormat < pOtherFormat.mInternalFormat;
+		}
+		if (pLevels[0].mWidth != pOtherLevels[0].mWidth)
+		{
+			return pLevels[0].mWidth < pOtherLevels[0].mWidth;
+		}
+		if (pLevels[0].mHeight != pOtherLevels[0].mHeight)
+		{
+			return pLevels[0].mHeight < pOtherLevels[0].mHeight;
+		}
+		return pLevels.size() < pOtherLevels.size();
+	}
+}
+
+bool TextureLoader::FileIdentity::operator<(const FileIdentity & pOther) const
+{
+	if (mDevice != pOther.mDevice)
+	{
+		return mDevice < pOther.mDevice;
+	}
+	if (mInode != pOther.mInode)
+	{
+		return mInode < pOther.mInode;
+	}
+	if (mSize != pOther.mSize)
+	{
+		return mSize < pOther.mSize;
+	}
+	return mTime < pOther.mTime;
+}
+
+TextureLoader::TextureLoader(WorkerPool *pWorkerPool, GLStateCache *pGLState)
+	: mWorkerPool(pWorkerPool), mGLState(pGLState), mAtlas(pGLState), mArrays(pGLState),
+	mNextTexture(0),
+	mRequestCount(0), mFileShareCount(0), mContentShareCount(0), mStatisticsPending(false), mBudget(0), mFrame(0)
+{
+	memset(&mStreamingStatistics, 0, sizeof(mStreamingStatistics));
+}
+
+TextureLoader::~TextureLoader()
+{
+	mWorkerPool->wait();
+	for (size_t i = 0; i < mJobs.size(); i++)
+	{
+		if (mJobs[i]->mBuffer)
+		{
+			mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, mJobs[i]->mBuffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			mGLState->deleteBuffers(1, &mJobs[i]->mBuffer);
+		}
+		delete mJobs[i];
+	}
+	// the atlas and the arrays delete their textures.
+	for (std::map<int, Texture>::iterator it = mTextures.begin(); it != mTextures.end(); ++it)
+	{
+		for (size_t i = 0; i < it->second.mHandles.size(); i++)
+		{
+			delete it->second.mHandles[i];
+		}
+		if (it->second.mTile.mPage < 0 && it->second.mLayer.mArray < 0)
+		{
+			mGLState->deleteTextures(1, &it->second.mName);
+		}
+	}
+}
+
+bool TextureLoader::getFileIdentity(const std::string & pPath, FileIdentity & pIdentity)
+{
+#ifdef _WIN32
+	// the volume serial number and file index play device and inode.
+	const HANDLE file = CreateFileA(pPath.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	BY_HANDLE_FILE_INFORMATION information;
+	const bool found = GetFileInformationByHandle(file, &information) != 0
+		&& (information.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0;
+	CloseHandle(file);
+	if (!found)
+	{
+		return false;
+	}
+	pIdentity.mDevice = static_cast<unsigned long long>(information.dwVolumeSerialNumber);
+	pIdentity.mInode = (static_cast<unsigned long long>(information.nFileIndexHigh) << 32) | information.nFileIndexLow;
+	pIdentity.mSize = static_cast<long long>((static_cast<unsigned long long>(information.nFileSizeHigh) << 32)
+		| information.nFileSizeLow);
+	pIdentity.mTime = static_cast<long long>(
+		(static_cast<unsigned long long>(information.ftLastWriteTime.dwHighDateTime) << 32)
+		| information.ftLastWriteTime.dwLowDateTime);
+	return true;
+#else
+	struct stat fileStat;
+	if (stat(pPath.c_str(), &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+	{
+		return false;
+	}
+	pIdentity.mDevice = static_cast<unsigned long long>(fileStat.st_dev);
+	pIdentity.mInode = static_cast<unsigned long long>(fileStat.st_ino);
+	pIdentity.mSize = static_cast<long long>(fileStat.st_size);
+	pIdentity.mTime = static_cast<long long>(fileStat.st_mtime);
+	return true;
+#endif
+}
+
+const TextureHandle *TextureLoader::request(const std::vector<std::string> & pCandidates, bool pAtlasAllowed)
+{
+	++mRequestCount;
+	mStatisticsPending = true;
+
+	// the first file that exists is the one the worker would load.
+	FileIdentity identity;
+	bool identified = false;
+	for (size_t i = 0; i < pCandidates.size() && !identified; i++)
+	{
+		identified = getFileIdentity(pCandidates[i], identity);
+	}
+	if (identified)
+	{
+		// a released texture only waits for its job to come back, it gets a new one.
+		std::map<FileIdentity, int>::const_iterator found = mFiles.find(identity);
+		bool shared = found != mFiles.end() && !mTextures[found->second].mHandles.empty();
+		if (shared && !pAtlasAllowed)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			shared = keepOutOfAtlas(found->second);
+		}
+		if (shared)
+		{
+			Texture & texture = mTextures[found->second];
+			TextureHandle *handle = new TextureHandle;
+			handle->mName = texture.mName;
+			memcpy(handle->mUVTransform, texture.mUVTransform, sizeof(handle->mUVTransform));
+			handle->mLayer = texture.mLayer.mArray >= 0 ? texture.mLayer.mLayer : -1;
+			handle->mTexture = found->second;
+			texture.mHandles.push_back(handle);
+			++mFileShareCount;
+			return handle;
+		}
+	}
+
+	const int id = mNextTexture++;
+	Texture & texture = mTextures[id];
+	glGenTextures(1, &texture.mName);
+	mGLState->bindTexture(GL_TEXTURE_2D, texture.mName);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	// the levels go into this texture later, the uvs outside the image repeat it.
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, PLACEHOLDER_PIXEL);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	memcpy(texture.mUVTransform, IDENTITY_UV_TRANSFORM, sizeof(texture.mUVTransform));
+	texture.mTile.mPage = -1;
+	texture.mLayer.mArray = -1;
+	texture.mHashed = false;
+	texture.mContentHash = 0;
+	texture.mSize = 0;
+	texture.mUploadSeconds = 0.0;
+	texture.mStreamed = false;
+	texture.mTailLevel = 0;
+	texture.mBaseLevel = 0;
+	texture.mRequestedLevel = 0;
+	texture.mLastUsed = -1;
+	texture.mStreaming = false;
+	if (identified)
+	{
+		// a request that repeats takes the file over from a texture in the atlas.
+		texture.mFiles.push_back(identity);
+		mFiles[identity] = id;
+	}
+
+	TextureHandle *handle = new TextureHandle;
+	handle->mName = texture.mName;
+	memcpy(handle->mUVTransform, texture.mUVTransform, sizeof(handle->mUVTransform));
+	handle->mLayer = -1;
+	handle->mTexture = id;
+	texture.mHandles.push_back(handle);
+
+	Job *job = createJob(id, pCandidates);
+	job->mAtlasAllowed = pAtlasAllowed;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(job);
+	}
+	mWorkerPool->submit([this, job]() { decode(job); });
+	return handle;
+}
+
+TextureLoader::Job *TextureLoader::createJob(int pTexture, const std::vector<std::string> & pCandidates)
+{
+	Job *job = new Job;
+	job->mTexture = pTexture;
+	job->mCandidates = pCandidates;
+	job->mAtlasAllowed = false;
+	job->mState = STATE_DECODING;
+	job->mReleased = false;
+	job->mContentHash = 0;
+	job->mTile.mPage = -1;
+	job->mGrouped = false;
+	job->mLayer.mArray = -1;
+	job->mStreamIn = false;
+	job->mBaseLevel = 0;
+	job->mKeepTail = false;
+	job->mBuffer = 0;
+	job->mMapped = NULL;
+	return job;
+}
+
+void TextureLoader::release(const TextureHandle *pHandle)
+{
+	const int id = pHandle->mTexture;
+	std::map<int, Texture>::iterator found = mTextures.find(id);
+	if (found == mTextures.end())
+	{
+		cout << "error: unknown texture handle " << id << endl;
+		return;
+	}
+	std::vector<TextureHandle *> & handles = found->second.mHandles;
+	handles.erase(std::remove(handles.begin(), handles.end(), pHandle), handles.end());
+	delete pHandle;
+	if (!handles.empty())
+	{
+		return;
+	}
+
+	// a job still on it drops the texture when it comes back.
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (size_t i = 0; i < mJobs.size(); i++)
+		{
+			if (mJobs[i]->mTexture == id)
+			{
+				mJobs[i]->mReleased = true;
+				return;
+			}
+		}
+	}
+	deleteTexture(id);
+}
+
+void TextureLoader::deleteTexture(int pTexture)
+{
+	std::map<int, Texture>::iterator found = mTextures.find(pTexture);
+	const Texture & texture = found->second;
+	for (size_t i = 0; i < texture.mFiles.size(); i++)
+	{
+		// a later texture of the file may have taken it over.
+		std::map<FileIdentity, int>::iterator file = mFiles.find(texture.mFiles[i]);
+		if (file != mFiles.end() && file->second == pTexture)
+		{
+			mFiles.erase(file);
+		}
+	}
+	if (texture.mHashed)
+	{
+		std::map<uint64_t, int>::iterator content = mContents.find(texture.mContentHash);
+		if (content != mContents.end() && content->second == pTexture)
+		{
+			mContents.erase(content);
+		}
+	}
+	if (texture.mTile.mPage >= 0)
+	{
+		mAtlas.release(texture.mTile);
+	}
+	else if (texture.mLayer.mArray >= 0)
+	{
+		mArrays.release(texture.mLayer);
+	}
+	else
+	{
+		mGLState->deleteTextures(1, &texture.mName);
+	}
+	mTextures.erase(found);
+}
+
+void TextureLoader::setName(Texture & pTexture, GLuint pName, const GLfloat *pUVTransform, GLint pLayer)
+{
+	pTexture.mName = pName;
+	memcpy(pTexture.mUVTransform, pUVTransform, sizeof(pTexture.mUVTransform));
+	for (size_t i = 0; i < pTexture.mHandles.size(); i++)
+	{
+		pTexture.mHandles[i]->mName = pName;
+		memcpy(pTexture.mHandles[i]->mUVTransform, pUVTransform, sizeof(pTexture.mUVTransform));
+		pTexture.mHandles[i]->mLayer = pLayer;
+	}
+}
+
+GLuint TextureLoader::createTexture(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels)
+{
+	GLuint name = 0;
+	glGenTextures(1, &name);
+	mGLState->bindTexture(GL_TEXTURE_2D, name);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(pLevels.size()) - 1);
+	uploadTextureLevels(pFormat, pLevels);
+	return name;
+}
+
+bool TextureLoader::goesToAtlas(const Job *pJob)
+{
+	return pJob->mAtlasAllowed && TextureAtlas::accepts(pJob->mFormat, pJob->mLevels);
+}
+
+bool TextureLoader::isStreamed(const std::vector<TextureLevelData> & pLevels) const
+{
+	return isStreaming() && getTailLevel(pLevels) > 0;
+}
+
+int TextureLoader::getTailLevel(const std::vector<TextureLevelData> & pLevels)
+{
+	int level = 0;
+	while (level + 1 < static_cast<int>(pLevels.size())
+		&& std::max(pLevels[level].mWidth, pLevels[level].mHeight) > RESIDENT_SIZE)
+	{
+		++level;
+	}
+	return level;
+}
+
+size_t TextureLoader::getLevelBytes(const std::vector<TextureLevelData> & pLevels, int pFirstLevel)
+{
+	size_t size = 0;
+	for (size_t level = pFirstLevel; level < pLevels.size(); level++)
+	{
+		size += pLevels[level].mSize;
+	}
+	return size;
+}
+
+int TextureLoader::getPendingCount() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return static_cast<int>(mJobs.size());
+}
+
+void TextureLoader::setState(Job *pJob, State pState)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	pJob->mState = pState;
+}
+
+void TextureLoader::decode(Job *pJob)
+{
+	for (size_t i = 0; i < pJob->mCandidates.size(); i++)
+	{
+		if (decodeFile(pJob, pJob->mCandidates[i]))
+		{
+			pJob->mPath = pJob->mCandidates[i];
+			setState(pJob, STATE_DECODED);
+			return;
+		}
+	}
+	setState(pJob, STATE_FAILED);
+}
+
+bool TextureLoader::decodeFile(Job *pJob, const std::string & pPath)
+{
+	if (!isTga(pPath))
+	{
+		return false;
+	}
+
+	// a texture file newer than the tga holds the finished levels.
+	const std::string texturePath = pPath + TEXTURE_FILE_EXTENSION;
+	if (pJob->mFile.open(texturePath.c_str(), pPath.c_str()))
+	{
+		pJob->mFormat = pJob->mFile.getFormat();
+		pJob->mLevels = pJob->mFile.getLevels();
+		pJob->mContentHash = pJob->mFile.getContentHash();
+		return true;
+	}
+
+	tga_image tgaImage;
+	if (tga_read(&tgaImage, pPath.c_str()) != TGA_NOERR)
+	{
+		return false;
+	}
+
+	if (tga_is_right_to_left(&tgaImage))
+	{
+		tga_flip_horiz(&tgaImage);
+	}
+
+	if (tga_is_top_to_bottom(&tgaImage))
+	{
+		tga_flip_vert(&tgaImage);
+	}
+
+	tga_convert_depth(&tgaImage, 24);
+
+	// tga stores bgr.
+	tga_swap_red_blue(&tgaImage);
+
+	pJob->mContentHash = hashPixels(tgaImage.image_data, tgaImage.width, tgaImage.height, 3);
+
+	// the color textures are averaged in linear space.
+	std::vector<MipLevel> mipLevels;
+	generateMipChain(tgaImage.image_data, tgaImage.width, tgaImage.height, 3, true, MIP_FILTER_KAISER,
+		mWorkerPool, mipLevels);
+
+	// every level goes to the gpu as etc2 blocks.
+	std::vector<std::vector<unsigned char> > & blocks = pJob->mStorage;
+	blocks.resize(mipLevels.size() + 1);
+	const std::chrono::steady_clock::time_point encodeStart = std::chrono::steady_clock::now();
+	encodeEtc2(tgaImage.image_data, tgaImage.width, tgaImage.height, 3, ETC2_QUALITY_FAST, mWorkerPool, blocks[0]);
+	for (size_t level = 0; level < mipLevels.size(); level++)
+	{
+		const MipLevel & mip = mipLevels[level];
+		encodeEtc2(&mip.mPixels[0], mip.mWidth, mip.mHeight, 3, ETC2_QUALITY_FAST, mWorkerPool, blocks[level + 1]);
+	}
+	const double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeStart).count();
+	const double psnr = measureEtc2PSNR(tgaImage.image_data, &blocks[0][0], tgaImage.width, tgaImage.height, 3);
+
+	pJob->mLevels.resize(blocks.size());
+	size_t pixelCount = 0;
+	size_t compressedSize = 0;
+	for (size_t level = 0; level < blocks.size(); level++)
+	{
+		TextureLevelData & data = pJob->mLevels[level];
+		data.mWidth = level == 0 ? tgaImage.width : mipLevels[level - 1].mWidth;
+		data.mHeight = level == 0 ? tgaImage.height : mipLevels[level - 1].mHeight;
+		data.mData = &blocks[level][0];
+		data.mSize = blocks[level].size();
+		pixelCount += static_cast<size_t>(data.mWidth) * data.mHeight;
+		compressedSize += data.mSize;
+	}
+	pJob->mFormat.mInternalFormat = getEtc2Format(3);
+	pJob->mFormat.mFormat = 0;
+	pJob->mFormat.mType = 0;
+
+	cout << "etc2: " << pPath << " " << tgaImage.width << "x" << tgaImage.height << ", "
+		<< pJob->mLevels.size() << " levels, " << pixelCount / 1000000.0 / std::max(encodeSeconds, 1e-6)
+		<< " mpix/s, psnr " << psnr << " db, " << pixelCount * 3 / 1024 << " -> " << compressedSize / 1024 << " kb" << endl;
+
+	if (!TextureFile::write(texturePath.c_str(), pJob->mFormat, pJob->mLevels, pJob->mContentHash))
+	{
+		cout << "error: cannot write texture file " << texturePath << endl;
+	}
+
+	tga_free_buffers(&tgaImage);
+	return true;
+}
+
+void TextureLoader::copy(Job *pJob)
+{
+	if (pJob->mTile.mPage >= 0)
+	{
+		TextureAtlas::padTile(pJob->mLevels, pJob->mTile, pJob->mMapped);
+	}
+	else
+	{
+		unsigned char *target = pJob->mMapped;
+		for (size_t level = pJob->mBaseLevel; level < pJob->mLevels.size(); level++)
+		{
+			const TextureLevelData & data = pJob->mLevels[level];
+			memcpy(target, data.mData, data.mSize);
+			target += data.mSize;
+			// the mapping is write only.
+			if (pJob->mKeepTail)
+			{
+				pJob->mTail.insert(pJob->mTail.end(), data.mData, data.mData + data.mSize);
+			}
+		}
+	}
+	pJob->mFile.close();
+	std::vector<std::vector<unsigned char> >().swap(pJob->mStorage);
+	setState(pJob, STATE_COPIED);
+}
+
+bool TextureLoader::shareDuplicate(Job *pJob)
+{
+	std::map<uint64_t, int>::const_iterator found = mContents.find(pJob->mContentHash);
+	if (found == mContents.end())
+	{
+		Texture & texture = mTextures[pJob->mTexture];
+		texture.mHashed = true;
+		texture.mContentHash = pJob->mContentHash;
+		mContents[pJob->mContentHash] = pJob->mTexture;
+		return false;
+	}
+
+	// registered on an earlier frame that had no buffer left for it.
+	if (found->second == pJob->mTexture)
+	{
+		return false;
+	}
+
+	// released and waiting for its own job to come back.
+	Texture & original = mTextures[found->second];
+	if (original.mHandles.empty())
+	{
+		return false;
+	}
+
+	// uvs outside the image would sample the neighbours of an atlas tile.
+	if (!pJob->mAtlasAllowed && !keepOutOfAtlas(found->second))
+	{
+		return false;
+	}
+
+	Texture & duplicate = mTextures[pJob->mTexture];
+	for (size_t i = 0; i < duplicate.mHandles.size(); i++)
+	{
+		TextureHandle *handle = duplicate.mHandles[i];
+		handle->mName = original.mName;
+		memcpy(handle->mUVTransform, original.mUVTransform, sizeof(handle->mUVTransform));
+		handle->mLayer = original.mLayer.mArray >= 0 ? original.mLayer.mLayer : -1;
+		handle->mTexture = found->second;
+		original.mHandles.push_back(handle);
+	}
+	for (size_t i = 0; i < duplicate.mFiles.size(); i++)
+	{
+		mFiles[duplicate.mFiles[i]] = found->second;
+		original.mFiles.push_back(duplicate.mFiles[i]);
+	}
+	duplicate.mHandles.clear();
+	duplicate.mFiles.clear();
+	deleteTexture(pJob->mTexture);
+	++mContentShareCount;
+	return true;
+}
+
+bool TextureLoader::keepOutOfAtlas(int pTexture)
+{
+	if (mTextures[pTexture].mTile.mPage >= 0)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < mJobs.size(); i++)
+	{
+		Job *job = mJobs[i];
+		if (job->mTexture == pTexture && !job->mStreamIn)
+		{
+			if (job->mTile.mPage >= 0)
+			{
+				return false;
+			}
+			job->mAtlasAllowed = false;
+		}
+	}
+	return true;
+}
+
+void TextureLoader::groupLayers()
+{
+	std::vector<Job *> jobs;
+	for (size_t i = 0; i < mJobs.size(); i++)
+	{
+		Job *job = mJobs[i];
+		if (job->mState != STATE_DECODED || job->mGrouped)
+		{
+			continue;
+		}
+		job->mGrouped = true;
+		if (!goesToAtlas(job) && TextureArray::accepts(job->mFormat, job->mLevels) && !isStreamed(job->mLevels))
+		{
+			jobs.push_back(job);
+		}
+	}
+
+	std::sort(jobs.begin(), jobs.end(), [](const Job *pJob, const Job *pOther)
+	{
+		return isKindBefore(pJob->mFormat, pJob->mLevels, pOther->mFormat, pOther->mLevels);
+	});
+	std::vector<TextureArray::Layer> layers;
+	for (size_t first = 0; first < jobs.size();)
+	{
+		size_t last = first + 1;
+		while (last < jobs.size()
+			&& !isKindBefore(jobs[first]->mFormat, jobs[first]->mLevels, jobs[last]->mFormat, jobs[last]->mLevels))
+		{
+			++last;
+		}
+		// the ones left without a layer keep a texture of their own.
+		layers.resize(last - first);
+		const int count = mArrays.allocate(jobs[first]->mFormat, jobs[first]->mLevels, static_cast<int>(last - first), &layers[0]);
+		for (int i = 0; i < count; i++)
+		{
+			jobs[first + i]->mLayer = layers[i];
+		}
+		first = last;
+	}
+}
+
+void TextureLoader::mapBuffer(Job *pJob)
+{
+	size_t size = 0;
+	if (!pJob->mStreamIn && goesToAtlas(pJob)
+		&& mAtlas.allocate(pJob->mLevels[0].mWidth, pJob->mLevels[0].mHeight, pJob->mTile))
+	{
+		size = TextureAtlas::getTileSize(pJob->mTile);
+	}
+	else
+	{
+		// a streamed texture starts with the levels that always stay.
+		if (!pJob->mStreamIn && pJob->mLayer.mArray < 0 && isStreamed(pJob->mLevels))
+		{
+			pJob->mBaseLevel = getTailLevel(pJob->mLevels);
+			pJob->mKeepTail = true;
+		}
+		size = getLevelBytes(pJob->mLevels, pJob->mBaseLevel);
+	}
+
+	glGenBuffers(1, &pJob->mBuffer);
+	mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, pJob->mBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	pJob->mMapped = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!pJob->mMapped)
+	{
+		cout << "error: cannot map the pixel buffer of " << pJob->mPath << endl;
+		mGLState->deleteBuffers(1, &pJob->mBuffer);
+		pJob->mBuffer = 0;
+		if (pJob->mTile.mPage >= 0)
+		{
+			mAtlas.release(pJob->mTile);
+			pJob->mTile.mPage = -1;
+		}
+		if (pJob->mLayer.mArray >= 0)
+		{
+			mArrays.release(pJob->mLayer);
+			pJob->mLayer.mArray = -1;
+		}
+		pJob->mState = STATE_FAILED;
+		return;
+	}
+
+	pJob->mState = STATE_COPYING;
+	mWorkerPool->submit([this, pJob]() { copy(pJob); });
+}
+
+void TextureLoader::upload(Job *pJob)
+{
+	const std::chrono::steady_clock::time_point uploadStart = std::chrono::steady_clock::now();
+	mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, pJob->mBuffer);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	pJob->mMapped = NULL;
+
+	Texture & texture = mTextures[pJob->mTexture];
+	size_t size = 0;
+	if (pJob->mTile.mPage >= 0)
+	{
+		mAtlas.upload(pJob->mTile);
+		size = TextureAtlas::getTileSize(pJob->mTile);
+
+		// the placeholder is not needed any more.
+		mGLState->deleteTextures(1, &texture.mName);
+		GLfloat transform[4];
+		TextureAtlas::getUVTransform(pJob->mTile, transform);
+		texture.mTile = pJob->mTile;
+		setName(texture, mAtlas.getPageTexture(pJob->mTile.mPage), transform, -1);
+	}
+	else
+	{
+		// with the buffer bound the level pointers are offsets into it.
+		std::vector<TextureLevelData> levels(pJob->mLevels.begin() + pJob->mBaseLevel, pJob->mLevels.end());
+		for (size_t level = 0; level < levels.size(); level++)
+		{
+			levels[level].mData = reinterpret_cast<const unsigned char *>(size);
+			size += levels[level].mSize;
+		}
+
+		if (pJob->mLayer.mArray >= 0)
+		{
+			mArrays.upload(pJob->mLayer, levels);
+			mGLState->deleteTextures(1, &texture.mName);
+			texture.mLayer = pJob->mLayer;
+			setName(texture, mArrays.getArrayTexture(pJob->mLayer.mArray), IDENTITY_UV_TRANSFORM, pJob->mLayer.mLayer);
+		}
+		else if (pJob->mStreamIn)
+		{
+			// a new texture, the driver keeps every level a texture ever had.
+			const GLuint name = createTexture(pJob->mFormat, levels);
+			mGLState->deleteTextures(1, &texture.mName);
+			setName(texture, name, IDENTITY_UV_TRANSFORM, -1);
+			texture.mBaseLevel = pJob->mBaseLevel;
+			texture.mStreaming = false;
+			++mStreamingStatistics.mStreamCount;
+		}
+		else
+		{
+			mGLState->bindTexture(GL_TEXTURE_2D, texture.mName);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels.size()) - 1);
+			uploadTextureLevels(pJob->mFormat, levels);
+		}
+
+		if (pJob->mKeepTail)
+		{
+			texture.mStreamed = true;
+			texture.mPath = pJob->mPath;
+			texture.mFormat = pJob->mFormat;
+			texture.mLevels = pJob->mLevels;
+			for (size_t level = 0; level < texture.mLevels.size(); level++)
+			{
+				texture.mLevels[level].mData = NULL;
+			}
+			texture.mTailLevel = pJob->mBaseLevel;
+			texture.mBaseLevel = pJob->mBaseLevel;
+			texture.mTail.swap(pJob->mTail);
+		}
+	}
+
+	// other uploads must not read from the buffer.
+	mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	mGLState->deleteBuffers(1, &pJob->mBuffer);
+	pJob->mBuffer = 0;
+
+	texture.mSize = size;
+	if (!pJob->mStreamIn)
+	{
+		texture.mUploadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - uploadStart).count();
+	}
+}
+
+void TextureLoader::update()
+{
+	int mapped = 0;
+	int uploaded = 0;
+	bool decoding = false;
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (size_t i = 0; i < mJobs.size();)
+	{
+		Job *job = mJobs[i];
+		const bool finished = job->mState == STATE_DECODED || job->mState == STATE_COPIED || job->mState == STATE_FAILED;
+		if (job->mReleased && finished)
+		{
+			if (job->mBuffer)
+			{
+				mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, job->mBuffer);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				mGLState->deleteBuffers(1, &job->mBuffer);
+			}
+			if (job->mTile.mPage >= 0)
+			{
+				mAtlas.release(job->mTile);
+			}
+			if (job->mLayer.mArray >= 0)
+			{
+				mArrays.release(job->mLayer);
+			}
+			deleteTexture(job->mTexture);
+			delete job;
+			mJobs.erase(mJobs.begin() + i);
+			continue;
+		}
+
+		if (job->mState == STATE_DECODED && job->mStreamIn
+			&& job->mLevels.size() != mTextures[job->mTexture].mLevels.size())
+		{
+			// the file changed since the first load.
+			job->mState = STATE_FAILED;
+		}
+
+		if (job->mState == STATE_DECODED && !job->mStreamIn && shareDuplicate(job))
+		{
+			cout << "texture shared: " << job->mPath << endl;
+			if (job->mLayer.mArray >= 0)
+			{
+				mArrays.release(job->mLayer);
+			}
+			delete job;
+			mJobs.erase(mJobs.begin() + i);
+			continue;
+		}
+
+		if (job->mState == STATE_DECODED && (job->mGrouped || goesToAtlas(job)) && mapped < MAX_TEXTURES_PER_FRAME)
+		{
+			mapBuffer(job);
+			++mapped;
+		}
+		else if (job->mState == STATE_COPIED && uploaded < MAX_TEXTURES_PER_FRAME)
+		{
+			upload(job);
+			++uploaded;
+			if (!job->mStreamIn)
+			{
+				cout << "texture loaded: " << job->mPath << (job->mTile.mPage >= 0 ? " (atlas)" : "")
+					<< (job->mLayer.mArray >= 0 ? " (array)" : "") << (job->mKeepTail ? " (streamed)" : "") << endl;
+			}
+			delete job;
+			mJobs.erase(mJobs.begin() + i);
+			continue;
+		}
+
+		if (job->mState == STATE_FAILED)
+		{
+			// the placeholder or the resident levels stay.
+			cout << "failed to load texture file: " << job->mCandidates[0] << endl;
+			if (job->mStreamIn)
+			{
+				mTextures[job->mTexture].mStreaming = false;
+			}
+			delete job;
+			mJobs.erase(mJobs.begin() + i);
+			continue;
+		}
+		decoding = decoding || (job->mState == STATE_DECODING && !job->mStreamIn);
+		++i;
+	}
+
+	if (!decoding)
+	{
+		groupLayers();
+	}
+	if (isStreaming())
+	{
+		stream();
+	}
+
+	if (mJobs.empty() && mStatisticsPending)
+	{
+		mStatisticsPending = false;
+		printStatistics();
+	}
+}
+
+void TextureLoader::requestLevel(const TextureHandle *pHandle, float pUVPerPixel)
+{
+	std::map<int, Texture>::iterator found = mTextures.find(pHandle->mTexture);
+	if (found == mTextures.end())
+	{
+		return;
+	}
+	Texture & texture = found->second;
+	int level = 0;
+	if (texture.mStreamed)
+	{
+		// a pixel spans this many texels of level 0, every level halves it.
+		const float texels = pUVPerPixel * std::max(texture.mLevels[0].mWidth, texture.mLevels[0].mHeight);
+		level = texels > 1.0f ? static_cast<int>(floor(log2(texels))) : 0;
+		level = std::min(level, static_cast<int>(texture.mLevels.size()) - 1);
+	}
+	if (texture.mLastUsed != mFrame)
+	{
+		texture.mLastUsed = mFrame;
+		texture.mRequestedLevel = level;
+	}
+	else
+	{
+		texture.mRequestedLevel = std::min(texture.mRequestedLevel, level);
+	}
+}
+
+void TextureLoader::stream()
+{
+	// the draws since the last update asked in this frame.
+	const int usedFrame = mFrame++;
+
+	StreamingStatistics & statistics = mStreamingStatistics;
+	statistics.mResidentBytes = 0;
+	statistics.mRequestedBytes = 0;
+	statistics.mUsedCount = 0;
+	statistics.mMissCount = 0;
+	// levels missing and texture, the textures furthest from their level first.
+	std::vector<std::pair<int, int> > candidates;
+	// last use and texture, the least recently used first.
+	std::vector<std::pair<int, int> > victims;
+	size_t freeable = 0;
+	for (std::map<int, Texture>::const_iterator it = mTextures.begin(); it != mTextures.end(); ++it)
+	{
+		const Texture & texture = it->second;
+		statistics.mResidentBytes += texture.mSize;
+		if (texture.mLastUsed == usedFrame)
+		{
+			++statistics.mUsedCount;
+			statistics.mRequestedBytes += texture.mStreamed ? getLevelBytes(texture.mLevels, texture.mRequestedLevel)
+				: texture.mSize;
+			if (texture.mStreamed && texture.mBaseLevel > texture.mRequestedLevel)
+			{
+				++statistics.mMissCount;
+				if (!texture.mStreaming)
+				{
+					candidates.push_back(std::make_pair(texture.mBaseLevel - texture.mRequestedLevel, it->first));
+				}
+			}
+		}
+		else if (texture.mStreamed && !texture.mStreaming && texture.mBaseLevel < texture.mTailLevel)
+		{
+			victims.push_back(std::make_pair(texture.mLastUsed, it->first));
+			freeable += texture.mSize - texture.mTail.size();
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), std::greater<std::pair<int, int> >());
+	std::sort(victims.begin(), victims.end());
+
+	// the levels still on their way count as resident.
+	size_t used = statistics.mResidentBytes;
+	for (size_t i = 0; i < mJobs.size(); i++)
+	{
+		const Job *job = mJobs[i];
+		if (job->mStreamIn && !job->mReleased)
+		{
+			const Texture & texture = mTextures[job->mTexture];
+			used += getLevelBytes(texture.mLevels, job->mBaseLevel) - texture.mSize;
+		}
+	}
+
+	size_t victim = 0;
+	for (size_t i = 0; i < candidates.size() && i < MAX_TEXTURES_PER_FRAME; i++)
+	{
+		const int id = candidates[i].second;
+		Texture & texture = mTextures[id];
+
+		// the finest level the budget has room for, after the evictions.
+		int level = texture.mRequestedLevel;
+		size_t cost = getLevelBytes(texture.mLevels, level) - texture.mSize;
+		while (level < texture.mBaseLevel && used + cost > mBudget + freeable)
+		{
+			++level;
+			cost = getLevelBytes(texture.mLevels, level) - texture.mSize;
+		}
+		if (level == texture.mBaseLevel)
+		{
+			continue;
+		}
+		while (used + cost > mBudget)
+		{
+			Texture & evicted = mTextures[victims[victim++].second];
+			const size_t freed = evicted.mSize - evicted.mTail.size();
+			evict(evicted);
+			used -= freed;
+			freeable -= freed;
+		}
+		used += cost;
+
+		Job *job = createJob(id, std::vector<std::string>(1, texture.mPath));
+		job->mGrouped = true;
+		job->mStreamIn = true;
+		job->mBaseLevel = level;
+		texture.mStreaming = true;
+		// update() holds the lock.
+		mJobs.push_back(job);
+		mWorkerPool->submit([this, job]() { decode(job); });
+	}
+}
+
+void TextureLoader::evict(Texture & pTexture)
+{
+	// the levels come from the copy on the cpu, not from a buffer.
+	mGLState->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	std::vector<TextureLevelData> levels(pTexture.mLevels.begin() + pTexture.mTailLevel, pTexture.mLevels.end());
+	const unsigned char *data = &pTexture.mTail[0];
+	for (size_t level = 0; level < levels.size(); level++)
+	{
+		levels[level].mData = data;
+		data += levels[level].mSize;
+	}
+	const GLuint name = createTexture(pTexture.mFormat, levels);
+	mGLState->deleteTextures(1, &pTexture.mName);
+	setName(pTexture, name, IDENTITY_UV_TRANSFORM, -1);
+	pTexture.mBaseLevel = pTexture.mTailLevel;
+	pTexture.mSize = pTexture.mTail.size();
+	++mStreamingStatistics.mEvictionCount;
+}
+
+void TextureLoader::printStreamingStatistics() const
+{
+	const StreamingStatistics & statistics = mStreamingStatistics;
+	cout << "texture streaming: " << statistics.mResidentBytes / 1024 << " of " << mBudget / 1024 << " kb resident, "
+		<< statistics.mRequestedBytes / 1024 << " kb requested, " << statistics.mMissCount << " of "
+		<< statistics.mUsedCount << " used textures too coarse ("
+		<< (statistics.mUsedCount ? 100.0 * statistics.mMissCount / statistics.mUsedCount : 0.0) << "%), "
+		<< statistics.mStreamCount << " streamed in, " << statistics.mEvictionCount << " evicted" << endl;
+}
+
+void TextureLoader::printStatistics() const
+{
+	// without sharing every handle would have had its own texture.
+	size_t size = 0;
+	size_t unsharedSize = 0;
+	double seconds = 0.0;
+	double unsharedSeconds = 0.0;
+	for (std::map<int, Texture>::const_iterator it = mTextures.begin(); it != mTextures.end(); ++it)
+	{
+		const Texture & texture = it->second;
+		size += texture.mSize;
+		unsharedSize += texture.mSize * texture.mHandles.size();
+		seconds += texture.mUploadSeconds;
+		unsharedSeconds += texture.mUploadSeconds * texture.mHandles.size();
+	}
+	cout << "textures: " << mRequestCount << " requests, " << mTextures.size() << " textures, "
+		<< mFileShareCount << " shared by file, " << mContentShareCount << " shared by content, "
+		<< unsharedSize / 1024 << " -> " << size / 1024 << " kb, upload "
+		<< unsharedSeconds * 1000.0 << " -> " << seconds * 1000.0 << " ms, "
+		<< mAtlas.getTileCount() << " in " << mAtlas.getPageCount() << " atlas pages, "
+		<< mArrays.getLayerCount() << " in " << mArrays.getArrayCount() << " texture arrays" << endl;
+}
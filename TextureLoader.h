@@ -0,0 +1,222 @@
+#pragma once
+#include "preh.h"
+#include "TextureFile.h"
+#include "TextureAtlas.h"
+#include "TextureArray.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class WorkerPool;
+class GLStateCache;
+
+// what the users of a texture keep. the loader changes it when the texture
+// arrives, is shared with another or moves to an atlas page or array layer.
+struct TextureHandle
+{
+	GLuint mName;		// a GL_TEXTURE_2D_ARRAY if mLayer is not -1
+	// scale and offset from the uvs of the mesh to the uvs of mName.
+	GLfloat mUVTransform[4];
+	GLint mLayer;
+	int mTexture;		// of the loader
+};
+
+// loads the scene textures without blocking the gl thread. every request
+// gets a texture handle right away, a 1x1 white placeholder until the data
+// arrives. the workers find the file, map its texture file or decode, mip
+// map and compress the tga, then copy the levels into a pixel unpack
+// buffer the gl thread mapped for them. update() uploads a few finished
+// textures per frame from those buffers.
+//
+// requests for the same image share one texture: the same file (device,
+// inode, size and time) is found at request time, the same pixels under
+// another file by their content hash once decoded. the handles of a
+// duplicate are then pointed to the first texture and the duplicate deleted.
+// a request that does not allow the atlas never shares an atlas tile.
+//
+// small textures whose uvs stay inside the image go to the atlas instead
+// of a texture of their own. the others are grouped by size, format and
+// levels into texture arrays. the groups are only known once the textures
+// of the scene are decoded, so these textures wait for the last decode.
+//
+// with a memory budget the textures of their own larger than RESIDENT_SIZE
+// stream: only the levels up to RESIDENT_SIZE load at first and stay. the
+// draws ask for the finest level they need every frame, update() loads
+// those levels again from the texture file into a new texture, and drops
+// the least recently used textures back to their resident levels when the
+// budget is full. such textures do not go to arrays.
+class TextureLoader
+{
+public:
+	// textures mapped and textures uploaded per update.
+	enum { MAX_TEXTURES_PER_FRAME = 2 };
+	// levels with no side above this always stay resident.
+	enum { RESIDENT_SIZE = 64 };
+
+	struct StreamingStatistics
+	{
+		size_t mResidentBytes;
+		// what the textures used in the last frame take at the level they asked for.
+		size_t mRequestedBytes;
+		int mUsedCount;			// textures used in the last frame
+		int mMissCount;			// of those, the ones coarser than they asked for
+		int mStreamCount;		// finer levels loaded, since the start
+		int mEvictionCount;		// textures dropped to their resident levels, since the start
+	};
+
+	TextureLoader(WorkerPool *pWorkerPool, GLStateCache *pGLState);
+	// waits for the workers and deletes every texture. the gl context must still be current.
+	~TextureLoader();
+
+	// pCandidates are tried in order, the first that loads wins. the handle
+	// is valid until it is released.
+	const TextureHandle *request(const std::vector<std::string> & pCandidates, bool pAtlasAllowed);
+	// the texture goes when its last handle does.
+	void release(const TextureHandle *pHandle);
+
+	// the bytes all the textures may take, 0 for no streaming (the default).
+	// set it before the first request.
+	void setBudget(size_t pBytes) { mBudget = pBytes; }
+	bool isStreaming() const { return mBudget != 0; }
+
+	// a draw of this frame samples the texture with pUVPerPixel uv units per pixel.
+	void requestLevel(const TextureHandle *pHandle, float pUVPerPixel);
+
+	// gl thread, once per frame.
+	void update();
+
+	int getPendingCount() const;
+
+	void printStatistics() const;
+	const StreamingStatistics & getStreamingStatistics() const { return mStreamingStatistics; }
+	void printStreamingStatistics() const;
+
+private:
+	enum State
+	{
+		STATE_DECODING,		// on a worker
+		STATE_DECODED,		// levels on the cpu, waiting for a buffer
+		STATE_COPYING,		// on a worker, copying into the mapped buffer
+		STATE_COPIED,		// waiting for the upload
+		STATE_FAILED,
+	};
+
+	struct Job
+	{
+		int mTexture;
+		std::vector<std::string> mCandidates;
+		bool mAtlasAllowed;
+		State mState;
+		bool mReleased;		// every handle went before the upload
+		std::string mPath;
+		TextureFormat mFormat;
+		uint64_t mContentHash;
+		// point into mStorage or into mFile.
+		std::vector<TextureLevelData> mLevels;
+		std::vector<std::vector<unsigned char> > mStorage;
+		TextureFile mFile;
+		TextureAtlas::Tile mTile;
+		bool mGrouped;		// the array layers were handed out, mLayer may still be none
+		TextureArray::Layer mLayer;
+		// the finer levels of a streamed texture that is already loaded.
+		bool mStreamIn;
+		// levels before it are not uploaded.
+		int mBaseLevel;
+		// the first load of a streamed texture keeps its resident levels on the cpu.
+		bool mKeepTail;
+		std::vector<unsigned char> mTail;
+		GLuint mBuffer;
+		unsigned char *mMapped;
+	};
+
+	struct FileIdentity
+	{
+		unsigned long long mDevice;
+		unsigned long long mInode;
+		long long mSize;
+		long long mTime;
+
+		bool operator<(const FileIdentity & pOther) const;
+	};
+
+	struct Texture
+	{
+		GLuint mName;
+		GLfloat mUVTransform[4];
+		TextureAtlas::Tile mTile;
+		TextureArray::Layer mLayer;
+		std::vector<TextureHandle *> mHandles;
+		std::vector<FileIdentity> mFiles;
+		bool mHashed;
+		uint64_t mContentHash;
+		size_t mSize;		// resident bytes
+		double mUploadSeconds;
+
+		bool mStreamed;
+		std::string mPath;		// what the stream jobs load again
+		TextureFormat mFormat;
+		// every level, without data.
+		std::vector<TextureLevelData> mLevels;
+		int mTailLevel;			// the first level that always stays
+		std::vector<unsigned char> mTail;
+		int mBaseLevel;			// the finest level resident
+		int mRequestedLevel;	// the finest level a draw of mLastUsed asked for
+		int mLastUsed;			// frame, -1 for never
+		bool mStreaming;		// a stream job is on it
+	};
+
+	// a job with nothing decided yet.
+	static Job *createJob(int pTexture, const std::vector<std::string> & pCandidates);
+
+	// worker side.
+	void decode(Job *pJob);
+	bool decodeFile(Job *pJob, const std::string & pPath);
+	void copy(Job *pJob);
+	void setState(Job *pJob, State pState);
+
+	// gl side.
+	bool shareDuplicate(Job *pJob);
+	// a texture still loading does not go to the atlas any more, false if it
+	// already has a tile. the caller holds mMutex.
+	bool keepOutOfAtlas(int pTexture);
+	// array layers for the decoded textures, once no texture is decoding.
+	void groupLayers();
+	// statistics of the frame that just ended, then the stream jobs and the evictions.
+	void stream();
+	// back to the resident levels, from the copy on the cpu.
+	void evict(Texture & pTexture);
+	GLuint createTexture(const TextureFormat & pFormat, const std::vector<TextureLevelData> & pLevels);
+	bool isStreamed(const std::vector<TextureLevelData> & pLevels) const;
+	void mapBuffer(Job *pJob);
+	void upload(Job *pJob);
+	void deleteTexture(int pTexture);
+	// the name, uv transform and layer go to every handle of the texture.
+	void setName(Texture & pTexture, GLuint pName, const GLfloat *pUVTransform, GLint pLayer);
+
+	static bool goesToAtlas(const Job *pJob);
+	static int getTailLevel(const std::vector<TextureLevelData> & pLevels);
+	static size_t getLevelBytes(const std::vector<TextureLevelData> & pLevels, int pFirstLevel);
+	static bool getFileIdentity(const std::string & pPath, FileIdentity & pIdentity);
+
+	WorkerPool *mWorkerPool;
+	GLStateCache *mGLState;
+	TextureAtlas mAtlas;
+	TextureArray mArrays;
+	std::vector<Job *> mJobs;
+	mutable std::mutex mMutex;
+
+	std::map<int, Texture> mTextures;
+	std::map<FileIdentity, int> mFiles;
+	std::map<uint64_t, int> mContents;
+	int mNextTexture;
+
+	int mRequestCount;
+	int mFileShareCount;
+	int mContentShareCount;
+	bool mStatisticsPending;
+
+	size_t mBudget;
+	int mFrame;
+	StreamingStatistics mStreamingStatistics;
+};
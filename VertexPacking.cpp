@@ -0,0 +1,159 @@
+#include "VertexPacking.h"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	const float POSITION_SCALE = 65535.0f;
+	const float NORMAL_SCALE = 511.0f;
+	const double RADIANS_TO_DEGREES = 57.295779513082321;
+
+	inline int signExtend10(GLuint pValue)
+	{
+		return (pValue & 0x200) ? static_cast<int>(pValue) - 0x400 : static_cast<int>(pValue);
+	}
+}
+
+GLushort floatToHalf(float pValue)
+{
+	unsigned int bits;
+	memcpy(&bits, &pValue, sizeof(bits));
+	const unsigned int sign = (bits >> 16) & 0x8000;
+	const int exponent = static_cast<int>((bits >> 23) & 0xFF) - 127 + 15;
+	unsigned int mantissa = bits & 0x7FFFFF;
+
+	if ((bits & 0x7FFFFFFF) >= 0x7F800000)
+	{
+		// infinity stays infinity, nan stays a nan.
+		return static_cast<GLushort>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	}
+	if (exponent >= 31)
+	{
+		return static_cast<GLushort>(sign | 0x7C00);
+	}
+	if (exponent <= 0)
+	{
+		// denormal half, or zero below half of the smallest one.
+		if (exponent < -10)
+		{
+			return static_cast<GLushort>(sign);
+		}
+		mantissa |= 0x800000;
+		const int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		const unsigned int rest = mantissa & ((1u << shift) - 1);
+		const unsigned int halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+		{
+			++half;
+		}
+		return static_cast<GLushort>(sign | half);
+	}
+
+	// round to nearest even, a carry into the exponent is still right.
+	unsigned int half = (static_cast<unsigned int>(exponent) << 10) | (mantissa >> 13);
+	const unsigned int rest = mantissa & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+	{
+		++half;
+	}
+	return static_cast<GLushort>(sign | half);
+}
+
+float halfToFloat(GLushort pValue)
+{
+	const int exponent = (pValue >> 10) & 0x1F;
+	const int mantissa = pValue & 0x3FF;
+	float value;
+	if (exponent == 0)
+	{
+		value = std::ldexp(static_cast<float>(mantissa), -24);
+	}
+	else if (exponent == 31)
+	{
+		value = mantissa ? NAN : INFINITY;
+	}
+	else
+	{
+		value = std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+	}
+	return (pValue & 0x8000) ? -value : value;
+}
+
+GLuint packNormal(const GLfloat *pNormal)
+{
+	const float length = std::sqrt(pNormal[0] * pNormal[0] + pNormal[1] * pNormal[1] + pNormal[2] * pNormal[2]);
+	const float scale = length > 0.0f ? NORMAL_SCALE / length : 0.0f;
+	GLuint packed = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		const int value = static_cast<int>(std::floor(pNormal[i] * scale + 0.5f));
+		packed |= (static_cast<GLuint>(std::max(-511, std::min(511, value))) & 0x3FF) << (i * 10);
+	}
+	return packed;
+}
+
+void unpackNormal(GLuint pPacked, GLfloat *pNormal)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		pNormal[i] = std::max(-1.0f, signExtend10((pPacked >> (i * 10)) & 0x3FF) / NORMAL_SCALE);
+	}
+}
+
+void packVertices(const GLfloat *pPositions, const GLfloat *pNormals, const GLfloat *pUVs, int pCount,
+	const GLfloat *pBoundsMin, const GLfloat *pBoundsMax, PackedVertex *pPacked, PackingError & pError)
+{
+	pError.mPosition = 0.0f;
+	pError.mNormalDegrees = 0.0f;
+	pError.mUV = 0.0f;
+
+	float extent[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		extent[axis] = pBoundsMax[axis] - pBoundsMin[axis];
+	}
+
+	for (int i = 0; i < pCount; i++)
+	{
+		PackedVertex & vertex = pPacked[i];
+		const GLfloat *position = pPositions + i * 4;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float t = extent[axis] > 0.0f ? (position[axis] - pBoundsMin[axis]) / extent[axis] : 0.0f;
+			const int value = static_cast<int>(std::floor(t * POSITION_SCALE + 0.5f));
+			vertex.mPosition[axis] = static_cast<GLushort>(std::max(0, std::min(65535, value)));
+			const float decoded = pBoundsMin[axis] + vertex.mPosition[axis] / POSITION_SCALE * extent[axis];
+			pError.mPosition = std::max(pError.mPosition, std::fabs(decoded - position[axis]));
+		}
+		vertex.mPosition[3] = 65535;
+
+		vertex.mNormal = 0;
+		if (pNormals)
+		{
+			const GLfloat *normal = pNormals + i * 3;
+			vertex.mNormal = packNormal(normal);
+			GLfloat decoded[3];
+			unpackNormal(vertex.mNormal, decoded);
+			const double lengths = std::sqrt((normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2])
+				* (decoded[0] * decoded[0] + decoded[1] * decoded[1] + decoded[2] * decoded[2]));
+			if (lengths > 0.0)
+			{
+				const double cosine = (normal[0] * decoded[0] + normal[1] * decoded[1] + normal[2] * decoded[2]) / lengths;
+				const double degrees = std::acos(std::max(-1.0, std::min(1.0, cosine))) * RADIANS_TO_DEGREES;
+				pError.mNormalDegrees = std::max(pError.mNormalDegrees, static_cast<float>(degrees));
+			}
+		}
+
+		vertex.mUV[0] = 0;
+		vertex.mUV[1] = 0;
+		if (pUVs)
+		{
+			for (int k = 0; k < 2; k++)
+			{
+				vertex.mUV[k] = floatToHalf(pUVs[i * 2 + k]);
+				pError.mUV = std::max(pError.mUV, std::fabs(halfToFloat(vertex.mUV[k]) - pUVs[i * 2 + k]));
+			}
+		}
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "preh.h"
+
+// 16 byte interleaved vertex. the position is unsigned normalized 16 bit
+// against the bounds of the mesh with w = 1, so min + q * extent (folded
+// into the model matrix) gives it back. the normal is signed normalized
+// 10_10_10_2 and the uv two half floats, both read by the vertex fetch as
+// they are.
+struct PackedVertex
+{
+	GLushort mPosition[4];
+	GLuint mNormal;
+	GLushort mUV[2];
+};
+
+// largest difference between the packed and the original attributes.
+struct PackingError
+{
+	float mPosition;		// object space units
+	float mNormalDegrees;
+	float mUV;
+};
+
+GLushort floatToHalf(float pValue);
+float halfToFloat(GLushort pValue);
+
+// GL_INT_2_10_10_10_REV, w = 0.
+GLuint packNormal(const GLfloat *pNormal);
+void unpackNormal(GLuint pPacked, GLfloat *pNormal);
+
+// pPositions has 4 floats per vertex, pNormals 3 and pUVs 2, both may be NULL.
+// the positions must lie inside [pBoundsMin, pBoundsMax].
+void packVertices(const GLfloat *pPositions, const GLfloat *pNormals, const GLfloat *pUVs, int pCount,
+	const GLfloat *pBoundsMin, const GLfloat *pBoundsMax, PackedVertex *pPacked, PackingError & pError);
@@ -0,0 +1,110 @@
+#include "VertexWelder.h"
+
+namespace
+{
+	const int NORMAL_STRIDE = 3;
+	const int UV_STRIDE = 2;
+	// position, normal, uv and control point.
+	const int KEY_FLOATS = 9;
+
+	struct VertexKey
+	{
+		unsigned int mBits[KEY_FLOATS];
+
+		bool operator==(const VertexKey & pOther) const
+		{
+			return memcmp(mBits, pOther.mBits, sizeof(mBits)) == 0;
+		}
+	};
+
+	VertexKey makeKey(const GLfloat *pPositions, int pPositionStride, const GLfloat *pNormals, const GLfloat *pUVs,
+		const GLuint *pControlPoints, int pVertex)
+	{
+		VertexKey key;
+		memset(&key, 0, sizeof(key));
+		memcpy(key.mBits, pPositions + pVertex * pPositionStride, 3 * sizeof(GLfloat));
+		if (pNormals)
+		{
+			memcpy(key.mBits + 3, pNormals + pVertex * NORMAL_STRIDE, NORMAL_STRIDE * sizeof(GLfloat));
+		}
+		if (pUVs)
+		{
+			memcpy(key.mBits + 6, pUVs + pVertex * UV_STRIDE, UV_STRIDE * sizeof(GLfloat));
+		}
+		if (pControlPoints)
+		{
+			key.mBits[8] = pControlPoints[pVertex];
+		}
+		return key;
+	}
+
+	unsigned int hashKey(const VertexKey & pKey)
+	{
+		unsigned int hash = 2166136261u;
+		for (int i = 0; i < KEY_FLOATS; i++)
+		{
+			hash = (hash ^ pKey.mBits[i]) * 16777619u;
+			hash ^= hash >> 15;
+		}
+		return hash;
+	}
+}
+
+int weldVertices(GLfloat *pPositions, int pPositionStride, GLfloat *pNormals, GLfloat *pUVs,
+	const GLuint *pControlPoints, int pVertexCount, GLuint *pIndices, int pIndexCount, std::vector<int> & pSource)
+{
+	// open addressing, at most half full.
+	int tableSize = 1;
+	while (tableSize < pVertexCount * 2)
+	{
+		tableSize <<= 1;
+	}
+	std::vector<int> table(tableSize, -1);
+
+	// original vertex -> merged vertex.
+	std::vector<int> merged(pVertexCount);
+	std::vector<VertexKey> keys;
+	keys.reserve(pVertexCount);
+	pSource.clear();
+	for (int vertex = 0; vertex < pVertexCount; vertex++)
+	{
+		const VertexKey key = makeKey(pPositions, pPositionStride, pNormals, pUVs, pControlPoints, vertex);
+		unsigned int slot = hashKey(key) & (tableSize - 1);
+		while (table[slot] >= 0 && !(keys[table[slot]] == key))
+		{
+			slot = (slot + 1) & (tableSize - 1);
+		}
+		if (table[slot] < 0)
+		{
+			table[slot] = static_cast<int>(keys.size());
+			keys.push_back(key);
+			pSource.push_back(vertex);
+		}
+		merged[vertex] = table[slot];
+	}
+	for (int i = 0; i < pIndexCount; i++)
+	{
+		pIndices[i] = static_cast<GLuint>(merged[pIndices[i]]);
+	}
+
+	// pSource is increasing, so moving down in place never overwrites a vertex still to be read.
+	const int count = static_cast<int>(pSource.size());
+	for (int i = 0; i < count; i++)
+	{
+		const int source = pSource[i];
+		if (source == i)
+		{
+			continue;
+		}
+		memmove(pPositions + i * pPositionStride, pPositions + source * pPositionStride, pPositionStride * sizeof(GLfloat));
+		if (pNormals)
+		{
+			memmove(pNormals + i * NORMAL_STRIDE, pNormals + source * NORMAL_STRIDE, NORMAL_STRIDE * sizeof(GLfloat));
+		}
+		if (pUVs)
+		{
+			memmove(pUVs + i * UV_STRIDE, pUVs + source * UV_STRIDE, UV_STRIDE * sizeof(GLfloat));
+		}
+	}
+	return count;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "preh.h"
+#include <vector>
+
+// merge the vertices whose position, normal and uv are bitwise equal.
+// the arrays are compacted in place, keeping their order, and pIndices is
+// rewritten to the merged vertices. pNormals (3 floats) and pUVs (2 floats)
+// may be NULL. with pControlPoints only the vertices of the same control
+// point merge, skinned meshes need it to keep the weights of every corner.
+// pSource gets, for every merged vertex, the original vertex it was taken
+// from. returns the merged vertex count.
+int weldVertices(GLfloat *pPositions, int pPositionStride, GLfloat *pNormals, GLfloat *pUVs,
+	const GLuint *pControlPoints, int pVertexCount, GLuint *pIndices, int pIndexCount, std::vector<int> & pSource);
@@ -0,0 +1,161 @@
+#include "WorkerPool.h"
+#include <atomic>
+#include <memory>
+
+namespace
+{
+	// shared by the calling thread and the helper tasks of one parallelFor.
+	// helpers may still be queued when the caller returns, so it is ref counted.
+	struct ParallelForState
+	{
+		std::function<void(int, int)> mFunc;
+		std::atomic<int> mNextChunk;
+		std::atomic<int> mDoneChunks;
+		int mChunkCount;
+		int mChunkSize;
+		int mCount;
+		std::mutex mMutex;
+		std::condition_variable mFinished;
+
+		void run()
+		{
+			int chunk;
+			while ((chunk = mNextChunk.fetch_add(1)) < mChunkCount)
+			{
+				const int begin = chunk * mChunkSize;
+				const int end = begin + mChunkSize < mCount ? begin + mChunkSize : mCount;
+				mFunc(begin, end);
+				if (mDoneChunks.fetch_add(1) + 1 == mChunkCount)
+				{
+					std::lock_guard<std::mutex> lock(mMutex);
+					mFinished.notify_all();
+				}
+			}
+		}
+	};
+}
+
+WorkerPool::WorkerPool(int pThreadCount) : mPendingCount(0), mStopping(false)
+{
+	if (pThreadCount <= 0)
+	{
+		pThreadCount = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+		if (pThreadCount < 1)
+		{
+			pThreadCount = 1;
+		}
+	}
+
+	for (int i = 0; i < pThreadCount; i++)
+	{
+		mThreads.push_back(std::thread(&WorkerPool::workerLoop, this));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mTaskReady.notify_all();
+	for (size_t i = 0; i < mThreads.size(); i++)
+	{
+		mThreads[i].join();
+	}
+}
+
+void WorkerPool::submit(const std::function<void()>& pTask)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTasks.push_back(pTask);
+		++mPendingCount;
+	}
+	mTaskReady.notify_one();
+}
+
+void WorkerPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (mPendingCount > 0)
+	{
+		mTaskDone.wait(lock);
+	}
+}
+
+void WorkerPool::parallelFor(int pCount, int pGrain, const std::function<void(int, int)>& pFunc)
+{
+	if (pCount <= 0)
+	{
+		return;
+	}
+	if (pGrain < 1)
+	{
+		pGrain = 1;
+	}
+
+	const int workerCount = getThreadCount() + 1;
+	int chunkSize = (pCount + workerCount - 1) / workerCount;
+	if (chunkSize < pGrain)
+	{
+		chunkSize = pGrain;
+	}
+	const int chunkCount = (pCount + chunkSize - 1) / chunkSize;
+	if (chunkCount == 1)
+	{
+		pFunc(0, pCount);
+		return;
+	}
+
+	std::shared_ptr<ParallelForState> state(new ParallelForState);
+	state->mFunc = pFunc;
+	state->mNextChunk = 0;
+	state->mDoneChunks = 0;
+	state->mChunkCount = chunkCount;
+	state->mChunkSize = chunkSize;
+	state->mCount = pCount;
+
+	// the calling thread works too, so a nested call from a worker
+	// can never wait on chunks that nobody picks up.
+	for (int i = 0; i < chunkCount - 1 && i < getThreadCount(); i++)
+	{
+		submit([state]() { state->run(); });
+	}
+	state->run();
+
+	std::unique_lock<std::mutex> lock(state->mMutex);
+	while (state->mDoneChunks.load() < chunkCount)
+	{
+		state->mFinished.wait(lock);
+	}
+}
+
+void WorkerPool::workerLoop()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			while (!mStopping && mTasks.empty())
+			{
+				mTaskReady.wait(lock);
+			}
+			if (mTasks.empty())
+			{
+				return;
+			}
+			task = mTasks.front();
+			mTasks.pop_front();
+		}
+
+		task();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			--mPendingCount;
+		}
+		mTaskDone.notify_all();
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "preh.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <deque>
+
+// a small fixed size thread pool for cpu side work (culling, mesh and
+// texture baking). tasks are plain functions, there is no future/result.
+class WorkerPool
+{
+public:
+	// 0 threads means one per hardware thread minus the calling thread.
+	WorkerPool(int pThreadCount = 0);
+	~WorkerPool();
+
+	int getThreadCount() const { return static_cast<int>(mThreads.size()); }
+
+	void submit(const std::function<void()> & pTask);
+
+	// block until every submitted task has finished.
+	void wait();
+
+	// split [0, pCount) into chunks of at least pGrain items and run
+	// pFunc(begin, end) on the workers and the calling thread. blocks.
+	void parallelFor(int pCount, int pGrain, const std::function<void(int, int)> & pFunc);
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> mThreads;
+	std::deque<std::function<void()> > mTasks;
+	std::mutex mMutex;
+	std::condition_variable mTaskReady;
+	std::condition_variable mTaskDone;
+	int mPendingCount;
+	bool mStopping;
+};
@@ -1,10 +1,22 @@
 #include "GameContext.h"
 #include "ShaderProgram.h"
 #include "SceneContext.h"
+#include "OcclusionCuller.h"
+#include "OcclusionQuery.h"
+#include "ScenePicker.h"
+#include "MeshletCuller.h"
+#include "RenderQueue.h"
+#include "GLStateCache.h"
+#include "StaticBatcher.h"
+#include "TextureLoader.h"
 
 const char * GAME_NAME = "MiniGame";
 const int DEFAULT_WINDOW_WIDTH = 480;
 const int DEFAULT_WINDOW_HEIGHT = 480;
+// "-texture-budget <mb>" streams the textures within that much memory, off by default.
+const char *TEXTURE_BUDGET_OPTION = "-texture-budget";
+// "-float-vertices" keeps every mesh in floats instead of the packed format.
+const char *FLOAT_VERTICES_OPTION = "-float-vertices";
 
 ///
 //  ESWindowProc()
@@ -231,6 +243,96 @@ void shutdown(GameContext *gameContext)
 	
 }
 
+void key(GameContext *gameContext, unsigned char key, int x, int y)
+{
+	switch (key)
+	{
+	case 'o':
+	{
+		// toggle the software occlusion culling and print what the last frame culled.
+		OcclusionCuller *occlusionCuller = gameContext->mOcclusionCuller;
+		occlusionCuller->printStatistics();
+		occlusionCuller->setEnabled(!occlusionCuller->isEnabled());
+		cout << "software occlusion culling " << (occlusionCuller->isEnabled() ? "on" : "off") << endl;
+	}
+	break;
+	case 'q':
+	{
+		// toggle the gpu occlusion queries.
+		OcclusionQuery *occlusionQuery = gameContext->mOcclusionQuery;
+		occlusionQuery->printStatistics();
+		occlusionQuery->setEnabled(!occlusionQuery->isEnabled());
+		cout << "occlusion queries " << (occlusionQuery->isEnabled() ? "on" : "off") << endl;
+	}
+	break;
+	case 'm':
+	{
+		// toggle the meshlet culling and print what the last frame culled.
+		MeshletCuller *meshletCuller = gameContext->mMeshletCuller;
+		meshletCuller->printStatistics();
+		meshletCuller->setEnabled(!meshletCuller->isEnabled());
+		cout << "meshlet culling " << (meshletCuller->isEnabled() ? "on" : "off") << endl;
+	}
+	break;
+	case 'r':
+	{
+		// state changes of the last frame, sorted and in scene order.
+		gameContext->mRenderQueue->printStatistics();
+	}
+	break;
+	case 'b':
+	{
+		// toggle the static batches and print what the last frame drew with them.
+		StaticBatcher *staticBatcher = gameContext->mStaticBatcher;
+		staticBatcher->printStatistics();
+		staticBatcher->setEnabled(!staticBatcher->isEnabled());
+		cout << "static batching " << (staticBatcher->isEnabled() ? "on" : "off") << endl;
+	}
+	break;
+	case 'g':
+	{
+		// gl calls the last frame issued and the ones the state cache dropped.
+		gameContext->mGLState->printStatistics();
+	}
+	break;
+	case 't':
+	{
+		// texture memory of the last frame against what its draws asked for.
+		gameContext->mTextureLoader->printStreamingStatistics();
+	}
+	break;
+	case 'p':
+	{
+		// what the cursor is over, picking works in client area pixels.
+		POINT point = { x, y };
+		ScreenToClient(gameContext->eglNativeWindow, &point);
+		gameContext->mScenePicker->printPick(gameContext, (float)point.x, (float)point.y);
+	}
+	break;
+	case 's':
+	{
+		// draw only the node under the cursor, or the whole scene again.
+		POINT point = { x, y };
+		ScreenToClient(gameContext->eglNativeWindow, &point);
+		PickResult result;
+		SceneContext *sceneContext = gameContext->mSceneContext;
+		if (!sceneContext->getSelectedNode()
+			&& gameContext->mScenePicker->pick(gameContext, (float)point.x, (float)point.y, result))
+		{
+			sceneContext->setSelectedNode(result.mNode);
+			cout << "selected " << result.mNode->GetName() << endl;
+		}
+		else
+		{
+			sceneContext->setSelectedNode(NULL);
+		}
+	}
+	break;
+	default:
+		break;
+	}
+}
+
 void winLoop(GameContext *gameContext)
 {
 	MSG msg = { 0 };
@@ -469,13 +571,26 @@ int main(int arc, char *argv[])
 	//const FbxString fileName("D:\\resource\\farm-life\\AllModels_Sepearated\\crops\\Apple.fbx");
 	//const FbxString fileName("F:\\resource\\farm-life\\AllModels_Sepearated\\Buildings\\Warehouse.fbx");
 	//const FbxString fileName("F:\\resource\\farm-life\\AllModels_Sepearated\\Map_7.fbx");
-	if (!gameContext.loadScene(fileName))
+	bool packVertices = true;
+	for (int i = 1; i < arc; i++)
+	{
+		if (strcmp(argv[i], TEXTURE_BUDGET_OPTION) == 0 && i + 1 < arc)
+		{
+			gameContext.mTextureLoader->setBudget(static_cast<size_t>(atoi(argv[i + 1])) * 1024 * 1024);
+		}
+		else if (strcmp(argv[i], FLOAT_VERTICES_OPTION) == 0)
+		{
+			packVertices = false;
+		}
+	}
+	if (!gameContext.loadScene(fileName, packVertices))
 	{
 		exit(1);
 	}
 	gameContext.drawFunc = draw;
 	gameContext.updateFunc = update;
 	gameContext.shutdownFunc = shutdown;
+	gameContext.keyFunc = key;
 	winLoop(&gameContext);
 
 	if (gameContext.shutdownFunc != NULL)
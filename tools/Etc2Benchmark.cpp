@@ -0,0 +1,178 @@
+// encoder throughput and quality of Etc2Encoder, on the cpu only. it encodes
+// a few generated reference images and the tga files given on the command
+// line with both presets, decodes them again with decodeEtc2 and prints
+// MPix/s and PSNR. it is a program of its own, not part of the game, built
+// with the include paths of the game (preh.h wants the fbx and gles headers):
+//
+//   g++ -O2 -std=c++11 -I. -include preh.h tools/Etc2Benchmark.cpp Etc2Encoder.cpp WorkerPool.cpp targa.cpp -pthread
+#include "Etc2Encoder.h"
+#include "WorkerPool.h"
+#include "targa.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace
+{
+	const int REFERENCE_SIZE = 512;
+	// every image is encoded again until this much time has passed.
+	const double MIN_SECONDS = 0.5;
+
+	struct Image
+	{
+		std::string mName;
+		int mWidth;
+		int mHeight;
+		int mChannels;
+		std::vector<unsigned char> mPixels;
+	};
+
+	unsigned int nextRandom(unsigned int & pState)
+	{
+		pState = pState * 1664525u + 1013904223u;
+		return pState >> 24;
+	}
+
+	// smooth gradients, noise, hard edges and a mix of them, where the
+	// modes of the encoder differ the most.
+	void createReferenceImages(std::vector<Image> & pImages)
+	{
+		const char *NAMES[] = { "gradient", "noise", "checker", "mixed", "mixed rgba" };
+		unsigned int random = 1;
+		for (int kind = 0; kind < 5; kind++)
+		{
+			Image image;
+			image.mName = NAMES[kind];
+			image.mWidth = REFERENCE_SIZE;
+			image.mHeight = REFERENCE_SIZE;
+			image.mChannels = kind == 4 ? 4 : 3;
+			image.mPixels.resize(REFERENCE_SIZE * REFERENCE_SIZE * image.mChannels);
+			for (int y = 0; y < REFERENCE_SIZE; y++)
+			{
+				for (int x = 0; x < REFERENCE_SIZE; x++)
+				{
+					unsigned char *pixel = &image.mPixels[(y * REFERENCE_SIZE + x) * image.mChannels];
+					for (int c = 0; c < 3; c++)
+					{
+						const double wave = 127.5 + 127.5 * sin((x * (c + 1) + y * (3 - c)) * 0.01);
+						const int checker = ((x / 16 + y / 16 + c) & 1) * 255;
+						int value = 0;
+						if (kind == 0)
+						{
+							value = static_cast<int>(wave);
+						}
+						else if (kind == 1)
+						{
+							value = static_cast<int>(nextRandom(random));
+						}
+						else if (kind == 2)
+						{
+							value = checker;
+						}
+						else
+						{
+							value = static_cast<int>(wave * 0.6 + checker * 0.3) + static_cast<int>(nextRandom(random) % 26);
+						}
+						pixel[c] = static_cast<unsigned char>(std::min(value, 255));
+					}
+					if (image.mChannels == 4)
+					{
+						pixel[3] = static_cast<unsigned char>((x + y) * 255 / (2 * REFERENCE_SIZE - 2));
+					}
+				}
+			}
+			pImages.push_back(image);
+		}
+	}
+
+	bool loadImage(const char *pPath, Image & pImage)
+	{
+		tga_image tgaImage;
+		if (tga_read(&tgaImage, pPath) != TGA_NOERR)
+		{
+			return false;
+		}
+		pImage.mChannels = tgaImage.pixel_depth == 32 ? 4 : 3;
+		tga_convert_depth(&tgaImage, static_cast<uint8_t>(pImage.mChannels * 8));
+		tga_swap_red_blue(&tgaImage);
+		pImage.mName = pPath;
+		pImage.mWidth = tgaImage.width;
+		pImage.mHeight = tgaImage.height;
+		pImage.mPixels.assign(tgaImage.image_data, tgaImage.image_data + pImage.mWidth * pImage.mHeight * pImage.mChannels);
+		tga_free_buffers(&tgaImage);
+		return true;
+	}
+
+	double measurePSNR(const std::vector<unsigned char> & pPixels, const std::vector<unsigned char> & pDecoded)
+	{
+		double sum = 0;
+		for (size_t i = 0; i < pPixels.size(); i++)
+		{
+			const double d = static_cast<double>(pDecoded[i]) - pPixels[i];
+			sum += d * d;
+		}
+		if (sum == 0)
+		{
+			return 99.0;
+		}
+		return 10.0 * log10(255.0 * 255.0 * pPixels.size() / sum);
+	}
+
+	// returns false if the workers wrote other blocks than a single thread.
+	bool benchmark(const Image & pImage, Etc2Quality pQuality, WorkerPool *pWorkerPool)
+	{
+		std::vector<unsigned char> blocks;
+		int runs = 0;
+		double seconds = 0.0;
+		while (seconds < MIN_SECONDS)
+		{
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			encodeEtc2(&pImage.mPixels[0], pImage.mWidth, pImage.mHeight, pImage.mChannels, pQuality, pWorkerPool, blocks);
+			seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			++runs;
+		}
+
+		std::vector<unsigned char> serialBlocks;
+		encodeEtc2(&pImage.mPixels[0], pImage.mWidth, pImage.mHeight, pImage.mChannels, pQuality, NULL, serialBlocks);
+		const bool same = serialBlocks == blocks;
+
+		std::vector<unsigned char> decoded(pImage.mPixels.size());
+		decodeEtc2(&blocks[0], pImage.mWidth, pImage.mHeight, pImage.mChannels, &decoded[0]);
+
+		const double pixels = static_cast<double>(pImage.mWidth) * pImage.mHeight * runs;
+		cout << pImage.mName << " " << pImage.mWidth << "x" << pImage.mHeight << (pImage.mChannels == 4 ? " rgba" : " rgb")
+			<< (pQuality == ETC2_QUALITY_FAST ? " fast: " : " high: ") << pixels / 1000000.0 / seconds << " mpix/s, psnr "
+			<< measurePSNR(pImage.mPixels, decoded) << " db" << (same ? "" : ", error: threads differ") << endl;
+		return same;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<Image> images;
+	createReferenceImages(images);
+	for (int i = 1; i < argc; i++)
+	{
+		Image image;
+		if (loadImage(argv[i], image))
+		{
+			images.push_back(image);
+		}
+		else
+		{
+			cout << "error: cannot read " << argv[i] << endl;
+		}
+	}
+
+	WorkerPool workerPool;
+	cout << "etc2 benchmark, " << workerPool.getThreadCount() + 1 << " threads" << endl;
+	bool same = true;
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		same = benchmark(images[i], ETC2_QUALITY_FAST, &workerPool) && same;
+		same = benchmark(images[i], ETC2_QUALITY_HIGH, &workerPool) && same;
+	}
+	return same ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// checks of the software depth buffer of the occlusion culler, on the cpu
+// only. it needs the gles headers but not the fbx sdk:
+//
+//   g++ -O2 -std=c++11 -I. tools/SoftwareDepthBufferTest.cpp SoftwareDepthBuffer.cpp
+//
+// prints one line per failed check and exits non-zero if there was one.
+#include "SoftwareDepthBuffer.h"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using std::cout;
+using std::endl;
+
+namespace
+{
+	const int WIDTH = 64;
+	const int HEIGHT = 48;
+	const int RANDOM_TRIANGLES = 200;
+	const int RANDOM_QUERIES = 2000;
+
+	int sFailures = 0;
+
+	void check(bool pPassed, const char *pWhat)
+	{
+		if (!pPassed)
+		{
+			cout << "error: " << pWhat << endl;
+			++sFailures;
+		}
+	}
+
+	unsigned int sRandom = 1;
+	float nextFloat(float pMin, float pMax)
+	{
+		sRandom = sRandom * 1664525u + 1013904223u;
+		return pMin + (pMax - pMin) * static_cast<float>(sRandom >> 8) / 16777216.0f;
+	}
+
+	void setVertex(float *pVertex, float pX, float pY, float pZ)
+	{
+		pVertex[0] = pX;
+		pVertex[1] = pY;
+		pVertex[2] = pZ;
+		pVertex[3] = 1.0f;
+	}
+
+	void render(SoftwareDepthBuffer & pBuffer, const std::vector<float> & pVertices, const std::vector<GLuint> & pIndices)
+	{
+		const int triangleCount = static_cast<int>(pIndices.size()) / 3;
+		std::vector<RasterTriangle> triangles(triangleCount);
+		pBuffer.setupTriangles(&pVertices[0], &pIndices[0], triangleCount, &triangles[0]);
+		pBuffer.rasterizeRows(&triangles[0], triangleCount, 0, pBuffer.getHeight());
+		pBuffer.buildHierarchy();
+	}
+
+	void testRejection(SoftwareDepthBuffer & pBuffer)
+	{
+		float vertices[5 * 4];
+		setVertex(vertices, -0.5f, -0.5f, 0.0f);
+		setVertex(vertices + 4, 0.5f, -0.5f, 0.0f);
+		setVertex(vertices + 8, 0.0f, 0.5f, 0.0f);
+		setVertex(vertices + 12, 0.0f, 0.5f, -2.0f);		// before the near plane
+		setVertex(vertices + 16, 5.0f, 5.0f, 0.0f);			// off screen
+		const GLuint indices[] = { 0, 1, 2, 0, 2, 1, 0, 1, 3, 4, 4, 4 };
+		RasterTriangle triangles[4];
+		const int accepted = pBuffer.setupTriangles(vertices, indices, 4, triangles);
+		check(accepted == 1, "one of the triangles is front facing and on screen");
+		check(!SoftwareDepthBuffer::isRejected(triangles[0]), "front face accepted");
+		check(SoftwareDepthBuffer::isRejected(triangles[1]), "back face rejected");
+		check(SoftwareDepthBuffer::isRejected(triangles[2]), "triangle crossing the near plane rejected");
+		check(SoftwareDepthBuffer::isRejected(triangles[3]), "degenerate triangle rejected");
+		for (int i = 1; i < 4; i++)
+		{
+			check(triangles[i].mMinY > triangles[i].mMaxY, "rejected triangles have no rows");
+		}
+	}
+
+	void testFullScreen(SoftwareDepthBuffer & pBuffer)
+	{
+		// a quad over the whole screen at depth 0.5.
+		std::vector<float> vertices(4 * 4);
+		setVertex(&vertices[0], -1.0f, -1.0f, 0.0f);
+		setVertex(&vertices[4], 1.0f, -1.0f, 0.0f);
+		setVertex(&vertices[8], 1.0f, 1.0f, 0.0f);
+		setVertex(&vertices[12], -1.0f, 1.0f, 0.0f);
+		const GLuint quad[] = { 0, 1, 2, 0, 2, 3 };
+		pBuffer.clear();
+		render(pBuffer, vertices, std::vector<GLuint>(quad, quad + 6));
+
+		const float *depth = pBuffer.getDepth();
+		bool covered = true;
+		for (int i = 0; i < pBuffer.getWidth() * pBuffer.getHeight(); i++)
+		{
+			covered = covered && depth[i] == 0.5f;
+		}
+		check(covered, "the quad covers every pixel without cracks");
+		check(pBuffer.isOccluded(10.0f, 10.0f, 30.0f, 20.0f, 0.8f), "a box behind the quad is occluded");
+		check(!pBuffer.isOccluded(10.0f, 10.0f, 30.0f, 20.0f, 0.3f), "a box in front of the quad is visible");
+		check(!pBuffer.isOccluded(-20.0f, -20.0f, -5.0f, -5.0f, 0.8f), "a box off screen is not occluded");
+	}
+
+	// whatever the hierarchy level, an occluded rectangle must be behind every pixel of level 0.
+	void testConservative(SoftwareDepthBuffer & pBuffer)
+	{
+		std::vector<float> vertices;
+		std::vector<GLuint> indices;
+		for (int i = 0; i < RANDOM_TRIANGLES; i++)
+		{
+			const float z = nextFloat(-0.9f, 0.9f);
+			const float cx = nextFloat(-1.2f, 1.2f);
+			const float cy = nextFloat(-1.2f, 1.2f);
+			for (int k = 0; k < 3; k++)
+			{
+				const float vertex[4] = { cx + nextFloat(-0.4f, 0.4f), cy + nextFloat(-0.4f, 0.4f), z, 1.0f };
+				vertices.insert(vertices.end(), vertex, vertex + 4);
+				indices.push_back(static_cast<GLuint>(indices.size()));
+			}
+		}
+		pBuffer.clear();
+		render(pBuffer, vertices, indices);
+
+		const float *depth = pBuffer.getDepth();
+		int occluded = 0;
+		bool conservative = true;
+		for (int i = 0; i < RANDOM_QUERIES; i++)
+		{
+			const float minX = nextFloat(-8.0f, WIDTH);
+			const float minY = nextFloat(-8.0f, HEIGHT);
+			const float maxX = minX + nextFloat(0.0f, WIDTH * 0.5f);
+			const float maxY = minY + nextFloat(0.0f, HEIGHT * 0.5f);
+			const float minDepth = nextFloat(0.0f, 1.0f);
+			if (!pBuffer.isOccluded(minX, minY, maxX, maxY, minDepth))
+			{
+				continue;
+			}
+			++occluded;
+			for (int y = std::max(0, static_cast<int>(minY)); y <= std::min(HEIGHT - 1, static_cast<int>(maxY)); y++)
+			{
+				for (int x = std::max(0, static_cast<int>(minX)); x <= std::min(pBuffer.getWidth() - 1, static_cast<int>(maxX)); x++)
+				{
+					conservative = conservative && depth[y * pBuffer.getWidth() + x] < minDepth;
+				}
+			}
+		}
+		check(conservative, "occluded rectangles are behind every pixel");
+		check(occluded > 0, "some random rectangles are occluded");
+	}
+}
+
+int main()
+{
+	SoftwareDepthBuffer buffer(WIDTH, HEIGHT);
+	testRejection(buffer);
+	testFullScreen(buffer);
+	testConservative(buffer);
+	cout << "software depth buffer: " << (sFailures ? "failed" : "passed") << endl;
+	return sFailures ? 1 : 0;
+}